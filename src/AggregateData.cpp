@@ -6,11 +6,321 @@
  */
 
 #include "AggregateData.h"
+#include "Parallel.h"
 #include <cassert>
+#include <cstring>   // memchr()
+#include <algorithm> // std::copy()
+#include <vector>
+#include <deque>
+#include <cstdio>    // fopen(), rename()
+#include <stdint.h>
 
 using namespace std;
 
+/**
+ * @brief Parse an unsigned decimal integer starting at @c *p.
+ *        Leaves @c *p pointing at the first non-digit character.
+ */
+static inline size_t parseSizeT(
+        const char ** p,
+        const char * end
+        )
+{
+    size_t value = 0;
+    const char * c = *p;
+    while ( c < end && *c >= '0' && *c <= '9' ) {
+        value = (value * 10) + (*c - '0');
+        c++;
+    }
+    *p = c;
+    return value;
+}
+
+AggregateData::AggregateData()
+: samplePeriod(6), capacity(0), stream(0),
+  streamBufferBegin(0), streamBufferEnd(0), streamEOF(true),
+  timeIndexOrigin(0), bucketWidth(6), numRetired(0)
+{}
+
+AggregateData::~AggregateData()
+{
+    closeStream();
+}
+
+/**
+ * @brief Load a Current Cost CSV file.
+ *
+ * On the first load of a CSV file a binary sidecar cache is written
+ * next to it (see writeCache()).  Later loads read the sidecar instead
+ * of re-parsing the CSV, as long as the checksum of the CSV still
+ * matches the one recorded in the sidecar.  If it doesn't match then
+ * the sidecar is thrown away and rebuilt.
+ */
 void AggregateData::loadCurrentCostData(
+        const std::string& filename, /**< including path and suffix. */
+        const bool useCache /**< read and write the binary sidecar cache? */
+    )
+{
+    cout << "Loading CurrentCost data " << filename << "..." << endl;
+
+    if ( ! Utils::fileExists( filename ) ) {
+        Utils::fatalError( "Current cost file " + filename + " does not exist." );
+    }
+
+    closeStream();
+    aggDataFilename = filename;
+    samplePeriod = 6;
+
+    size_t length;
+    const char * const file = Utils::mapFile( filename, &length );
+
+    if ( useCache ) {
+        const uint64_t checksum = Utils::checksum( file, length );
+        const string cacheFilename = filename + CACHE_SUFFIX;
+
+        if ( loadCache( cacheFilename, checksum, length ) ) {
+            cout << "Loaded " << size << " data points from cache "
+                 << cacheFilename << endl;
+        } else {
+            parseCurrentCostCsv( file, length );
+            writeCache( cacheFilename, checksum, length );
+        }
+    } else {
+        parseCurrentCostCsv( file, length );
+    }
+
+    Utils::unmapFile( file, length );
+
+    buildSearchIndices();
+
+    cout << "... done loading Current Cost data." << std::endl;
+}
+
+/**
+ * @brief Parse a single "timestamp reading" line.
+ */
+static void parseCurrentCostLine(
+        const char * p,   /**< start of line */
+        const char * end, /**< end of line */
+        AggregateSample * sample /**< output parameter */
+        )
+{
+    sample->timestamp = parseSizeT( &p, end );
+    while ( p < end && (*p == ' ' || *p == '\t' || *p == ',') ) {
+        p++; // skip separator
+    }
+    sample->reading = parseSizeT( &p, end );
+}
+
+/**
+ * @brief Parse a memory-mapped Current Cost CSV file.
+ *
+ * Large files are split at newline boundaries and parsed on several
+ * cores (see Parallel::LineChunks).  The data lines in each chunk are
+ * counted first, so every chunk can then be parsed straight into its
+ * final position in the buffer we hand to Array.  As with the original
+ * iostreams loader, any line which does not start with a digit is skipped.
+ */
+void AggregateData::parseCurrentCostCsv(
+        const char * const file, /**< first byte of the mapped file */
+        const size_t length      /**< length of the mapped file in bytes */
+        )
+{
+    Parallel::LineChunks chunks( file, length );
+
+    const size_t count = chunks.getNumDataLines();
+    AggregateSample * buffer = allocateSamples( count );
+    chunks.parseInto( buffer, parseCurrentCostLine );
+
+    adoptSamples( buffer, count, count );
+
+    cout << "Found " << count << " data points in file." << endl;
+}
+
+/**
+ * @brief Allocate a buffer suitable for handing to adoptSamples().
+ */
+AggregateSample * AggregateData::allocateSamples(
+        const size_t n
+        )
+{
+    AggregateSample * buffer = 0;
+    try {
+        buffer = new AggregateSample[ n ];
+    } catch (std::bad_alloc& ba) {
+        Utils::fatalError(std::string("Failed to allocate memory: ") + ba.what() );
+    }
+    return buffer;
+}
+
+/**
+ * @brief Hand a buffer allocated with allocateSamples() over to Array
+ *        (which will delete [] it).
+ */
+void AggregateData::adoptSamples(
+        AggregateSample * buffer,
+        const size_t n,         /**< number of valid samples in @c buffer */
+        const size_t _capacity  /**< number of samples allocated in @c buffer */
+        )
+{
+    if ( data != 0 ) {
+        delete [] data;
+    }
+    data = buffer;
+    size = n;
+    capacity = _capacity;
+
+    rebuildTimeIndex();
+    clearSearchIndices();
+}
+
+/**
+ * @brief Header for the binary sidecar cache.
+ *
+ * The header is followed by two columns, each @c count entries long:
+ * first the timestamps, delta-encoded as @c int32_t (the first entry
+ * is always 0 because @c firstTimestamp holds the first timestamp),
+ * then the readings as @c uint32_t.  Everything is stored in native
+ * byte order; the cache is not meant to be moved between machines.
+ */
+struct AggregateCacheHeader {
+    char     magic[8];       /**< @brief always CACHE_MAGIC */
+    uint32_t version;        /**< @brief bump when the layout changes */
+    uint32_t samplePeriod;   /**< @brief in seconds */
+    uint64_t firstTimestamp; /**< @brief UNIX timestamp of the first sample */
+    uint64_t count;          /**< @brief number of samples */
+    uint64_t csvLength;      /**< @brief length of the source CSV in bytes */
+    uint64_t csvChecksum;    /**< @brief Utils::checksum() of the source CSV */
+};
+
+static const char     CACHE_MAGIC[8] = {'A','G','G','C','A','C','H','E'};
+static const uint32_t CACHE_VERSION  = 1;
+
+const std::string AggregateData::CACHE_SUFFIX = ".aggcache";
+const size_t AggregateData::TIME_OUT_OF_RANGE;
+
+/**
+ * @brief Try to load samples from the binary sidecar cache.
+ *
+ * @return false if the cache does not exist, is from an incompatible
+ *         version, is truncated or was built from a different CSV.
+ */
+const bool AggregateData::loadCache(
+        const std::string& cacheFilename,
+        const uint64_t csvChecksum,
+        const size_t csvLength
+        )
+{
+    if ( ! Utils::fileExists( cacheFilename ) )
+        return false;
+
+    size_t length;
+    const char * const cache = Utils::mapFile( cacheFilename, &length );
+
+    AggregateCacheHeader header;
+    bool valid = (length >= sizeof(header));
+    if ( valid ) {
+        memcpy( &header, cache, sizeof(header) );
+        valid = memcmp( header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC) ) == 0
+                && header.version     == CACHE_VERSION
+                && header.csvLength   == csvLength
+                && header.csvChecksum == csvChecksum
+                && length == sizeof(header) + header.count * (sizeof(int32_t) + sizeof(uint32_t));
+    }
+
+    if ( ! valid ) {
+        cout << "Cache " << cacheFilename << " is stale. Rebuilding it." << endl;
+        Utils::unmapFile( cache, length );
+        return false;
+    }
+
+    const int32_t  * const deltas   =
+            reinterpret_cast<const int32_t *>( cache + sizeof(header) );
+    const uint32_t * const readings =
+            reinterpret_cast<const uint32_t *>( deltas + header.count );
+
+    AggregateSample * buffer = allocateSamples( header.count );
+    size_t timestamp = header.firstTimestamp;
+    for (size_t i=0; i<header.count; i++) {
+        timestamp += deltas[i];
+        buffer[i].timestamp = timestamp;
+        buffer[i].reading   = readings[i];
+    }
+
+    Utils::unmapFile( cache, length );
+
+    adoptSamples( buffer, header.count, header.count );
+    samplePeriod = header.samplePeriod;
+
+    return true;
+}
+
+/**
+ * @brief Write the loaded samples to the binary sidecar cache.
+ *
+ * The cache is written to a temporary file which is then renamed, so
+ * a half-written cache is never picked up by loadCache().  Failure to
+ * write the cache is not fatal; we just carry on without one.
+ */
+void AggregateData::writeCache(
+        const std::string& cacheFilename,
+        const uint64_t csvChecksum,
+        const size_t csvLength
+        ) const
+{
+    AggregateCacheHeader header;
+    memcpy( header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC) );
+    header.version        = CACHE_VERSION;
+    header.samplePeriod   = samplePeriod;
+    header.firstTimestamp = (size ? data[0].timestamp : 0);
+    header.count          = size;
+    header.csvLength      = csvLength;
+    header.csvChecksum    = csvChecksum;
+
+    // Build the two columns, checking everything fits into 32 bits.
+    std::vector<int32_t>  deltas( size );
+    std::vector<uint32_t> readings( size );
+    size_t prevTimestamp = header.firstTimestamp;
+    for (size_t i=0; i<size; i++) {
+        const long long delta = (long long)data[i].timestamp - (long long)prevTimestamp;
+        if ( delta > INT32_MAX || delta < INT32_MIN || data[i].reading > UINT32_MAX ) {
+            cout << "Data won't fit in cache format. Not writing cache." << endl;
+            return;
+        }
+        deltas[i]     = delta;
+        readings[i]   = data[i].reading;
+        prevTimestamp = data[i].timestamp;
+    }
+
+    const string tmpFilename = cacheFilename + ".tmp";
+    FILE * fp = fopen( tmpFilename.c_str(), "wb" );
+    if ( fp == NULL ) {
+        cout << "Failed to open " << tmpFilename << " for writing. Not writing cache." << endl;
+        return;
+    }
+
+    bool ok = fwrite( &header, sizeof(header), 1, fp ) == 1;
+    if ( size ) {
+        ok = ok && fwrite( &deltas[0],   sizeof(int32_t),  size, fp ) == size;
+        ok = ok && fwrite( &readings[0], sizeof(uint32_t), size, fp ) == size;
+    }
+    ok = (fclose( fp ) == 0) && ok;
+
+    if ( ok && rename( tmpFilename.c_str(), cacheFilename.c_str() ) == 0 ) {
+        cout << "Wrote cache " << cacheFilename << endl;
+    } else {
+        cout << "Failed to write cache " << cacheFilename << endl;
+        remove( tmpFilename.c_str() );
+    }
+}
+
+/**
+ * @brief The original two-pass iostreams loader.
+ *
+ * @deprecated superseded by loadCurrentCostData().  Kept so the
+ * tests can check the two loaders agree and compare their speed.
+ */
+void AggregateData::loadCurrentCostDataWithIostreams(
         const std::string& filename /**< including path and suffix. */
     )
 {
@@ -39,10 +349,258 @@ void AggregateData::loadCurrentCostData(
         }
         fs.ignore( 255, '\n' );  // skip to next line
     }
+    capacity = size;
+
+    rebuildTimeIndex();
+    buildSearchIndices();
 
     cout << "... done loading Current Cost data." << std::endl;
 }
 
+/**
+ * @brief Open a Current Cost CSV file for streaming.
+ *
+ * No samples are read until streamSamplesUntil() is called.  In
+ * streaming mode, @c data only ever holds a window of samples: the
+ * window is extended with streamSamplesUntil() and shrunk from the
+ * front with retireSamplesBefore().  All the search functions
+ * (findSpike(), findTime(), readingGoesBelowPowerState() etc.)
+ * work on whatever is currently in the window.
+ */
+void AggregateData::openCurrentCostStream(
+        const std::string& filename /**< including path and suffix. */
+        )
+{
+    cout << "Streaming CurrentCost data from " << filename << "..." << endl;
+
+    closeStream();
+
+    stream = fopen( filename.c_str(), "rb" );
+    if ( stream == NULL ) {
+        Utils::fatalError( "Failed to open " + filename + " for reading." );
+    }
+
+    aggDataFilename = filename;
+    samplePeriod = 6;
+    size = 0;
+    rebuildTimeIndex();
+    streamBuffer.resize( 1 << 20 );
+    streamBufferBegin = streamBufferEnd = 0;
+    streamEOF = false;
+}
+
+/**
+ * @brief Read samples from the stream until the last sample in the window
+ *        is at or after @c time, or until we run out of samples.
+ *
+ * @return false if the end of the stream has been reached.
+ */
+const bool AggregateData::streamSamplesUntil(
+        const size_t time /**< UNIX timestamp */
+        )
+{
+    AggregateSample sample;
+    while ( (size == 0 || data[size-1].timestamp < time) && readSampleFromStream( &sample ) ) {
+        appendSample( sample );
+    }
+
+    return ! endOfStream();
+}
+
+/**
+ * @brief Drop every sample with a timestamp before @c time from the front of
+ *        the window.  The memory is kept for re-use by streamSamplesUntil().
+ */
+void AggregateData::retireSamplesBefore(
+        const size_t time /**< UNIX timestamp */
+        )
+{
+    size_t first = 0;
+    while ( first < size && data[first].timestamp < time ) {
+        first++;
+    }
+
+    if ( first == 0 )
+        return;
+
+    std::copy( data + first, data + size, data );
+    size -= first;
+
+    retireFromTimeIndex( first );
+    clearSearchIndices();
+}
+
+/**
+ * @brief Append @c n samples to the end of the window, e.g. as they
+ *        arrive from a meter.  They must be later than every sample
+ *        already in the window and in time order.
+ */
+void AggregateData::appendSamples(
+        const AggregateSample * samples,
+        const size_t n
+        )
+{
+    for (size_t i=0; i<n; i++) {
+        if ( (i > 0 && samples[i].timestamp <= samples[i-1].timestamp) ||
+             (i == 0 && size > 0 && samples[0].timestamp <= data[size-1].timestamp) ) {
+            Utils::fatalError( "Samples must be appended in time order." );
+        }
+    }
+
+    reserveSamples( size + n );
+    std::copy( samples, samples + n, data + size );
+    size += n;
+    indexSamplesFrom( size-n );
+    clearSearchIndices();
+}
+
+const bool AggregateData::isStreaming() const
+{
+    return stream != 0;
+}
+
+const bool AggregateData::endOfStream() const
+{
+    return streamEOF && streamBufferBegin == streamBufferEnd;
+}
+
+/**
+ * @return the number of samples currently allocated.  In streaming
+ *         mode this is the high-water mark of the window size.
+ */
+const size_t AggregateData::getCapacity() const
+{
+    return capacity;
+}
+
+/**
+ * @brief Append a sample to the end of the window, growing @c data if required.
+ */
+void AggregateData::appendSample(
+        const AggregateSample& sample
+        )
+{
+    reserveSamples( size + 1 );
+    data[ size++ ] = sample;
+    indexSamplesFrom( size-1 );
+    clearSearchIndices();
+}
+
+/**
+ * @brief Make sure @c data has room for at least @c n samples, keeping
+ *        the samples already in it.  Grows geometrically.
+ */
+void AggregateData::reserveSamples(
+        const size_t n
+        )
+{
+    if ( n <= capacity )
+        return;
+
+    size_t newCapacity = (capacity < 1024) ? 1024 : capacity * 2;
+    if ( newCapacity < n )
+        newCapacity = n;
+
+    AggregateSample * buffer = allocateSamples( newCapacity );
+    std::copy( data, data + size, buffer );
+    adoptSamples( buffer, size, newCapacity );
+}
+
+/**
+ * @brief Parse a Current Cost CSV file and append its samples to the end
+ *        of @c data.  Used by AggregateDataset to build a window which
+ *        spans several files.  The file must start after the last sample
+ *        already held.
+ */
+void AggregateData::appendCurrentCostData(
+        const std::string& filename /**< including path and suffix. */
+        )
+{
+    cout << "Appending CurrentCost data " << filename << "..." << endl;
+
+    size_t length;
+    const char * const file = Utils::mapFile( filename, &length );
+
+    Parallel::LineChunks chunks( file, length );
+    const size_t n = chunks.getNumDataLines();
+    reserveSamples( size + n );
+    chunks.parseInto( data + size, parseCurrentCostLine );
+
+    Utils::unmapFile( file, length );
+
+    if ( n > 0 && size > 0 && data[size].timestamp <= data[size-1].timestamp ) {
+        Utils::fatalError( filename + " overlaps the aggregate data already loaded." );
+    }
+
+    size += n;
+    indexSamplesFrom( size-n );
+    clearSearchIndices();
+}
+
+/**
+ * @brief Parse the next sample from @c stream.  As with loadCurrentCostData(),
+ *        lines which don't start with a digit are skipped.
+ *
+ * @return false if there are no more samples in the stream.
+ */
+const bool AggregateData::readSampleFromStream(
+        AggregateSample * sample /**< return parameter */
+        )
+{
+    if ( stream == 0 )
+        return false;
+
+    while ( true ) {
+        // Find the end of the next line in the buffer
+        const char * const begin = &streamBuffer[0] + streamBufferBegin;
+        const char * const end   = &streamBuffer[0] + streamBufferEnd;
+        const char * eol = static_cast<const char *>( memchr( begin, '\n', end - begin ) );
+
+        if ( eol == 0 && ! streamEOF ) {
+            // Move the partial line to the front of the buffer and top up from the file
+            const size_t remaining = streamBufferEnd - streamBufferBegin;
+            memmove( &streamBuffer[0], begin, remaining );
+            if ( remaining == streamBuffer.size() ) {
+                streamBuffer.resize( streamBuffer.size() * 2 ); // very long line
+            }
+            streamBufferBegin = 0;
+            streamBufferEnd = remaining +
+                    fread( &streamBuffer[remaining], 1, streamBuffer.size() - remaining, stream );
+            if ( streamBufferEnd == remaining ) {
+                streamEOF = true;
+            }
+            continue;
+        }
+
+        if ( begin == end ) {
+            return false; // nothing left
+        }
+
+        const char * lineEnd = (eol == 0) ? end : eol;
+        const char * p = begin;
+        streamBufferBegin = (lineEnd - &streamBuffer[0]) + ((eol == 0) ? 0 : 1);
+
+        if ( isdigit( (unsigned char)*p ) ) {
+            sample->timestamp = parseSizeT( &p, lineEnd );
+            while ( p < lineEnd && (*p == ' ' || *p == '\t' || *p == ',') ) {
+                p++; // skip separator
+            }
+            sample->reading = parseSizeT( &p, lineEnd );
+            return true;
+        }
+    }
+}
+
+void AggregateData::closeStream()
+{
+    if ( stream != 0 ) {
+        fclose( stream );
+        stream = 0;
+    }
+    streamEOF = true;
+    streamBufferBegin = streamBufferEnd = 0;
+}
+
 const string AggregateData::getFilename() const
 {
     return aggDataFilename;
@@ -142,22 +700,180 @@ const bool AggregateData::readingGoesBelowPowerState(
         const Statistic<Sample_t>& powerState
         ) const
 {
-    size_t i = findTime( startTime );
-    i++;
-    size_t time = data[i].timestamp;
+    return readingGoesBelow( startTime, endTime, powerState.min );
+}
+
+/**
+ * @brief Does any sample after the one at @c startTime and before
+ *        @c endTime have a reading lower than @c threshold ?
+ *
+ * Takes constant time when the data was loaded in one go (using
+ * @c readingMinimum ).  Otherwise scans the samples.
+ */
+const bool AggregateData::readingGoesBelow(
+        const size_t startTime,
+        const size_t endTime,
+        const double threshold
+        ) const
+{
+    if ( size == 0 )
+        return false;
+
+    size_t first = findTime( startTime );
+    if ( first == TIME_OUT_OF_RANGE ) {
+        if ( startTime > data[size-1].timestamp )
+            return false; // nothing to check
+        first = 0;
+    } else {
+        first++;
+    }
 
-    while (time < endTime && i < size) {
+    // one past the last sample before endTime
+    size_t last;
+    if ( endTime > data[size-1].timestamp )
+        last = size;
+    else if ( endTime <= data[0].timestamp )
+        last = 0;
+    else
+        last = findTime( endTime-1 ) + 1;
+
+    if ( first >= last )
+        return false;
+
+    if ( readingMinimum.size() == size ) {
+        return readingMinimum.min( first, last ) < threshold;
+    }
 
-        if ( data[i].reading < powerState.min ) {
+    for (size_t i=first; i<last; i++) {
+        if ( data[i].reading < threshold ) {
             return true;
         }
-
-        time = data[++i].timestamp;
     }
 
     return false;
 }
 
+/**
+ * @brief Batch version of readingGoesBelow().
+ *
+ * @c results[q] is set to the answer for @c queries[q].
+ */
+void AggregateData::readingsGoBelow(
+        const std::vector<ReadingQuery>& queries,
+        std::vector<bool> * results /**< output parameter */
+        ) const
+{
+    results->resize( queries.size() );
+    for (size_t q=0; q<queries.size(); q++) {
+        (*results)[q] = readingGoesBelow( queries[q].startTime, queries[q].endTime, queries[q].threshold );
+    }
+}
+
+/**
+ * @return a stdev which isn't so small that it'll not provide sufficient
+ *         headroom when trying to find deltas in the noisy aggregate data.
+ */
+static const double fakedStdev(
+        const double mean
+        )
+{
+    if (mean < 500) {
+        return fabs(mean/5);
+    } else if (mean < 1000) {
+        return fabs(mean/10);
+    } else {
+        // mean > 1000
+        return fabs(mean/17);
+    }
+}
+
+/**
+ * @brief Work out the limits findSpike() uses to look for a spike which
+ *        fits @c spikeStats.  Doing this once per search (rather than once
+ *        per sample or once per call) lets findSpikes() share one pass
+ *        over the data between several searches.
+ */
+AggregateData::SpikeSearch::SpikeSearch(
+        const Statistic<Sample_t>& spikeStats
+        )
+: mean( spikeStats.mean ),
+  stdev( spikeStats.nonZeroStdev() )
+{
+    setLimits( spikeStats.min, spikeStats.max, fakedStdev( spikeStats.mean ) );
+}
+
+/**
+ * @brief As above, but if @c tailQuantile > 0 and @c spikeStats has seen
+ *        enough data points then the limits come from its learned
+ *        quantiles: the search looks around the
+ *        [tailQuantile, 1-tailQuantile] quantile range rather than
+ *        [min, max], with headroom based on the inter-quartile range
+ *        rather than on a fraction of the mean.  A few outliers in
+ *        training then no longer widen the search.
+ */
+AggregateData::SpikeSearch::SpikeSearch(
+        const Statistic< Sample_t, SketchedMoments<Sample_t> >& spikeStats,
+        const double tailQuantile /**< 0 to use the same limits as for a plain Statistic */
+        )
+: mean( spikeStats.mean ),
+  stdev( spikeStats.nonZeroStdev() )
+{
+    if ( tailQuantile > 0 && spikeStats.numDataPoints >= MIN_DATA_POINTS_FOR_QUANTILES ) {
+        // For a normal distribution the inter-quartile range is 1.349 stdevs.
+        // As in Statistic::nonZeroStdev(), fall back to a tenth of the
+        // mean if the spread is negligible.
+        double spread = (spikeStats.quantile(0.75) - spikeStats.quantile(0.25)) / 1.349;
+        if (spread < 1)
+            spread = fabs(spikeStats.mean/10);
+
+        setLimits( spikeStats.quantile( tailQuantile ), spikeStats.quantile( 1 - tailQuantile ), spread );
+    } else {
+        setLimits( spikeStats.min, spikeStats.max, fakedStdev( spikeStats.mean ) );
+    }
+}
+
+/**
+ * @brief Set the wide limits to [lower, upper] plus 5 times @c headroom
+ *        either side and the narrow limits to [lower, upper] plus 1.5
+ *        times @c headroom either side.
+ */
+void AggregateData::SpikeSearch::setLimits(
+        const double lower,
+        const double upper,
+        const double headroom
+        )
+{
+    const double e = headroom * 5;
+    double wideLowerLimit = lower - e;
+    double wideUpperLimit = upper + e;
+    double narrowLowerLimit = lower - (headroom*1.5);
+    double narrowUpperLimit = upper + (headroom*1.5);
+
+    // make sure we're at least looking for a spike of the correct sign
+    if ( ! Utils::sameSign(wideLowerLimit, mean) )
+        wideLowerLimit = 0;
+    if ( ! Utils::sameSign(wideUpperLimit, mean) )
+        wideUpperLimit = 0;
+
+    // Utils::between() doesn't care which way round its bounds are
+    wideLower   = std::min( wideLowerLimit, wideUpperLimit );
+    wideUpper   = std::max( wideLowerLimit, wideUpperLimit );
+    narrowLower = std::min( narrowLowerLimit, narrowUpperLimit );
+    narrowUpper = std::max( narrowLowerLimit, narrowUpperLimit );
+}
+
+/**
+ * @brief likelihood() of each of the @c n values in @c x, in one batch.
+ */
+void AggregateData::SpikeSearch::likelihoods(
+        const double * x,
+        const size_t n,
+        double * results /**< output parameter.  Must have room for @c n values. */
+        ) const
+{
+    Likelihood::normalisedGaussian( x, n, mean, stdev, results );
+}
+
 /**
  * @brief Find all spikes in aggregate data which fit @c spikeStats.
  */
@@ -167,127 +883,537 @@ list<AggregateData::FoundSpike> AggregateData::findSpike(
         size_t endTime, /**< The UNIX timecode marking the end of the search window. */
         const bool verbose
         ) const
+{
+    return findSpike( SpikeSearch( spikeStats ), startTime, endTime, verbose );
+}
+
+/**
+ * @brief Find all spikes in aggregate data which fit @c search.
+ */
+list<AggregateData::FoundSpike> AggregateData::findSpike(
+        const SpikeSearch& search,
+        size_t startTime, /**< The UNIX timecode marking the start of the search window. */
+        size_t endTime, /**< The UNIX timecode marking the end of the search window. */
+        const bool verbose
+        ) const
 {
     if (verbose) cout << "startTime = " << startTime-1310252400 << " endTime = " << endTime-1310252400 << endl;
 
     size_t i = checkStartAndEndTimes( &startTime, &endTime );
     list<AggregateData::FoundSpike> foundSpikes;
 
-    // Make sure the stdev isn't so small that it'll not provide
-    // sufficient headroom when trying to find deltas in the
-    // noisy aggregate data.
-    double fakedStdev = spikeStats.stdev;
-    if (spikeStats.mean < 500) {
-        fakedStdev = fabs(spikeStats.mean/5);
-    } else if (spikeStats.mean < 1000) {
-        fakedStdev = fabs(spikeStats.mean/10);
-    } else {
-        // spikeStats.mean > 1000
-        fakedStdev = fabs(spikeStats.mean/17);
+    if (verbose) {
+        cout << "Looking for spike with mean " << search.mean
+             << " between vals " << search.wideLower
+             << " to " << search.wideUpper << " and times "
+             << startTime-1310252400 << " - " << endTime-1310252400 << endl;
     }
 
-    const double e = fakedStdev * 5;
-    double wideLowerLimit = spikeStats.min - e;
-    double wideUpperLimit = spikeStats.max + e;
-    double narrowLowerLimit = spikeStats.min - (fakedStdev*1.5);
-    double narrowUpperLimit = spikeStats.max + (fakedStdev*1.5);
+    if ( deltaColumns[0].size() != size ) {
+        // No delta columns (e.g. we're streaming) so work out the deltas as we go
+        size_t time = startTime;
+        int variations[NUM_VARIATIONS]; // used for trying aggDelta(i), aggDelta(i)+aggDelta(i+1), aggDelta(i)+aggDelta(i-1), aD(i-1)+aD(i)+aD(i+1)
+        while (time < endTime && i < size) {
 
-    // make sure we're at least looking for a spike of the correct sign
-    if ( ! Utils::sameSign(wideLowerLimit, spikeStats.mean) )
-        wideLowerLimit = 0;
-    if ( ! Utils::sameSign(wideUpperLimit, spikeStats.mean) )
-        wideUpperLimit = 0;
+            variations[0] = aggDelta(i);
 
-    if (verbose) {
-        cout << "Looking for spike with mean " << spikeStats.mean
-             << " between vals " << wideLowerLimit
-             << " to " << wideUpperLimit << " and times "
-             << startTime-1310252400 << " - " << endTime-1310252400 << endl;
+            if ( search.wideMatch( variations[0] ) ) {
+                getVariations( i, variations );
+                checkVariations( variations, time, search, &foundSpikes, verbose );
+            }
+
+            time = data[++i].timestamp;
+        }
+
+        return foundSpikes;
     }
 
-    boost::math::normal dist(spikeStats.mean, spikeStats.nonZeroStdev() );
-    // see http://live.boost.org/doc/libs/1_42_0/libs/math/doc/sf_and_dist/html/math_toolkit/dist/dist_ref/dists/normal_dist.html
+    if ( i >= size )
+        return foundSpikes;
 
-    size_t time = startTime;
-    int variations[4]; // used for trying aggDelta(i), aggDelta(i)+aggDelta(i+1), aggDelta(i)+aggDelta(i-1), aD(i-1)+aD(i)+aD(i+1)
-    while (time < endTime && i < size) {
+    // The window covers samples [i, windowEnd).  The first sample in the
+    // window is always tested, and is reported with timestamp startTime.
+    const size_t firstInWindow = i;
+    const size_t windowEnd = findWindowEnd( firstInWindow, endTime );
 
-        variations[0] = aggDelta(i);
+    // Find the range of the value-sorted index whose delta lies within the wide limits
+    DeltaIsBelow isBelow( &deltaColumns[0] );
+    DeltaIsAbove isAbove( &deltaColumns[0] );
+    const vector<uint32_t>::const_iterator beginOfRange =
+            std::lower_bound( deltaIndex.begin(), deltaIndex.end(), search.wideLower, isBelow );
+    const vector<uint32_t>::const_iterator endOfRange =
+            std::upper_bound( beginOfRange, deltaIndex.end(), search.wideUpper, isAbove );
 
-        if ( Utils::between(wideLowerLimit, wideUpperLimit, variations[0]) ) {
+    // Get the candidates in time order, either from the sorted index
+    // (if fewer samples match the wide limits than there are samples in
+    // the window) or by scanning the window.
+    vector<uint32_t> candidates;
+    if ( (size_t)(endOfRange - beginOfRange) < (windowEnd - firstInWindow) ) {
+        for (vector<uint32_t>::const_iterator it=beginOfRange; it!=endOfRange; it++) {
+            if ( *it >= firstInWindow && *it < windowEnd )
+                candidates.push_back( *it );
+        }
+        std::sort( candidates.begin(), candidates.end() );
+    } else {
+        const int32_t * const column = &deltaColumns[0][0];
+        for (size_t j=firstInWindow; j<windowEnd; j++) {
+            if ( search.wideMatch( column[j] ) )
+                candidates.push_back( j );
+        }
+    }
+
+    int variations[NUM_VARIATIONS];
+    for (vector<uint32_t>::const_iterator c=candidates.begin(); c!=candidates.end(); c++) {
+        getVariations( *c, variations );
+        checkVariations( variations, (*c == firstInWindow) ? startTime : data[*c].timestamp,
+                search, &foundSpikes, verbose );
+    }
+
+    return foundSpikes;
+}
 
-            variations[1] = variations[0] + aggDelta(i+1);
-            variations[2] = variations[0] + aggDelta(i-1);
-            variations[3] = variations[0] + aggDelta(i+1) + aggDelta(i-1);
+/**
+ * @brief Answer several findSpike() queries in a single pass.
+ *
+ * The windows of the queries are merged and each sample in the union
+ * of the windows is read once.  Each sample's delta is then tested
+ * against every query whose window contains it.  This is much cheaper
+ * than calling findSpike() once per query when the windows overlap, as
+ * they do when PowerStateGraph::traceToEnd() searches for all the
+ * out-edges of a vertex.
+ *
+ * @c results[q] is set to exactly what findSpike() would return for
+ * @c queries[q].
+ */
+void AggregateData::findSpikes(
+        const std::vector<SpikeQuery>& queries,
+        std::vector< std::list<FoundSpike> > * results /**< output parameter */
+        ) const
+{
+    const size_t numQueries = queries.size();
+    results->assign( numQueries, list<FoundSpike>() );
 
-            for (size_t var_i=0; var_i<4; var_i++) {
-                if ( Utils::between(narrowLowerLimit, narrowUpperLimit, variations[var_i]) ) {
+    // Sanitise each query's times and convert them into a window of samples
+    vector<size_t> startTimes( numQueries ), firstInWindow( numQueries ), windowEnd( numQueries );
+    vector< pair<size_t, size_t> > windows; // (first, end) pairs
+    for (size_t q=0; q<numQueries; q++) {
+        size_t startTime = queries[q].startTime;
+        size_t endTime   = queries[q].endTime;
+        firstInWindow[q] = checkStartAndEndTimes( &startTime, &endTime );
+        startTimes[q]    = startTime;
+        if ( firstInWindow[q] >= size ) {
+            windowEnd[q] = firstInWindow[q]; // empty
+            continue;
+        }
+        windowEnd[q] = findWindowEnd( firstInWindow[q], endTime );
+        windows.push_back( make_pair( firstInWindow[q], windowEnd[q] ) );
+    }
 
-                    double normalisedLikelihood =
-                            spikeStats.normalisedLikelihood( variations[var_i] );
+    // Sweep through the union of the windows
+    std::sort( windows.begin(), windows.end() );
+    size_t i = 0;
+    int variations[NUM_VARIATIONS];
+    for (vector< pair<size_t, size_t> >::const_iterator w=windows.begin(); w!=windows.end(); w++) {
+        if ( i < w->first )
+            i = w->first;
 
-                    foundSpikes.push_back(
-                            FoundSpike(
-                                    time,
-                                    variations[var_i],
-                                    normalisedLikelihood
-                            ) );
+        for (; i < w->second; i++) {
+            const int delta = aggDeltaFromColumn( i );
+            bool haveVariations = false;
 
-                    if (verbose) cout << "Spike found with delta " << variations[var_i]
-                                      << " expected " << spikeStats.mean << endl;
+            for (size_t q=0; q<numQueries; q++) {
+                if ( i < firstInWindow[q] || i >= windowEnd[q] || ! queries[q].search.wideMatch( delta ) )
+                    continue;
 
-                    break;
+                if ( ! haveVariations ) {
+                    getVariations( i, variations );
+                    haveVariations = true;
                 }
+
+                checkVariations( variations, (i == firstInWindow[q]) ? startTimes[q] : data[i].timestamp,
+                        queries[q].search, &(*results)[q], false );
             }
         }
+    }
+}
 
-        time = data[++i].timestamp;
+/**
+ * @return true if findAllSpikes() can be used, i.e. the data was loaded
+ *         in one go and so has delta columns (see buildSearchIndices()).
+ */
+const bool AggregateData::canTabulateSpikes() const
+{
+    return size > 0 && deltaColumns[0].size() == size;
+}
+
+/**
+ * @brief Find every spike in the whole of the data which fits @c search.
+ *
+ * The table can then answer findSpike() queries for any window with
+ * two binary searches (see findSpikes()), which pays off when the same
+ * search is made over many short windows.  The table is only valid
+ * until the data changes.  canTabulateSpikes() must be true.
+ */
+void AggregateData::findAllSpikes(
+        const SpikeSearch& search,
+        SpikeTable * table /**< output parameter */
+        ) const
+{
+    assert( canTabulateSpikes() );
+
+    table->samples.clear();
+    table->spikes.clear();
+    table->numSamples = size;
+
+    // The samples whose delta lies within the wide limits, in time order.
+    // Sorting them out of the value-sorted index only pays if there are
+    // few of them; otherwise scan the whole column.
+    DeltaIsBelow isBelow( &deltaColumns[0] );
+    DeltaIsAbove isAbove( &deltaColumns[0] );
+    const vector<uint32_t>::const_iterator beginOfRange =
+            std::lower_bound( deltaIndex.begin(), deltaIndex.end(), search.wideLower, isBelow );
+    const vector<uint32_t>::const_iterator endOfRange =
+            std::upper_bound( beginOfRange, deltaIndex.end(), search.wideUpper, isAbove );
+
+    vector<uint32_t> candidates;
+    if ( (size_t)(endOfRange - beginOfRange) * 32 < size ) {
+        candidates.assign( beginOfRange, endOfRange );
+        std::sort( candidates.begin(), candidates.end() );
+    } else {
+        const int32_t * const column = &deltaColumns[0][0];
+        for (size_t j=0; j<size; j++) {
+            if ( search.wideMatch( column[j] ) )
+                candidates.push_back( j );
+        }
     }
 
-    return foundSpikes;
+    int variations[NUM_VARIATIONS];
+    vector<double> deltas;
+    for (vector<uint32_t>::const_iterator c=candidates.begin(); c!=candidates.end(); c++) {
+        getVariations( *c, variations );
+        const int var_i = firstNarrowMatch( variations, search );
+        if ( var_i < 0 )
+            continue;
+
+        table->samples.push_back( *c );
+        deltas.push_back( variations[var_i] );
+    }
+
+    // Work out the likelihoods of all the spikes' deltas in one batch
+    vector<double> likelihoods( deltas.size() );
+    if ( ! deltas.empty() )
+        search.likelihoods( &deltas[0], deltas.size(), &likelihoods[0] );
+
+    table->spikes.reserve( deltas.size() );
+    for (size_t s=0; s<deltas.size(); s++) {
+        table->spikes.push_back(
+                FoundSpike(
+                        data[ table->samples[s] ].timestamp,
+                        deltas[s],
+                        likelihoods[s]
+                ) );
+    }
+}
+
+/**
+ * @brief Append to @c foundSpikes exactly what findSpike() would return
+ *        for the window from @c startTime to @c endTime, using a table
+ *        made by findAllSpikes().
+ */
+void AggregateData::findSpikes(
+        const SpikeTable& table,
+        size_t startTime,
+        size_t endTime,
+        vector<FoundSpike> * foundSpikes /**< output parameter */
+        ) const
+{
+    assert( table.numSamples == size );
+
+    const size_t firstInWindow = checkStartAndEndTimes( &startTime, &endTime );
+    if ( firstInWindow >= size )
+        return;
+    const size_t windowEnd = findWindowEnd( firstInWindow, endTime );
+
+    const vector<uint32_t>::const_iterator first =
+            std::lower_bound( table.samples.begin(), table.samples.end(), firstInWindow );
+    const vector<uint32_t>::const_iterator last =
+            std::lower_bound( first, table.samples.end(), windowEnd );
+
+    for (vector<uint32_t>::const_iterator s=first; s!=last; s++) {
+        foundSpikes->push_back( table.spikes[ s - table.samples.begin() ] );
+        // The first sample in the window is reported with timestamp startTime
+        if ( *s == firstInWindow )
+            foundSpikes->back().timestamp = startTime;
+    }
+}
+
+/**
+ * @return one past the last sample which findSpike() tests for a window
+ *         starting at sample @c first and ending at @c endTime.
+ */
+const size_t AggregateData::findWindowEnd(
+        const size_t first,
+        const size_t endTime
+        ) const
+{
+    size_t windowEnd = findTime( endTime-1 ) + 1;
+    if ( windowEnd <= first )
+        windowEnd = first+1;
+    if ( windowEnd > size )
+        windowEnd = size;
+    return windowEnd;
+}
+
+/**
+ * @return aggDelta(i), from the delta columns if we have them.
+ */
+const int AggregateData::aggDeltaFromColumn(
+        const size_t i
+        ) const
+{
+    return ( deltaColumns[0].size() == size ) ? deltaColumns[0][i] : aggDelta(i);
+}
+
+/**
+ * @brief Fill @c variations with aggDelta(i), aggDelta(i)+aggDelta(i+1),
+ *        aggDelta(i)+aggDelta(i-1) and aggDelta(i-1)+aggDelta(i)+aggDelta(i+1).
+ */
+void AggregateData::getVariations(
+        const size_t i,
+        int * variations /**< output parameter: NUM_VARIATIONS ints */
+        ) const
+{
+    if ( deltaColumns[0].size() == size ) {
+        for (size_t var_i=0; var_i<NUM_VARIATIONS; var_i++) {
+            variations[var_i] = deltaColumns[var_i][i];
+        }
+    } else {
+        variations[0] = aggDelta(i);
+        variations[1] = variations[0] + aggDelta(i+1);
+        variations[2] = variations[0] + aggDelta(i-1);
+        variations[3] = variations[0] + aggDelta(i+1) + aggDelta(i-1);
+    }
 }
 
 /**
- * @brief a simple way to find the array index at which a timestamp occurs.
+ * @return the index of the first of the @c variations which lies within
+ *         the narrow limits of @c search, or -1 if none do.
+ */
+const int AggregateData::firstNarrowMatch(
+        const int * variations, /**< NUM_VARIATIONS deltas */
+        const SpikeSearch& search
+        )
+{
+    for (size_t var_i=0; var_i<NUM_VARIATIONS; var_i++) {
+        if ( search.narrowMatch( variations[var_i] ) )
+            return var_i;
+    }
+    return -1;
+}
+
+/**
+ * @brief If any of the @c variations lies within the narrow limits then add
+ *        the first one which does to @c foundSpikes.  Used by findSpike().
+ */
+void AggregateData::checkVariations(
+        const int * variations, /**< NUM_VARIATIONS deltas */
+        const size_t time,
+        const SpikeSearch& search,
+        list<FoundSpike> * foundSpikes, /**< output parameter */
+        const bool verbose
+        )
+{
+    const int var_i = firstNarrowMatch( variations, search );
+    if ( var_i < 0 )
+        return;
+
+    foundSpikes->push_back(
+            FoundSpike(
+                    time,
+                    variations[var_i],
+                    search.likelihood( variations[var_i] )
+            ) );
+
+    if (verbose) cout << "Spike found with delta " << variations[var_i]
+                      << " expected " << search.mean << endl;
+}
+
+/**
+ * @brief Precompute aggDelta(i) and the 2- and 3-sample merged deltas
+ *        which findSpike() tries, build an index of samples sorted
+ *        by aggDelta(i) and build the range-minimum structure over the
+ *        readings used by readingGoesBelow().
+ *
+ * Only built for data which is loaded in one go.  Streaming and
+ * appending clear the columns, and findSpike() then falls back to
+ * working out the deltas as it goes.
+ */
+void AggregateData::buildSearchIndices()
+{
+    clearSearchIndices();
+
+    if ( size > (size_t)UINT32_MAX ) {
+        return; // index wouldn't fit in 32 bits
+    }
+
+    for (size_t var_i=0; var_i<NUM_VARIATIONS; var_i++) {
+        deltaColumns[var_i].resize( size );
+    }
+
+    for (size_t i=0; i<size; i++) {
+        const int d    = aggDelta(i);
+        const int next = aggDelta(i+1);
+        const int prev = aggDelta(i-1);
+        deltaColumns[0][i] = d;
+        deltaColumns[1][i] = d + next;
+        deltaColumns[2][i] = d + prev;
+        deltaColumns[3][i] = d + next + prev;
+    }
+
+    deltaIndex.resize( size );
+    for (size_t i=0; i<size; i++) {
+        deltaIndex[i] = i;
+    }
+    std::stable_sort( deltaIndex.begin(), deltaIndex.end(), DeltaIsLess( &deltaColumns[0] ) );
+
+    readingMinimum.build( ReadingIterator( data ), size );
+}
+
+void AggregateData::clearSearchIndices()
+{
+    for (size_t var_i=0; var_i<NUM_VARIATIONS; var_i++) {
+        deltaColumns[var_i].clear();
+    }
+    deltaIndex.clear();
+    readingMinimum.clear();
+}
+
+/**
+ * @brief Find the array index at which a timestamp occurs.
  * If precise time cannot be found, returns the index to the
  * sample immediately prior.
- * Terminates program if time is out of range (as this is always fatal).
  *
- * This implements a kind of "poor man's" hash function and
- * should probably be re-written as a hash-function.
+ * Uses the bucketed time index (see rebuildTimeIndex()) to jump to
+ * the right bucket and then binary searches the samples within it.
+ * Timestamps are strictly increasing so a bucket holds at most
+ * @c bucketWidth samples, and usually only one or two.
  *
- * @return the array index at which @c time is located.
+ * @return the array index at which @c time is located, or
+ *         TIME_OUT_OF_RANGE if @c time is before the first sample
+ *         or after the last sample.
  */
 const size_t AggregateData::findTime(
         const size_t time /**< UNIX timestamp */
     ) const
 {
-    if (time > data[size-1].timestamp || time < data[0].timestamp) {
-        Utils::fatalError("Timestamp is out of range.  Fatal error.");
+    if (size == 0 || time > data[size-1].timestamp || time < data[0].timestamp) {
+        return TIME_OUT_OF_RANGE;
     }
 
-    if (data[size-1].timestamp == time)
-        return size-1;
+    // first sample at or after the start of time's bucket
+    const size_t bucket = (time - timeIndexOrigin) / bucketWidth;
+    const size_t i = timeIndex[ bucket ] - numRetired;
 
-    /* poor man's hash table! (kind of).
-     * estimatedIndex assumes there are no missing samples in the aggregate
-     * data and estimates the index.  This estimate will almost always be
-     * too high; it will never be too low.
-     */
-    size_t estimatedIndex = (time - data[0].timestamp) / samplePeriod;
+    if ( data[i].timestamp > time ) {
+        // time falls in a gap before the first sample in its bucket
+        return i-1;
+    }
 
-    if ( estimatedIndex > size-1 )
-        estimatedIndex = size-1;
+    // one past the last sample in time's bucket
+    const size_t end = ( bucket+1 < timeIndex.size() ) ? timeIndex[ bucket+1 ] - numRetired : size;
 
-    size_t i;
-    for (i=estimatedIndex; i>=0; i--) {
-        if ( Utils::between(data[i].timestamp, data[i+1].timestamp-1, time)) {
-            return i;
+    // last sample in [i, end) at or before time
+    const AggregateSample * const after =
+            std::upper_bound( data + i, data + end, time, TimestampIsLess() );
+
+    return ( after - data ) - 1;
+}
+
+/**
+ * @brief Rebuild the time index used by findTime() from scratch.
+ *
+ * The index is a table of buckets, each @c bucketWidth seconds wide,
+ * keyed by @c (timestamp-timeIndexOrigin)/bucketWidth.  Each bucket
+ * records the first sample at or after the bucket's start time, so gaps
+ * in the data are simply runs of buckets which all point at the sample
+ * after the gap.  The bucket width is normally the sample period but
+ * is widened if the data contains such huge gaps that the table would
+ * have more than @c MAX_BUCKETS_PER_SAMPLE buckets per sample.  When it
+ * is widened, it is widened to half that limit so that appending
+ * samples (see indexSamplesFrom()) has room to grow before the next rebuild.
+ */
+void AggregateData::rebuildTimeIndex()
+{
+    timeIndex.clear();
+    numRetired = 0;
+    bucketWidth = samplePeriod ? samplePeriod : 1;
+
+    if ( size > 1 ) {
+        const size_t span = data[size-1].timestamp - data[0].timestamp;
+        if ( span / bucketWidth >= MAX_BUCKETS_PER_SAMPLE * size ) {
+            bucketWidth = (2 * span / (MAX_BUCKETS_PER_SAMPLE * size)) + 1;
         }
     }
 
-    // should never get here
-    return -1;
+    indexSamplesFrom( 0 );
+}
+
+/**
+ * @brief Add samples [first, size) to the time index.
+ *        Samples must be appended in time order.
+ *
+ * A gap adds one bucket per @c bucketWidth seconds, so if a long gap
+ * (e.g. a meter outage) would leave the table with more than
+ * @c MAX_BUCKETS_PER_SAMPLE buckets per sample then the whole index
+ * is rebuilt with wider buckets instead.
+ */
+void AggregateData::indexSamplesFrom(
+        const size_t first
+        )
+{
+    for (size_t i=first; i<size; i++) {
+        if ( timeIndex.empty() ) {
+            timeIndexOrigin = data[i].timestamp;
+        }
+
+        const size_t bucket = (data[i].timestamp - timeIndexOrigin) / bucketWidth;
+        if ( bucket >= MAX_BUCKETS_PER_SAMPLE * size ) {
+            rebuildTimeIndex();
+            return;
+        }
+
+        while ( timeIndex.size() <= bucket ) {
+            timeIndex.push_back( i + numRetired );
+        }
+    }
+}
+
+/**
+ * @brief Update the time index after @c n samples have been
+ *        removed from the front of @c data.
+ */
+void AggregateData::retireFromTimeIndex(
+        const size_t n
+        )
+{
+    if ( size == 0 ) {
+        timeIndex.clear();
+        numRetired = 0;
+        return;
+    }
+
+    numRetired += n;
+
+    // drop buckets which end before the new first sample
+    while ( timeIndex.size() > 1 && timeIndexOrigin + bucketWidth <= data[0].timestamp ) {
+        timeIndex.pop_front();
+        timeIndexOrigin += bucketWidth;
+    }
+
+    // the front bucket may still point at a retired sample
+    for (size_t b=0; b<timeIndex.size() && timeIndex[b] < numRetired; b++) {
+        timeIndex[b] = numRetired;
+    }
 }
 
 const size_t AggregateData::getSamplePeriod() const
@@ -10,9 +10,15 @@
 
 #include "Array.h"
 #include "Statistic.h"
+#include "RangeMinimum.h"
+#include "Likelihood.h"
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <stdint.h>
+#include <cstdio>
+#include <vector>
+#include <deque>
 
 /**
  * @brief A simple struct for pairing @c timecode to @c reading
@@ -61,10 +67,27 @@ public:
 
     };
 
+    /***************************************/
+    /** @name Constructors and destructors */
+    ///@{
+    AggregateData();
+
+    virtual ~AggregateData();
+    ///@}
+
     /******************************************************************/
     /** @name General functions used by all disaggregation algorithms */
     ///@{
     void loadCurrentCostData(
+            const std::string& filename,
+            const bool useCache = true
+            );
+
+    void appendCurrentCostData(
+            const std::string& filename
+            );
+
+    void loadCurrentCostDataWithIostreams(
             const std::string& filename
             );
 
@@ -87,6 +110,123 @@ public:
             const bool verbose = false
             ) const;
 
+    /**
+     * @brief The limits and likelihood function findSpike() uses to
+     *        look for a spike which fits a Statistic.
+     */
+    struct SpikeSearch {
+        double mean;
+        double wideLower, wideUpper;     /**< @brief aggDelta(i) must lie in here for sample i to be considered */
+        double narrowLower, narrowUpper; /**< @brief one of the variations must lie in here for a match */
+        double stdev;                    /**< @brief nonZeroStdev() of the spike stats, for likelihood() */
+
+        /**
+         * @brief The fewest data points a Statistic must have before
+         *        its quantiles are used for the limits.
+         */
+        static const size_t MIN_DATA_POINTS_FOR_QUANTILES = 4;
+
+        explicit SpikeSearch(
+                const Statistic<Sample_t>& spikeStats
+                );
+
+        explicit SpikeSearch(
+                const Statistic< Sample_t, SketchedMoments<Sample_t> >& spikeStats,
+                const double tailQuantile = 0
+                );
+
+        const bool wideMatch( const double delta ) const
+        {
+            return delta >= wideLower && delta <= wideUpper;
+        }
+
+        const bool narrowMatch( const double delta ) const
+        {
+            return delta >= narrowLower && delta <= narrowUpper;
+        }
+
+        /**
+         * @return the same as Statistic::normalisedLikelihood() for the
+         *         Statistic this search was built from.
+         */
+        const double likelihood(
+                const double x
+                ) const
+        {
+            return Likelihood::normalisedGaussian( x, mean, stdev );
+        }
+
+        void likelihoods(
+                const double * x,
+                const size_t n,
+                double * results
+                ) const;
+
+    private:
+        void setLimits(
+                const double lower,
+                const double upper,
+                const double headroom
+                );
+    };
+
+    std::list<AggregateData::FoundSpike> findSpike(
+            const SpikeSearch& search,
+            size_t startTime = 0,
+            size_t endTime = 0,
+            const bool verbose = false
+            ) const;
+
+    /**
+     * @brief One query for findSpikes().
+     */
+    struct SpikeQuery {
+        SpikeSearch search;
+        size_t startTime;
+        size_t endTime;
+
+        SpikeQuery(
+                const SpikeSearch& s,
+                const size_t st,
+                const size_t et
+                )
+        : search(s), startTime(st), endTime(et)
+        {}
+    };
+
+    void findSpikes(
+            const std::vector<SpikeQuery>& queries,
+            std::vector< std::list<FoundSpike> > * results
+            ) const;
+
+    /**
+     * @brief Every spike in the data which matches one SpikeSearch, in
+     *        time order.  Made by findAllSpikes() and searched by findSpikes().
+     */
+    struct SpikeTable {
+        std::vector<uint32_t> samples;  /**< @brief index of the sample at which each spike was found */
+        std::vector<FoundSpike> spikes;
+        size_t numSamples;              /**< @brief size of the data when the table was made */
+
+        SpikeTable()
+        : numSamples(0)
+        {}
+    };
+
+    const bool canTabulateSpikes() const;
+
+    void findAllSpikes(
+            const SpikeSearch& search,
+            SpikeTable * table
+            ) const;
+
+    void findSpikes(
+            const SpikeTable& table,
+            size_t startTime,
+            size_t endTime,
+            std::vector<FoundSpike> * foundSpikes
+            ) const;
+
     const size_t findTime(
             const size_t time
             ) const;
@@ -96,6 +236,34 @@ public:
             const size_t endTime,
             const Statistic<Sample_t>& powerState
             ) const;
+
+    const bool readingGoesBelow(
+            const size_t startTime,
+            const size_t endTime,
+            const double threshold
+            ) const;
+
+    /**
+     * @brief One query for readingsGoBelow().
+     */
+    struct ReadingQuery {
+        size_t startTime;
+        size_t endTime;
+        double threshold;
+
+        ReadingQuery(
+                const size_t s,
+                const size_t e,
+                const double t
+                )
+        : startTime(s), endTime(e), threshold(t)
+        {}
+    };
+
+    void readingsGoBelow(
+            const std::vector<ReadingQuery>& queries,
+            std::vector<bool> * results
+            ) const;
     ///@}
 
     /********************************************************/
@@ -108,10 +276,126 @@ public:
             ) const;
     ///@}
 
+    /**************************************************************/
+    /** @name Streaming mode: only a sliding window of samples is */
+    /**       held in memory.                                     */
+    ///@{
+    void openCurrentCostStream(
+            const std::string& filename
+            );
+
+    const bool streamSamplesUntil(
+            const size_t time
+            );
+
+    void retireSamplesBefore(
+            const size_t time
+            );
+
+    void appendSamples(
+            const AggregateSample * samples,
+            const size_t n
+            );
+
+    const bool isStreaming() const;
+
+    const bool endOfStream() const;
+
+    const size_t getCapacity() const;
+    ///@}
+
+    static const size_t TIME_OUT_OF_RANGE = (size_t)-1; /**< @brief returned by findTime()
+                                                            if the time is not in @c data */
+
+    static const std::string CACHE_SUFFIX; /**< @brief appended to the CSV filename
+                                                to get the binary sidecar cache filename. */
+
 private:
 
     size_t samplePeriod; /**< @brief in seconds. */
 
+    void parseCurrentCostCsv(
+            const char * const file,
+            const size_t length
+            );
+
+    static AggregateSample * allocateSamples(
+            const size_t n
+            );
+
+    void adoptSamples(
+            AggregateSample * buffer,
+            const size_t n,
+            const size_t _capacity
+            );
+
+    void appendSample(
+            const AggregateSample& sample
+            );
+
+    void reserveSamples(
+            const size_t n
+            );
+
+    void rebuildTimeIndex();
+
+    void buildSearchIndices();
+
+    void clearSearchIndices();
+
+    const size_t findWindowEnd(
+            const size_t first,
+            const size_t endTime
+            ) const;
+
+    const int aggDeltaFromColumn(
+            const size_t i
+            ) const;
+
+    void getVariations(
+            const size_t i,
+            int * variations
+            ) const;
+
+    static const int firstNarrowMatch(
+            const int * variations,
+            const SpikeSearch& search
+            );
+
+    static void checkVariations(
+            const int * variations,
+            const size_t time,
+            const SpikeSearch& search,
+            std::list<FoundSpike> * foundSpikes,
+            const bool verbose
+            );
+
+    void indexSamplesFrom(
+            const size_t first
+            );
+
+    void retireFromTimeIndex(
+            const size_t n
+            );
+
+    const bool readSampleFromStream(
+            AggregateSample * sample
+            );
+
+    void closeStream();
+
+    const bool loadCache(
+            const std::string& cacheFilename,
+            const uint64_t csvChecksum,
+            const size_t csvLength
+            );
+
+    void writeCache(
+            const std::string& cacheFilename,
+            const uint64_t csvChecksum,
+            const size_t csvLength
+            ) const;
+
     const size_t checkStartAndEndTimes(
             size_t * startTime,
             size_t * endTime
@@ -119,6 +403,72 @@ private:
 
     std::string aggDataFilename; /**< @brief including path and suffix */
 
+    size_t capacity; /**< @brief number of samples allocated in @c data.
+                                 Only differs from @c size when streaming. */
+
+    FILE * stream; /**< @brief file we're streaming from.  0 if not streaming. */
+    std::vector<char> streamBuffer; /**< @brief raw bytes read from @c stream but not yet parsed. */
+    size_t streamBufferBegin; /**< @brief first unparsed byte in @c streamBuffer */
+    size_t streamBufferEnd;   /**< @brief one past the last valid byte in @c streamBuffer */
+    bool streamEOF; /**< @brief have we read the last byte from @c stream ? */
+
+    /** @name Time index used by findTime() (see rebuildTimeIndex()) */
+    ///@{
+    std::deque<size_t> timeIndex; /**< @brief bucket -> first sample (counting retired samples)
+                                       at or after the start of the bucket. */
+    size_t timeIndexOrigin; /**< @brief UNIX timestamp at which timeIndex[0] starts */
+    size_t bucketWidth;     /**< @brief in seconds */
+    size_t numRetired;      /**< @brief samples removed from the front of @c data since
+                                 the index was built. */
+    static const size_t MAX_BUCKETS_PER_SAMPLE = 4;
+
+    /** @brief Comparator for binary searching the samples within a bucket */
+    struct TimestampIsLess {
+        bool operator()( const size_t time, const AggregateSample& sample ) const { return time < sample.timestamp; }
+    };
+    ///@}
+
+    /** @name Delta columns and value-sorted index used by findSpike() and the
+     *        range-minimum structure used by readingGoesBelow() (see buildSearchIndices()) */
+    ///@{
+    static const size_t NUM_VARIATIONS = 4;
+    std::vector<int32_t> deltaColumns[NUM_VARIATIONS]; /**< @brief for each sample i:
+                                 aggDelta(i), aggDelta(i)+aggDelta(i+1), aggDelta(i)+aggDelta(i-1)
+                                 and aggDelta(i-1)+aggDelta(i)+aggDelta(i+1) */
+    std::vector<uint32_t> deltaIndex; /**< @brief sample indices sorted by aggDelta(i) */
+
+    /** @brief Comparators for searching and sorting @c deltaIndex */
+    struct DeltaIsLess {
+        const std::vector<int32_t> * column;
+        DeltaIsLess( const std::vector<int32_t> * c ) : column(c) {}
+        bool operator()( const uint32_t a, const uint32_t b ) const { return (*column)[a] < (*column)[b]; }
+    };
+    struct DeltaIsBelow {
+        const std::vector<int32_t> * column;
+        DeltaIsBelow( const std::vector<int32_t> * c ) : column(c) {}
+        bool operator()( const uint32_t i, const double value ) const { return (*column)[i] < value; }
+    };
+    struct DeltaIsAbove {
+        const std::vector<int32_t> * column;
+        DeltaIsAbove( const std::vector<int32_t> * c ) : column(c) {}
+        bool operator()( const double value, const uint32_t i ) const { return value < (*column)[i]; }
+    };
+
+    RangeMinimum<size_t> readingMinimum; /**< @brief range-minimum structure over the readings */
+
+    /** @brief Iterates over the readings in @c data.  Used to build @c readingMinimum */
+    struct ReadingIterator {
+        const AggregateSample * sample;
+        ReadingIterator( const AggregateSample * s ) : sample(s) {}
+        size_t operator*() const { return sample->reading; }
+        ReadingIterator& operator++() { sample++; return *this; }
+    };
+    ///@}
+
+    // Streaming AggregateData objects own a FILE* so don't allow copying
+    AggregateData( const AggregateData& );
+    AggregateData& operator=( const AggregateData& );
+
 };
 
 #endif /* AGGREGATEDATA_H_ */
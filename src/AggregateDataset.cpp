@@ -0,0 +1,309 @@
+/*
+ * AggregateDataset.cpp
+ */
+
+#include "AggregateDataset.h"
+#include "Utils.h"
+#include <iostream>
+#include <algorithm> // std::sort()
+#include <cctype>    // isdigit()
+#include <cstring>   // memchr()
+#include <glob.h>    // glob()
+#include <sys/stat.h> // stat()
+
+using namespace std;
+
+AggregateDataset::AggregateDataset()
+: firstFileInWindow(0), endFileInWindow(0), numFilesLoaded(0)
+{}
+
+/**
+ * @brief Parse the unsigned decimal integer at the start of @c p.
+ */
+static size_t parseTimestamp(
+        const char * p,
+        const char * end
+        )
+{
+    size_t value = 0;
+    while ( p < end && *p >= '0' && *p <= '9' ) {
+        value = (value * 10) + (*p - '0');
+        p++;
+    }
+    return value;
+}
+
+static bool compareFirstTimestamps(
+        const AggregateDataset::File& a,
+        const AggregateDataset::File& b
+        )
+{
+    return a.firstTimestamp < b.firstTimestamp;
+}
+
+/**
+ * @brief Build the time index over a set of Current Cost CSV files.
+ *
+ * No samples are loaded here; just the first and last line of each file
+ * are read to find the time range it covers.  Files may be given in any
+ * order but must not overlap in time.
+ */
+void AggregateDataset::open(
+        const string& directoryOrGlob /**< A directory (all *.csv files in it are used)
+                                           or a glob pattern e.g. "data/2011-08-*.csv" */
+        )
+{
+    name = directoryOrGlob;
+    files.clear();
+    window.retireSamplesBefore( (size_t)-1 ); // empty the window
+    firstFileInWindow = endFileInWindow = 0;
+
+    string pattern = directoryOrGlob;
+    struct stat sb;
+    if ( stat( directoryOrGlob.c_str(), &sb ) == 0 && S_ISDIR( sb.st_mode ) ) {
+        if ( pattern[ pattern.size()-1 ] != '/' )
+            pattern += "/";
+        pattern += "*.csv";
+    }
+
+    glob_t globResult;
+    if ( glob( pattern.c_str(), 0, NULL, &globResult ) == 0 ) {
+        for (size_t i=0; i<globResult.gl_pathc; i++) {
+            File file;
+            file.filename = globResult.gl_pathv[i];
+            if ( readFirstAndLastTimestamps( file.filename, &file.firstTimestamp, &file.lastTimestamp ) ) {
+                files.push_back( file );
+            } else {
+                cout << "Skipping " << file.filename << " because it contains no data." << endl;
+            }
+        }
+    }
+    globfree( &globResult );
+
+    if ( files.empty() ) {
+        Utils::fatalError( "No aggregate data files found in " + directoryOrGlob );
+    }
+
+    sort( files.begin(), files.end(), compareFirstTimestamps );
+
+    for (size_t i=1; i<files.size(); i++) {
+        if ( files[i].firstTimestamp <= files[i-1].lastTimestamp ) {
+            Utils::fatalError( files[i].filename + " overlaps " + files[i-1].filename );
+        }
+    }
+
+    cout << "Indexed " << files.size() << " aggregate data files:" << endl;
+    for (size_t i=0; i<files.size(); i++) {
+        cout << "   " << files[i] << endl;
+    }
+}
+
+/**
+ * @return true if @c path is a directory or looks like a glob pattern.
+ */
+const bool AggregateDataset::isDataset(
+        const string& path
+        )
+{
+    struct stat sb;
+    if ( stat( path.c_str(), &sb ) == 0 && S_ISDIR( sb.st_mode ) )
+        return true;
+
+    return path.find_first_of( "*?[" ) != string::npos;
+}
+
+const string& AggregateDataset::getName() const
+{
+    return name;
+}
+
+const size_t AggregateDataset::getNumFiles() const
+{
+    return files.size();
+}
+
+const AggregateDataset::File& AggregateDataset::getFile(
+        const size_t i
+        ) const
+{
+    return files[i];
+}
+
+/**
+ * @return the number of files which have been parsed so far.
+ *         Useful for checking that files are only loaded when needed.
+ */
+const size_t AggregateDataset::getNumFilesLoaded() const
+{
+    return numFilesLoaded;
+}
+
+/**
+ * @brief Make sure the window holds every sample from @c startTime to
+ *        @c endTime (plus one sample either side, which findSpike() needs
+ *        for its look-behind and look-ahead) and retire the samples
+ *        before that.
+ *
+ * Moving the window forwards only loads the files it hasn't already
+ * loaded.  Moving it backwards reloads from scratch.
+ *
+ * @return the window.  The reference stays valid for the lifetime of
+ *         this object but indices into it are invalidated by the next
+ *         call to loadWindow().
+ */
+const AggregateData& AggregateDataset::loadWindow(
+        const size_t startTime, /**< UNIX timestamp */
+        const size_t endTime    /**< UNIX timestamp */
+        )
+{
+    size_t first = fileAtOrBefore( startTime );
+
+    // The sample before startTime might be at the end of the previous file
+    if ( first > 0 && startTime <= files[first].firstTimestamp )
+        first--;
+
+    if ( window.getSize() == 0 || first < firstFileInWindow || first >= endFileInWindow ) {
+        window.retireSamplesBefore( (size_t)-1 ); // empty the window
+        firstFileInWindow = endFileInWindow = first;
+    }
+
+    extendWindowTo( endTime );
+
+    // Retire samples we no longer need, keeping the sample before startTime
+    if ( window.getSize() > 0 && startTime > window[0].timestamp ) {
+        const size_t last = window.getSize() - 1;
+        const size_t i = ( startTime >= window[last].timestamp ) ? last : window.findTime( startTime );
+        if ( i > 0 ) {
+            window.retireSamplesBefore( window[i-1].timestamp );
+        }
+
+        while ( firstFileInWindow+1 < endFileInWindow &&
+                files[ firstFileInWindow ].lastTimestamp < window[0].timestamp ) {
+            firstFileInWindow++;
+        }
+    }
+
+    return window;
+}
+
+/**
+ * @brief Load files onto the end of the window until it holds the first
+ *        sample after @c endTime (or the last sample in the dataset).
+ *        Never retires samples, so indices into the window stay valid.
+ */
+void AggregateDataset::extendWindowTo(
+        const size_t endTime /**< UNIX timestamp */
+        )
+{
+    size_t end = fileAtOrBefore( endTime ) + 1;
+    if ( end < files.size() && files[end-1].lastTimestamp <= endTime )
+        end++;
+
+    while ( endFileInWindow < end ) {
+        window.appendCurrentCostData( files[ endFileInWindow ].filename );
+        endFileInWindow++;
+        numFilesLoaded++;
+    }
+}
+
+const AggregateData& AggregateDataset::getWindow() const
+{
+    return window;
+}
+
+/**
+ * @brief Load the files which overlap [startTime, endTime] and then
+ *        run AggregateData::findSpike() over them.
+ */
+list<AggregateData::FoundSpike> AggregateDataset::findSpike(
+        const Statistic<Sample_t>& spikeStats,
+        const size_t startTime, /**< UNIX timestamp */
+        const size_t endTime    /**< UNIX timestamp */
+        )
+{
+    return loadWindow( startTime, endTime ).findSpike( spikeStats, startTime, endTime );
+}
+
+list<AggregateData::FoundSpike> AggregateDataset::findSpike(
+        const AggregateData::SpikeSearch& search,
+        const size_t startTime, /**< UNIX timestamp */
+        const size_t endTime    /**< UNIX timestamp */
+        )
+{
+    return loadWindow( startTime, endTime ).findSpike( search, startTime, endTime );
+}
+
+/**
+ * @return the index into getWindow() at which @c time is located.
+ */
+const size_t AggregateDataset::findTime(
+        const size_t time /**< UNIX timestamp */
+        )
+{
+    return loadWindow( time, time ).findTime( time );
+}
+
+/**
+ * @return the index of the last file which starts at or before @c time
+ *         (or 0 if @c time is before the first file).
+ */
+const size_t AggregateDataset::fileAtOrBefore(
+        const size_t time
+        ) const
+{
+    size_t lo = 0, hi = files.size();
+    while ( hi - lo > 1 ) {
+        const size_t mid = (lo + hi) / 2;
+        if ( files[mid].firstTimestamp <= time )
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief Read the timestamps from the first and last data lines of a
+ *        Current Cost CSV file.  The rest of the file is not touched.
+ *
+ * @return false if the file contains no data lines.
+ */
+const bool AggregateDataset::readFirstAndLastTimestamps(
+        const string& filename,
+        size_t * firstTimestamp, /**< return parameter */
+        size_t * lastTimestamp   /**< return parameter */
+        )
+{
+    size_t length;
+    const char * const file = Utils::mapFile( filename, &length );
+    const char * const end  = file + length;
+
+    // First data line
+    const char * first = file;
+    while ( first < end && ! isdigit( (unsigned char)*first ) ) {
+        const char * eol = static_cast<const char *>( memchr( first, '\n', end - first ) );
+        first = (eol == 0) ? end : eol + 1;
+    }
+
+    if ( first == end ) {
+        Utils::unmapFile( file, length );
+        return false;
+    }
+
+    // Last data line: walk backwards through the line starts
+    const char * last = end;
+    do {
+        const char * lineStart = last;
+        if ( lineStart > file && *(lineStart-1) == '\n' )
+            lineStart--; // step over the newline which ends the previous line
+        while ( lineStart > file && *(lineStart-1) != '\n' )
+            lineStart--;
+        last = lineStart;
+    } while ( last > first && ! isdigit( (unsigned char)*last ) );
+
+    *firstTimestamp = parseTimestamp( first, end );
+    *lastTimestamp  = parseTimestamp( last, end );
+
+    Utils::unmapFile( file, length );
+    return true;
+}
@@ -0,0 +1,118 @@
+/*
+ * AggregateDataset.h
+ */
+
+#ifndef AGGREGATEDATASET_H_
+#define AGGREGATEDATASET_H_
+
+#include "AggregateData.h"
+#include "Statistic.h"
+#include <string>
+#include <vector>
+#include <list>
+
+/**
+ * @brief A set of Current Cost CSV files (e.g. one file per day, as written
+ *        by a rotating logger) which are treated as a single, time-ordered
+ *        stream of aggregate data without having to concatenate them.
+ *
+ * open() indexes the files by the timestamps of their first and last
+ * samples (only the first and last lines of each file are read).  Samples
+ * are then loaded lazily: loadWindow() and extendWindowTo() load just the
+ * files which overlap the requested time range into a single AggregateData
+ * "window", and samples which are no longer needed are retired from the
+ * front of the window.
+ */
+class AggregateDataset {
+public:
+
+    /**
+     * @brief One entry in the time index.
+     */
+    struct File {
+        std::string filename;  /**< including path and suffix */
+        size_t firstTimestamp; /**< UNIX timestamp of the first sample in the file */
+        size_t lastTimestamp;  /**< UNIX timestamp of the last sample in the file */
+
+        friend std::ostream& operator<<(std::ostream& o, const File& f)
+        {
+            o << f.filename << " " << f.firstTimestamp << " - " << f.lastTimestamp;
+            return o;
+        }
+    };
+
+    AggregateDataset();
+
+    void open(
+            const std::string& directoryOrGlob
+            );
+
+    static const bool isDataset(
+            const std::string& path
+            );
+
+    const std::string& getName() const;
+
+    const size_t getNumFiles() const;
+
+    const File& getFile(
+            const size_t i
+            ) const;
+
+    const size_t getNumFilesLoaded() const;
+
+    /*********************************************/
+    /** @name Lazily loaded window of samples    */
+    ///@{
+    const AggregateData& loadWindow(
+            const size_t startTime,
+            const size_t endTime
+            );
+
+    void extendWindowTo(
+            const size_t endTime
+            );
+
+    const AggregateData& getWindow() const;
+
+    std::list<AggregateData::FoundSpike> findSpike(
+            const Statistic<Sample_t>& spikeStats,
+            const size_t startTime,
+            const size_t endTime
+            );
+
+    std::list<AggregateData::FoundSpike> findSpike(
+            const AggregateData::SpikeSearch& search,
+            const size_t startTime,
+            const size_t endTime
+            );
+
+    const size_t findTime(
+            const size_t time
+            );
+    ///@}
+
+private:
+    std::string name; /**< @brief the directory or glob passed to open() */
+
+    std::vector<File> files; /**< @brief sorted by time */
+
+    AggregateData window; /**< @brief samples from files [firstFileInWindow, endFileInWindow) */
+
+    size_t firstFileInWindow; /**< @brief index into @c files of the earliest file in @c window */
+    size_t endFileInWindow;   /**< @brief one past the index of the latest file in @c window */
+
+    size_t numFilesLoaded; /**< @brief number of times a file has been parsed into @c window */
+
+    const size_t fileAtOrBefore(
+            const size_t time
+            ) const;
+
+    static const bool readFirstAndLastTimestamps(
+            const std::string& filename,
+            size_t * firstTimestamp,
+            size_t * lastTimestamp
+            );
+};
+
+#endif /* AGGREGATEDATASET_H_ */
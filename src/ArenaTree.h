@@ -0,0 +1,179 @@
+/*
+ * ArenaTree.h
+ */
+
+#ifndef ARENATREE_H_
+#define ARENATREE_H_
+
+#include <cstddef> // size_t
+#include <vector>
+#include <ostream>
+
+/**
+ * @brief A flat store for a tree (or DAG) which is built, searched and
+ *        thrown away many times over, e.g. once per candidate during
+ *        disaggregation.
+ *
+ * Vertices and edges live in parallel arrays indexed by vertex or edge
+ * number.  Each vertex's out-edges form a singly linked list through
+ * @c nextOutEdge, in the order they were added.  clear() resets the
+ * arrays to zero length without freeing them so, once the arrays have
+ * grown to the size of the largest tree, building another tree makes
+ * no heap allocations at all (unless @c Vertex makes its own).
+ * getNumGrowths() counts the times an array had to grow.
+ *
+ * @c Vertex is the per-vertex payload.
+ */
+template <class Vertex>
+class ArenaTree {
+public:
+    typedef size_t vertex_descriptor;
+    typedef size_t edge_descriptor;
+
+    static const size_t NONE = (size_t)-1; /**< @brief "no vertex" or "no edge" */
+
+    ArenaTree()
+    : numGrowths(0)
+    {}
+
+    /**
+     * @brief Remove every vertex and edge, keeping the memory for re-use.
+     */
+    void clear()
+    {
+        vertices.clear();
+        parents.clear();
+        firstOutEdges.clear();
+        lastOutEdges.clear();
+        targets.clear();
+        likelihoods.clear();
+        nextOutEdges.clear();
+    }
+
+    const vertex_descriptor addVertex()
+    {
+        pushBack( &vertices, Vertex() );
+        pushBack( &parents, NONE );
+        pushBack( &firstOutEdges, NONE );
+        pushBack( &lastOutEdges, NONE );
+        return vertices.size() - 1;
+    }
+
+    /**
+     * @brief Add an edge from @c source to @c target.  It becomes the
+     *        last of @c source's out-edges.  The first edge into a
+     *        vertex sets its parent().
+     */
+    const edge_descriptor addEdge(
+            const vertex_descriptor source,
+            const vertex_descriptor target,
+            const double likelihood
+            )
+    {
+        const edge_descriptor e = targets.size();
+        pushBack( &targets, target );
+        pushBack( &likelihoods, likelihood );
+        pushBack( &nextOutEdges, NONE );
+
+        if ( lastOutEdges[source] == NONE )
+            firstOutEdges[source] = e;
+        else
+            nextOutEdges[ lastOutEdges[source] ] = e;
+        lastOutEdges[source] = e;
+
+        if ( parents[target] == NONE )
+            parents[target] = source;
+
+        return e;
+    }
+
+    Vertex& operator[](const vertex_descriptor v) { return vertices[v]; }
+
+    const Vertex& operator[](const vertex_descriptor v) const { return vertices[v]; }
+
+    const size_t getNumVertices() const { return vertices.size(); }
+
+    const size_t getNumEdges() const { return targets.size(); }
+
+    /**
+     * @return the source of the first edge into @c v, or NONE.
+     */
+    const vertex_descriptor parent(const vertex_descriptor v) const { return parents[v]; }
+
+    /**
+     * @return @c v's first out-edge, or NONE.
+     */
+    const edge_descriptor firstOutEdge(const vertex_descriptor v) const { return firstOutEdges[v]; }
+
+    /**
+     * @return the out-edge after @c e from the same vertex, or NONE.
+     */
+    const edge_descriptor nextOutEdge(const edge_descriptor e) const { return nextOutEdges[e]; }
+
+    const vertex_descriptor target(const edge_descriptor e) const { return targets[e]; }
+
+    const double likelihood(const edge_descriptor e) const { return likelihoods[e]; }
+
+    /**
+     * @return the number of times one of the arrays had to grow.
+     *         Each growth is one heap allocation.
+     */
+    const size_t getNumGrowths() const { return numGrowths; }
+
+    /**
+     * @brief Write the tree in GraphViz format.
+     *
+     * @param vertexWriter  called as vertexWriter(out, v) to write each vertex's attributes
+     * @param edgeWriter    called as edgeWriter(out, e) to write each edge's attributes
+     */
+    template <class VertexWriter, class EdgeWriter>
+    void writeGraphViz(
+            std::ostream& out,
+            VertexWriter vertexWriter,
+            EdgeWriter edgeWriter
+            ) const
+    {
+        out << "digraph G {" << std::endl;
+        for (vertex_descriptor v=0; v<getNumVertices(); v++) {
+            out << v;
+            vertexWriter( out, v );
+            out << ";" << std::endl;
+        }
+        for (vertex_descriptor v=0; v<getNumVertices(); v++) {
+            for (edge_descriptor e=firstOutEdge(v); e!=NONE; e=nextOutEdge(e)) {
+                out << v << "->" << target(e) << " ";
+                edgeWriter( out, e );
+                out << ";" << std::endl;
+            }
+        }
+        out << "}" << std::endl;
+    }
+
+private:
+    std::vector<Vertex> vertices;
+    std::vector<vertex_descriptor> parents;
+    std::vector<edge_descriptor> firstOutEdges;
+    std::vector<edge_descriptor> lastOutEdges;
+
+    std::vector<vertex_descriptor> targets;
+    std::vector<double> likelihoods;
+    std::vector<edge_descriptor> nextOutEdges;
+
+    size_t numGrowths;
+
+    template <class T>
+    void pushBack(
+            std::vector<T> * array,
+            const T& value
+            )
+    {
+        if ( array->size() == array->capacity() )
+            numGrowths++;
+        array->push_back( value );
+    }
+};
+
+template <class Vertex>
+const size_t ArenaTree<Vertex>::NONE;
+
+#endif /* ARENATREE_H_ */
@@ -11,10 +11,14 @@
 #include "Common.h"
 #include "Utils.h"
 #include "GNUplot.h"
+#include "Parallel.h"
 #include <iostream>
 #include <iostream>
 #include <fstream>
 #include <cstdint>
+#include <cstdlib> // strtod()
+#include <cstring> // memcpy()
+#include <algorithm>
 #include <cassert>
 #include <list>
 
@@ -39,6 +43,22 @@ protected:
                                    'upstreamSmoothing' records the smoothing of the upstream array. Else=0. */
     std::string deviceName; /**< @brief Most arrays are associated with a device.  If not, just leave blank. */
 
+    /**
+     * @brief Parse the first value on a line.  Used by loadData().
+     */
+    static void parseValue(
+            const char * begin, /**< start of line */
+            const char * end,   /**< end of line */
+            T * value           /**< output parameter */
+            )
+    {
+        char buffer[64]; // strtod() needs a null-terminated string
+        const size_t length = std::min( (size_t)(end - begin), sizeof(buffer) - 1 );
+        memcpy( buffer, begin, length );
+        buffer[ length ] = '\0';
+        *value = static_cast<T>( strtod( buffer, 0 ) );
+    }
+
 public:
     /********************
      * Member functions *
@@ -300,6 +320,28 @@ public:
         }
     }
 
+    /**
+     * @brief Load data from a CSV file with a single column.
+     *
+     * The file is memory-mapped and, if it's large enough, parsed
+     * on several cores at once (see Parallel::LineChunks).  Lines
+     * which do not start with a digit are skipped.
+     */
+    void loadData(
+            const std::string& filename /**< including path and suffix. */
+            )
+    {
+        size_t length;
+        const char * const file = Utils::mapFile( filename, &length );
+
+        Parallel::LineChunks chunks( file, length );
+        setSize( chunks.getNumDataLines() );
+        std::cout << "Found " << size << " data points in file." << std::endl;
+        chunks.parseInto( data, parseValue );
+
+        Utils::unmapFile( file, length );
+    }
+
 
     ///@}
 
@@ -0,0 +1,276 @@
+/*
+ * IntervalSelection.cpp
+ */
+
+#include "IntervalSelection.h"
+#include <algorithm> // sort(), lower_bound(), min()
+#include <queue>
+#include <functional> // greater
+#include <utility>    // pair
+#include <limits>
+
+using namespace std;
+
+namespace IntervalSelection {
+
+void select(
+        const vector<Interval>& intervals,
+        const size_t maxOverlap,
+        vector<bool> * selected
+        )
+{
+    if (maxOverlap == 1)
+        selectNonOverlapping( intervals, selected );
+    else
+        selectWithMaxOverlap( intervals, maxOverlap, selected );
+}
+
+/**
+ * @brief Orders interval indices by end time, then start time, then index
+ *        (so that the selection doesn't depend on the sort algorithm).
+ */
+class ByEnd {
+public:
+    ByEnd( const vector<Interval>& _intervals ) : intervals(_intervals) {}
+
+    bool operator()(const size_t a, const size_t b) const
+    {
+        if (intervals[a].end != intervals[b].end)
+            return intervals[a].end < intervals[b].end;
+        if (intervals[a].start != intervals[b].start)
+            return intervals[a].start < intervals[b].start;
+        return a < b;
+    }
+
+private:
+    const vector<Interval>& intervals;
+};
+
+void selectNonOverlapping(
+        const vector<Interval>& intervals,
+        vector<bool> * selected
+        )
+{
+    const size_t n = intervals.size();
+    selected->assign( n, false );
+
+    vector<size_t> order( n );
+    for (size_t i=0; i<n; i++) {
+        order[i] = i;
+    }
+    sort( order.begin(), order.end(), ByEnd( intervals ) );
+
+    vector<size_t> ends( n );
+    for (size_t j=0; j<n; j++) {
+        ends[j] = intervals[ order[j] ].end;
+    }
+
+    // best[j] is the heaviest selection from the first j intervals (in
+    // order of end time).  If the j-th interval is in it then the rest of
+    // the selection comes from the first previous[j] intervals, which are
+    // exactly those that end before the j-th one starts.
+    vector<double> best( n+1, 0.0 );
+    vector<size_t> previous( n+1, 0 );
+    vector<bool> taken( n+1, false );
+
+    for (size_t j=1; j<=n; j++) {
+        const Interval& interval = intervals[ order[j-1] ];
+        previous[j] = lower_bound( ends.begin(), ends.begin() + (j-1), interval.start ) - ends.begin();
+
+        const double withInterval = best[ previous[j] ] + interval.weight;
+        if (withInterval > best[j-1]) {
+            best[j] = withInterval;
+            taken[j] = true;
+        } else {
+            best[j] = best[j-1];
+        }
+    }
+
+    for (size_t j=n; j>0; ) {
+        if (taken[j]) {
+            (*selected)[ order[j-1] ] = true;
+            j = previous[j];
+        } else {
+            j--;
+        }
+    }
+}
+
+/**
+ * @brief A residual graph for min-cost flow.  Edge @c e's reverse edge
+ *        is @c e^1.  Each vertex's out-edges form a linked list.
+ */
+class FlowGraph {
+public:
+    static const size_t NONE = (size_t)-1;
+
+    FlowGraph( const size_t numVertices ) : firstOutEdge( numVertices, NONE ) {}
+
+    const size_t addEdge(
+            const size_t source,
+            const size_t _target,
+            const size_t _capacity,
+            const double _cost
+            )
+    {
+        const size_t e = target.size();
+        addHalfEdge( source, _target, _capacity, _cost );
+        addHalfEdge( _target, source, 0, -_cost );
+        return e;
+    }
+
+    const size_t getNumVertices() const { return firstOutEdge.size(); }
+
+    vector<size_t> firstOutEdge;
+    vector<size_t> nextOutEdge;
+    vector<size_t> target;
+    vector<size_t> capacity;
+    vector<double> cost;
+
+private:
+    void addHalfEdge(
+            const size_t source,
+            const size_t _target,
+            const size_t _capacity,
+            const double _cost
+            )
+    {
+        nextOutEdge.push_back( firstOutEdge[source] );
+        firstOutEdge[source] = target.size();
+        target.push_back( _target );
+        capacity.push_back( _capacity );
+        cost.push_back( _cost );
+    }
+};
+
+const size_t FlowGraph::NONE;
+
+void selectWithMaxOverlap(
+        const vector<Interval>& intervals,
+        const size_t maxOverlap,
+        vector<bool> * selected
+        )
+{
+    const size_t n = intervals.size();
+    selected->assign( n, false );
+    if (maxOverlap == 0)
+        return;
+
+    // The vertices are the distinct times at which an interval starts or
+    // the time just after one ends, in order.  A chain of zero-cost edges
+    // of capacity maxOverlap runs along the time line and each interval
+    // is an edge of capacity 1 whose cost is minus its weight.  Each unit
+    // of flow from the first to the last vertex follows a chain of
+    // disjoint intervals, so a min-cost flow of up to maxOverlap units
+    // picks the heaviest selection in which at most maxOverlap intervals
+    // cover any time.
+    vector<size_t> times;
+    times.reserve( n*2 );
+    for (size_t i=0; i<n; i++) {
+        if (intervals[i].weight > 0) {
+            times.push_back( intervals[i].start );
+            times.push_back( intervals[i].end + 1 );
+        }
+    }
+    if (times.empty())
+        return;
+    sort( times.begin(), times.end() );
+    times.erase( unique( times.begin(), times.end() ), times.end() );
+
+    const size_t numVertices = times.size();
+    const size_t source = 0;
+    const size_t sink = numVertices - 1;
+
+    FlowGraph graph( numVertices );
+    for (size_t v=0; v+1<numVertices; v++) {
+        graph.addEdge( v, v+1, maxOverlap, 0.0 );
+    }
+
+    vector<size_t> intervalEdges( n, FlowGraph::NONE );
+    for (size_t i=0; i<n; i++) {
+        if (intervals[i].weight > 0) {
+            const size_t start = lower_bound( times.begin(), times.end(), intervals[i].start ) - times.begin();
+            const size_t end = lower_bound( times.begin(), times.end(), intervals[i].end + 1 ) - times.begin();
+            intervalEdges[i] = graph.addEdge( start, end, 1, -intervals[i].weight );
+        }
+    }
+
+    // Every edge with spare capacity points forwards in time, so the
+    // shortest distances from the source make valid initial potentials
+    // and can be found in a single pass.
+    const double INF = numeric_limits<double>::infinity();
+    vector<double> potential( numVertices, INF );
+    potential[source] = 0.0;
+    for (size_t v=0; v<numVertices; v++) {
+        for (size_t e=graph.firstOutEdge[v]; e!=FlowGraph::NONE; e=graph.nextOutEdge[e]) {
+            if (graph.capacity[e] > 0 && potential[v] + graph.cost[e] < potential[ graph.target[e] ]) {
+                potential[ graph.target[e] ] = potential[v] + graph.cost[e];
+            }
+        }
+    }
+
+    // Successive shortest paths with Dijkstra on the reduced costs.
+    // Stop as soon as another unit of flow no longer adds any weight.
+    const double EPSILON = 1e-9;
+    typedef pair<double, size_t> QueueEntry;
+    vector<double> distance( numVertices );
+    vector<size_t> edgeIn( numVertices );
+    size_t flow = 0;
+
+    while (flow < maxOverlap) {
+        distance.assign( numVertices, INF );
+        edgeIn.assign( numVertices, FlowGraph::NONE );
+        priority_queue< QueueEntry, vector<QueueEntry>, greater<QueueEntry> > queue;
+        distance[source] = 0.0;
+        queue.push( QueueEntry( 0.0, source ) );
+
+        while (!queue.empty()) {
+            const QueueEntry top = queue.top();
+            queue.pop();
+            const size_t v = top.second;
+            if (top.first > distance[v])
+                continue;
+
+            for (size_t e=graph.firstOutEdge[v]; e!=FlowGraph::NONE; e=graph.nextOutEdge[e]) {
+                if (graph.capacity[e] == 0)
+                    continue;
+                const size_t w = graph.target[e];
+                const double reducedCost = max( 0.0, graph.cost[e] + potential[v] - potential[w] );
+                if (distance[v] + reducedCost < distance[w]) {
+                    distance[w] = distance[v] + reducedCost;
+                    edgeIn[w] = e;
+                    queue.push( QueueEntry( distance[w], w ) );
+                }
+            }
+        }
+
+        if (distance[sink] == INF)
+            break;
+
+        const double pathCost = distance[sink] + potential[sink] - potential[source];
+        if (pathCost >= -EPSILON)
+            break;
+
+        for (size_t v=0; v<numVertices; v++) {
+            potential[v] += min( distance[v], distance[sink] );
+        }
+
+        size_t bottleneck = maxOverlap - flow;
+        for (size_t v=sink; v!=source; v=graph.target[ edgeIn[v]^1 ]) {
+            bottleneck = min( bottleneck, graph.capacity[ edgeIn[v] ] );
+        }
+        for (size_t v=sink; v!=source; v=graph.target[ edgeIn[v]^1 ]) {
+            graph.capacity[ edgeIn[v] ] -= bottleneck;
+            graph.capacity[ edgeIn[v]^1 ] += bottleneck;
+        }
+        flow += bottleneck;
+    }
+
+    for (size_t i=0; i<n; i++) {
+        if (intervalEdges[i] != FlowGraph::NONE && graph.capacity[ intervalEdges[i] ] == 0) {
+            (*selected)[i] = true;
+        }
+    }
+}
+
+} // namespace IntervalSelection
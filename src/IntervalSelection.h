@@ -0,0 +1,71 @@
+/*
+ * IntervalSelection.h
+ */
+
+#ifndef INTERVALSELECTION_H_
+#define INTERVALSELECTION_H_
+
+#include <cstddef> // size_t
+#include <vector>
+
+/**
+ * @brief Choose the heaviest set of time intervals in which no more
+ *        than a given number of intervals overlap at any time.
+ *
+ * Used to resolve overlapping candidate fingerprints.
+ */
+namespace IntervalSelection {
+
+struct Interval {
+    size_t start;  /**< @brief first time covered */
+    size_t end;    /**< @brief last time covered (inclusive) */
+    double weight;
+
+    Interval(
+            const size_t _start,
+            const size_t _end,
+            const double _weight
+            )
+    : start(_start), end(_end), weight(_weight)
+    {}
+};
+
+/**
+ * @brief Find the set of @c intervals with the largest total weight such
+ *        that no time is covered by more than @c maxOverlap of them.
+ *
+ * Intervals with a weight of zero or less are never selected.
+ *
+ * @param selected  resized to match @c intervals; entry @c i is set true
+ *                  if @c intervals[i] was chosen.
+ */
+void select(
+        const std::vector<Interval>& intervals,
+        const size_t maxOverlap,
+        std::vector<bool> * selected
+        );
+
+/**
+ * @brief select() with a @c maxOverlap of 1.  Weighted interval
+ *        scheduling by dynamic programming; O(n log n).
+ */
+void selectNonOverlapping(
+        const std::vector<Interval>& intervals,
+        std::vector<bool> * selected
+        );
+
+/**
+ * @brief select() for any @c maxOverlap.  Solved as a min-cost flow of
+ *        @c maxOverlap units along the time line, where each unit of
+ *        flow picks out a chain of disjoint intervals; O(k n log n)
+ *        for k = @c maxOverlap.
+ */
+void selectWithMaxOverlap(
+        const std::vector<Interval>& intervals,
+        const size_t maxOverlap,
+        std::vector<bool> * selected
+        );
+
+} // namespace IntervalSelection
+
+#endif /* INTERVALSELECTION_H_ */
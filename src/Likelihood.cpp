@@ -0,0 +1,190 @@
+/*
+ * Likelihood.cpp
+ */
+
+#include "Likelihood.h"
+#include <cstring> // memcpy()
+#include <sstream>
+#include <stdexcept> // domain_error
+#include <stdint.h>
+#include <boost/math/special_functions/gamma.hpp> // tgamma_delta_ratio()
+#include <boost/math/constants/constants.hpp>
+
+using namespace std;
+
+namespace Likelihood {
+
+/**
+ * @brief Throw the std::domain_error which boost::math would have.
+ */
+void invalidParameter(
+        const char * name,
+        const double value
+        )
+{
+    ostringstream message;
+    message << name << " must be > 0 but is " << value << ".";
+    throw domain_error( message.str() );
+}
+
+void normalisedGaussian(
+        const double * x,
+        const size_t n,
+        const double mean,
+        const double stdev,
+        double * likelihoods
+        )
+{
+    if ( ! (stdev > 0) )
+        invalidParameter( "stdev", stdev );
+
+    // Exactly the same arithmetic as the single-value version (callers
+    // rely on the two agreeing to the last bit) in a loop with no
+    // branches and no calls other than exp() so that it vectorises.
+    for (size_t i=0; i<n; i++) {
+        const double z = (x[i] - mean) / stdev;
+        likelihoods[i] = exp( -0.5 * z * z );
+    }
+}
+
+/**
+ * @return the continued fraction for the regularised incomplete beta
+ *         function I_x(a, b), evaluated with the modified Lentz method
+ *         (see Numerical Recipes, 6.4).  Converges quickly for
+ *         x < (a+1)/(a+b+2).
+ */
+static const double betaContinuedFraction(
+        const double a,
+        const double b,
+        const double x
+        )
+{
+    const size_t MAX_ITERATIONS = 10000;
+    const double EPSILON = 1e-16;
+    const double TINY = 1e-300;
+
+    const double qab = a + b;
+    const double qap = a + 1;
+    const double qam = a - 1;
+    double c = 1;
+    double d = 1 - qab * x / qap;
+    if (fabs(d) < TINY) d = TINY;
+    d = 1 / d;
+    double h = d;
+
+    for (size_t m=1; m<=MAX_ITERATIONS; m++) {
+        const double m2 = 2.0 * m;
+
+        // even step
+        double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+        d = 1 + aa * d;
+        if (fabs(d) < TINY) d = TINY;
+        c = 1 + aa / c;
+        if (fabs(c) < TINY) c = TINY;
+        d = 1 / d;
+        h *= d * c;
+
+        // odd step
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+        d = 1 + aa * d;
+        if (fabs(d) < TINY) d = TINY;
+        c = 1 + aa / c;
+        if (fabs(c) < TINY) c = TINY;
+        d = 1 / d;
+        const double delta = d * c;
+        h *= delta;
+
+        if (fabs(delta - 1) < EPSILON)
+            break;
+    }
+    return h;
+}
+
+StudentT::StudentT(
+        const double _degreesOfFreedom /**< must be > 0 */
+        )
+: degreesOfFreedom(_degreesOfFreedom)
+{
+    if ( ! (degreesOfFreedom > 0) )
+        invalidParameter( "degrees of freedom", degreesOfFreedom );
+
+    // Beta(a, 1/2) = Gamma(a) Gamma(1/2) / Gamma(a + 1/2).  Taking the
+    // ratio of the gammas directly avoids the cancellation between two
+    // large lgamma()s when there are many degrees of freedom.
+    const double a = degreesOfFreedom / 2;
+    logBeta = log( boost::math::tgamma_delta_ratio( a, 0.5 ) )
+            + 0.5 * log( boost::math::constants::pi<double>() );
+}
+
+/**
+ * @return P(T > t).
+ *
+ * P(|T| > t) = I_x(v/2, 1/2) with x = v / (v + t^2) (Abramowitz &
+ * Stegun 26.7.1), and the tail is half of that.
+ */
+const double StudentT::upperTail(
+        const double t
+        ) const
+{
+    if (t == 0)
+        return 0.5;
+
+    const double v = degreesOfFreedom;
+    const double a = v / 2;
+    const double b = 0.5;
+    const double t2 = t * t;
+    const double x = v / (v + t2);
+    const double y = t2 / (v + t2); // 1 - x, without the cancellation
+
+    double twoTails;
+    if (x == 0) {
+        twoTails = 0;
+    } else {
+        // x^a y^b / Beta(a, b), with log(x) = -log(1 + t^2/v)
+        const double front = exp( -a * log1p( t2 / v ) + b * log(y) - logBeta );
+        if (x < (a + 1) / (a + b + 2)) {
+            twoTails = front * betaContinuedFraction( a, b, x ) / a;
+        } else {
+            // use the symmetry I_x(a, b) = 1 - I_y(b, a)
+            twoTails = 1 - front * betaContinuedFraction( b, a, y ) / b;
+        }
+    }
+
+    return (t > 0) ? twoTails / 2 : 1 - (twoTails / 2);
+}
+
+const double studentTUpperTail(
+        const double t,
+        const double degreesOfFreedom
+        )
+{
+    // A small direct-mapped cache, indexed by a hash of the bits of the
+    // degrees of freedom.  Thread-local so no locking is needed.  Empty
+    // slots hold a valid StudentT with 1 degree of freedom.
+    static const size_t CACHE_BITS = 6;
+    static thread_local StudentT cache[ (size_t)1 << CACHE_BITS ];
+
+    uint64_t bits;
+    memcpy( &bits, &degreesOfFreedom, sizeof(bits) );
+    const size_t slot = (size_t)( (bits * 0x9E3779B97F4A7C15ULL) >> (64 - CACHE_BITS) );
+
+    if ( cache[slot].getDegreesOfFreedom() != degreesOfFreedom ) {
+        cache[slot] = StudentT( degreesOfFreedom );
+    }
+    return cache[slot].upperTail( t );
+}
+
+void studentTUpperTail(
+        const double * t,
+        const size_t n,
+        const double degreesOfFreedom,
+        double * tails
+        )
+{
+    const StudentT dist( degreesOfFreedom );
+    for (size_t i=0; i<n; i++) {
+        tails[i] = dist.upperTail( t[i] );
+    }
+}
+
+} // namespace Likelihood
@@ -0,0 +1,100 @@
+/*
+ * LruCache.h
+ */
+
+#ifndef LRUCACHE_H_
+#define LRUCACHE_H_
+
+#include <cstddef> // size_t
+#include <list>
+#include <map>
+#include <utility> // std::pair
+
+/**
+ * @brief A map with a bounded number of entries.  When it is full,
+ *        inserting a new entry evicts the least recently used one.
+ *
+ * Counts hits, misses and evictions so that the capacity can be tuned.
+ * @c Key must have operator<.
+ */
+template <class Key, class Value>
+class LruCache {
+public:
+    LruCache(
+            const size_t _capacity = 0 /**< maximum number of entries.  0 disables the cache. */
+            )
+    : capacity(_capacity), hits(0), misses(0), evictions(0)
+    {}
+
+    /**
+     * @return the cached value for @c key or 0 if there isn't one.
+     *         The pointer is valid until the entry is evicted.
+     */
+    Value * find(
+            const Key& key
+            )
+    {
+        typename Index::iterator it = index.find( key );
+        if ( it == index.end() ) {
+            misses++;
+            return 0;
+        }
+
+        hits++;
+        entries.splice( entries.begin(), entries, it->second ); // now the most recently used
+        return &(it->second->second);
+    }
+
+    /**
+     * @brief Add @c value for @c key, which must not already be in the cache.
+     *
+     * @return a pointer to the cached copy of @c value, valid until the
+     *         entry is evicted, or 0 if the capacity is 0.
+     */
+    Value * insert(
+            const Key& key,
+            const Value& value
+            )
+    {
+        if ( capacity == 0 )
+            return 0;
+
+        if ( entries.size() >= capacity ) {
+            index.erase( entries.back().first );
+            entries.pop_back();
+            evictions++;
+        }
+
+        entries.push_front( std::make_pair( key, value ) );
+        index[ key ] = entries.begin();
+        return &(entries.front().second);
+    }
+
+    void clear()
+    {
+        entries.clear();
+        index.clear();
+    }
+
+    const size_t size() const { return entries.size(); }
+
+    const size_t getCapacity() const { return capacity; }
+
+    const size_t getHits() const { return hits; }
+
+    const size_t getMisses() const { return misses; }
+
+    const size_t getEvictions() const { return evictions; }
+
+private:
+    typedef std::list< std::pair<Key, Value> > Entries;
+    typedef std::map< Key, typename Entries::iterator > Index;
+
+    size_t capacity;
+    Entries entries; /**< @brief most recently used first */
+    Index index;
+
+    size_t hits, misses, evictions;
+};
+
+#endif /* LRUCACHE_H_ */
@@ -16,6 +16,7 @@ namespace po = boost::program_options;
 #include "Statistic.h"
 #include "Device.h"
 #include "PowerStateGraph.h"
+#include "AggregateDataset.h"
 #include "Common.h"
 #include <iostream>
 #include <fstream>
@@ -97,6 +98,52 @@ void declareAndParseOptions( po::variables_map * vm_p, int argc, char * argv[] )
                   "The device name e.g. \"kettle\".")
             ("keep-overlapping,o",
                   "Do not remove overlapping candidates during disaggregation.")
+            ("max-overlap",
+                  po::value<size_t>()->default_value(1),
+                  "When removing overlapping candidates, keep the most likely set in which this many"
+                  " candidates may overlap at any time, e.g. for a household with several of the device"
+                  " (graphs and spikes approach only).")
+            ("stream",
+                  "Stream the aggregate data from disk, keeping only a sliding window in memory"
+                  " (graphs and spikes approach only).")
+            ("online",
+                  "Feed the aggregate data to the online disaggregator one sample at a time, as a meter"
+                  " would, streaming it from disk (graphs and spikes approach only).  Of the search"
+                  " options, only --spike-quantile and --prune-edges may be given.")
+            ("threads,j",
+                  po::value<size_t>()->default_value(0),
+                  "Number of threads to use when tracing candidates during disaggregation"
+                  " (graphs and spikes approach only).  0 means one per core.")
+            ("beam-width",
+                  po::value<size_t>()->default_value(0),
+                  "Trace candidates with a beam search which keeps this many partial paths"
+                  " at each step (graphs and spikes approach only).  0 means use the exhaustive search.")
+            ("beam-min-likelihood",
+                  po::value<double>()->default_value(0),
+                  "Drop beam search steps whose likelihood is below this.")
+            ("prune-energy",
+                  po::value<double>()->default_value(0),
+                  "Stop tracing a candidate once it has used more than this multiple of the largest"
+                  " energy consumption seen in training (graphs and spikes approach only).  0 disables this.")
+            ("prune-duration",
+                  po::value<double>()->default_value(0),
+                  "Stop tracing a candidate once it has run for longer than this multiple of the longest"
+                  " training signature (graphs and spikes approach only).  0 disables this.")
+            ("prune-edges",
+                  po::value<size_t>()->default_value(0),
+                  "Stop tracing a branch if, were it to end within this many more spikes, it couldn't beat"
+                  " the best path found so far.  This is a heuristic: a longer path may have won"
+                  " (graphs and spikes approach only).  0 disables this.")
+            ("spike-quantile",
+                  po::value<double>()->default_value(0),
+                  "Look for each spike around the [q, 1-q] quantile range of the deltas seen in training,"
+                  " rather than around their min and max (graphs and spikes approach only).  0 disables this.")
+            ("expansion-cache-size",
+                  po::value<size_t>()->default_value(1 << 16),
+                  "Maximum number of entries in each thread's cache of DisagTree expansions"
+                  " (graphs and spikes approach only).  0 disables the cache.")
+            ("no-cache",
+                  "Do not read or write the binary cache which is kept next to the aggregate data file.")
             ("lms",
                   "Use Least Mean Squares approach for matching signature with aggregate data.")
             ("histogram",
@@ -138,7 +185,8 @@ void declareAndParseOptions( po::variables_map * vm_p, int argc, char * argv[] )
         hidden.add_options()
             ("aggdata,a",
                   po::value<string>(),
-                  "Aggregate data file (without path).\n");
+                  "Aggregate data file (without path).  May also be a directory"
+                  " or a glob pattern matching several files (e.g. one per day).\n");
 
         //*******************//
         // Register options  //
@@ -257,6 +305,17 @@ int main(int argc, char * argv[])
         mode = GRAPHSnSPIKES;
     }
 
+    // The online disaggregator only uses some of the search settings (see OnlineDisaggregator)
+    if (mode==GRAPHSnSPIKES && vm.count("online")) {
+        const char * ignored[] = { "threads", "beam-width", "beam-min-likelihood",
+                                   "prune-energy", "prune-duration", "expansion-cache-size" };
+        for (size_t i=0; i<sizeof(ignored)/sizeof(ignored[0]); i++) {
+            if (!vm[ ignored[i] ].defaulted()) {
+                Utils::fatalError( string("--") + ignored[i] + " has no effect with --online." );
+            }
+        }
+    }
+
     // Instantiate a device
     Device device( vm["device-name"].as< string >() );
 
@@ -267,11 +326,21 @@ int main(int argc, char * argv[])
             );
 
     AggregateData aggData;
+    AggregateDataset aggDataset;
     if (mode!=HISTOGRAM) {
         if (!vm.count("aggdata")) {
             Utils::fatalError( "An aggregate data file must be supplied at the command line.");
         }
-        aggData.loadCurrentCostData( AGG_DATA_PATH + vm["aggdata"].as< string >() );
+        if (AggregateDataset::isDataset( AGG_DATA_PATH + vm["aggdata"].as< string >() )) {
+            if (mode!=GRAPHSnSPIKES) {
+                Utils::fatalError( "Multi-file aggregate datasets can only be used with the graphs and spikes approach." );
+            }
+            aggDataset.open( AGG_DATA_PATH + vm["aggdata"].as< string >() );
+        } else if (mode==GRAPHSnSPIKES && (vm.count("stream") || vm.count("online"))) {
+            aggData.openCurrentCostStream( AGG_DATA_PATH + vm["aggdata"].as< string >() );
+        } else {
+            aggData.loadCurrentCostData( AGG_DATA_PATH + vm["aggdata"].as< string >(), !vm.count("no-cache") );
+        }
     }
 
     switch (mode) {
@@ -282,7 +351,26 @@ int main(int argc, char * argv[])
     case GRAPHSnSPIKES:
         cout << endl << "USING THE \"GRAPHS AND SPIKES\" APPROACH." << endl;
         device.trainPowerStateGraph();
-        device.getPowerStateGraph().disaggregate(aggData, vm.count("keep-overlapping"));
+        device.getPowerStateGraph().setNumThreads( vm["threads"].as< size_t >() );
+        device.getPowerStateGraph().setExpansionCacheSize( vm["expansion-cache-size"].as< size_t >() );
+        device.getPowerStateGraph().setMaxOverlap( vm["max-overlap"].as< size_t >() );
+        device.getPowerStateGraph().setPruning(
+                vm["prune-energy"].as< double >(),
+                vm["prune-duration"].as< double >(),
+                vm["prune-edges"].as< size_t >() );
+        device.getPowerStateGraph().setSpikeQuantile( vm["spike-quantile"].as< double >() );
+        device.getPowerStateGraph().setBeamSearch(
+                vm["beam-width"].as< size_t >(),
+                vm["beam-min-likelihood"].as< double >() );
+        if (aggDataset.getNumFiles() > 0) {
+            device.getPowerStateGraph().disaggregate(&aggDataset, vm.count("keep-overlapping"));
+        } else if (vm.count("online")) {
+            device.getPowerStateGraph().disaggregateOnline(&aggData, vm.count("keep-overlapping"));
+        } else if (aggData.isStreaming()) {
+            device.getPowerStateGraph().disaggregateStream(&aggData, vm.count("keep-overlapping"));
+        } else {
+            device.getPowerStateGraph().disaggregate(aggData, vm.count("keep-overlapping"));
+        }
         break;
     case HISTOGRAM:
         cout << endl << "USING THE \"HISTOGRAM\" APPROACH." << endl;
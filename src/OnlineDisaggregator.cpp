@@ -0,0 +1,384 @@
+/*
+ * OnlineDisaggregator.cpp
+ */
+
+#include "OnlineDisaggregator.h"
+#include "Utils.h"
+#include <limits>
+
+using namespace std;
+
+OnlineDisaggregator::OnlineDisaggregator(
+        PowerStateGraph * _psg /**< a trained PowerStateGraph.  It must outlive us. */
+        )
+: psg(_psg), peakWindowSize(0), prevAggData(_psg->aggData), prevAggDataset(_psg->aggDataset),
+  nextCandidate(0), scanFrom(0), scanStarted(false)
+{
+    if (num_vertices( psg->powerStateGraph ) < 2) {
+        Utils::fatalError( "powerStateGraph is empty. Cannot continue with disaggregation." );
+    }
+
+    psg->compile();
+    psg->aggData = &window;
+    psg->aggDataset = 0;
+
+    PowerStateGraph::PSG_out_edge_iter out_i, out_end;
+    tie(out_i, out_end) = out_edges(psg->offVertex, psg->powerStateGraph);
+    firstEdgeStats = psg->powerStateGraph[*out_i];
+}
+
+/**
+ * @brief Point the PowerStateGraph back at the data it had before.
+ */
+OnlineDisaggregator::~OnlineDisaggregator()
+{
+    psg->aggData = prevAggData;
+    psg->aggDataset = prevAggDataset;
+}
+
+/**
+ * @brief Add the next @c n samples and advance every candidate which
+ *        they let us advance.
+ *
+ * The work done is proportional to @c n and to the number of DisagTree
+ * vertices which the new samples make ready to expand, not to the
+ * amount of data seen so far.
+ */
+void OnlineDisaggregator::appendSamples(
+        const AggregateSample * samples, /**< in time order, after every sample appended so far */
+        const size_t n,
+        list<Fingerprint> * fingerprints /**< output parameter.  Candidates which have
+                                              finished are appended. */
+        )
+{
+    window.appendSamples( samples, n );
+    if ( window.getSize() > peakWindowSize )
+        peakWindowSize = window.getSize();
+    scanForStartSpikes( false );
+    advance( false, fingerprints );
+    retire();
+}
+
+/**
+ * @brief No more samples are coming so finish every open candidate.
+ *        As in PowerStateGraph::disaggregate(), search windows which
+ *        run past the end of the data are ignored.
+ */
+void OnlineDisaggregator::finish(
+        list<Fingerprint> * fingerprints /**< output parameter.  Candidates are appended. */
+        )
+{
+    scanForStartSpikes( true );
+    advance( true, fingerprints );
+}
+
+const size_t OnlineDisaggregator::getNumOpenCandidates() const
+{
+    return candidates.size();
+}
+
+const size_t OnlineDisaggregator::getNumOpenVertices() const
+{
+    return openTimestamps.size();
+}
+
+const size_t OnlineDisaggregator::getNumStartSpikes() const
+{
+    return nextCandidate;
+}
+
+/**
+ * @return the largest number of samples held at once.
+ */
+const size_t OnlineDisaggregator::getPeakWindowSize() const
+{
+    return peakWindowSize;
+}
+
+/**
+ * @brief Look for start spikes in the samples which have arrived since
+ *        the last call and open a candidate for each.  Like
+ *        PowerStateGraph::disaggregateStream(), the data is scanned in
+ *        chunks which end exactly on a sample.
+ */
+void OnlineDisaggregator::scanForStartSpikes(
+        const bool endOfData /**< if false, the last few samples are left until more arrive */
+        )
+{
+    const size_t size = window.getSize();
+    if ( size == 0 )
+        return;
+
+    if ( ! scanStarted ) {
+        scanFrom = window[0].timestamp;
+        scanStarted = true;
+    }
+
+    size_t scanTo;
+    if ( endOfData ) {
+        scanTo = window[ size-1 ].timestamp;
+    } else if ( size > LOOKAHEAD_SAMPLES ) {
+        scanTo = window[ size-1 - LOOKAHEAD_SAMPLES ].timestamp;
+    } else {
+        return;
+    }
+
+    if ( scanTo <= scanFrom )
+        return;
+
+    const list<AggregateData::FoundSpike> startSpikes = window.findSpike( psg->startSpikeSearch(), scanFrom, scanTo );
+    scanFrom = scanTo;
+
+    for (list<AggregateData::FoundSpike>::const_iterator spike=startSpikes.begin(); spike!=startSpikes.end(); spike++) {
+        const size_t c = nextCandidate++;
+        Candidate& candidate = candidates[c];
+
+        // time the device probably started
+        candidate.deviceStart = spike->timestamp - firstEdgeStats.duration.mean;
+        candidate.firstLAV = psg->startDisagTree( &candidate.disagTree, *spike, candidate.deviceStart );
+        candidate.numOpenVertices = 0;
+        candidate.bestCompleteAverage = 0;
+
+        // as in PowerStateGraph::initTraceToEnd()
+        PowerStateGraph::PathSoFar pathSoFar;
+        pathSoFar.energy = 0;
+        pathSoFar.likelihoodSum = 2 * candidate.firstLAV.likelihood;
+        pathSoFar.length = 2;
+        openVertex( c, candidate.firstLAV.vertex, pathSoFar );
+    }
+}
+
+/**
+ * @brief Queue @c vertex to be expanded once the data reaches its search horizon.
+ */
+void OnlineDisaggregator::openVertex(
+        const size_t c,
+        const DisagTree::vertex_descriptor vertex,
+        const PowerStateGraph::PathSoFar& pathSoFar
+        )
+{
+    Candidate& candidate = candidates[c];
+
+    OpenVertex open;
+    open.horizon   = psg->searchHorizon( candidate.disagTree, vertex );
+    open.candidate = c;
+    open.vertex    = vertex;
+    open.timestamp = candidate.disagTree[vertex].timestamp;
+    open.pathSoFar = pathSoFar;
+    openVertices.push( open );
+    openTimestamps.insert( open.timestamp );
+    candidate.numOpenVertices++;
+    if ( vertex >= candidate.isOpen.size() )
+        candidate.isOpen.resize( candidate.disagTree.getNumVertices(), false );
+    candidate.isOpen[ vertex ] = true;
+}
+
+/**
+ * @brief Expand every open vertex whose search windows the data now
+ *        covers and finish the candidates which then have none left.
+ */
+void OnlineDisaggregator::advance(
+        const bool endOfData, /**< if true, expand every open vertex */
+        list<Fingerprint> * fingerprints /**< output parameter */
+        )
+{
+    size_t ready;
+    if ( endOfData ) {
+        ready = numeric_limits<size_t>::max();
+    } else if ( window.getSize() > LOOKAHEAD_SAMPLES ) {
+        ready = window[ window.getSize()-1 - LOOKAHEAD_SAMPLES ].timestamp;
+    } else {
+        return;
+    }
+
+    expanded.clear();
+    while ( ! openVertices.empty() && openVertices.top().horizon <= ready ) {
+        const OpenVertex open = openVertices.top();
+        openVertices.pop();
+
+        map< size_t, Candidate >::iterator candidate = candidates.find( open.candidate );
+        if ( candidate == candidates.end() )
+            continue; // the candidate finished early
+        openTimestamps.erase( openTimestamps.find( open.timestamp ) );
+        candidate->second.isOpen[ open.vertex ] = false;
+
+        expand( open );
+
+        if ( --candidate->second.numOpenVertices == 0 )
+            finishCandidate( open.candidate, fingerprints );
+        else
+            expanded.insert( open.candidate );
+    }
+
+    // Finish the candidates whose best path is now known
+    if ( psg->pruneRemainingEdges > 0 ) {
+        for (set<size_t>::const_iterator c=expanded.begin(); c!=expanded.end(); c++) {
+            map< size_t, Candidate >::iterator candidate = candidates.find( *c );
+            if ( candidate != candidates.end() && cannotBeBeaten( candidate->second ) )
+                finishCandidate( *c, fingerprints );
+        }
+    }
+}
+
+/**
+ * @brief Append candidate @c c's best path to @c fingerprints, if it
+ *        has one, and forget the candidate.  Any of its vertices which
+ *        are still open are closed.
+ */
+void OnlineDisaggregator::finishCandidate(
+        const size_t c,
+        list<Fingerprint> * fingerprints /**< output parameter */
+        )
+{
+    Candidate& candidate = candidates[c];
+    const Fingerprint fingerprint = psg->findBestPath(
+            candidate.disagTree, 0, candidate.firstLAV, candidate.deviceStart );
+    if ( fingerprint.avLikelihood != -1 ) {
+        fingerprints->push_back( fingerprint );
+    }
+
+    // the queue entries are skipped once the candidate has gone
+    for (DisagTree::vertex_descriptor v=0; v<candidate.isOpen.size(); v++) {
+        if ( candidate.isOpen[v] )
+            openTimestamps.erase( openTimestamps.find( candidate.disagTree[v].timestamp ) );
+    }
+    candidates.erase( c );
+}
+
+/**
+ * @return true if @c candidate has a path to off and, assuming every
+ *         path ends within PowerStateGraph::pruneRemainingEdges more
+ *         edges of likelihood at most 1, no path through one of its
+ *         open vertices can have a higher average likelihood.
+ *
+ * Takes time proportional to the size of the candidate's DisagTree.
+ */
+const bool OnlineDisaggregator::cannotBeBeaten(
+        const Candidate& candidate
+        )
+{
+    static const double EXCESS_TOLERANCE = 1e-9;
+
+    if ( candidate.bestCompleteAverage == 0 )
+        return false;
+
+    const size_t numVertices = candidate.disagTree.getNumVertices();
+    openExcess.resize( numVertices );
+    openExcessFound.assign( numVertices, false );
+
+    // findBestPath() counts the first edge twice
+    const double lambda = candidate.bestCompleteAverage;
+    const double excess = candidate.firstLAV.likelihood - lambda + maxOpenExcess( candidate, 0, lambda );
+    return excess < -EXCESS_TOLERANCE;
+}
+
+/**
+ * @return the largest sum of (likelihood - @c lambda) along any path
+ *         from @c vertex through an open vertex, continued as well as
+ *         it possibly could be, or -infinity if there are no such paths.
+ *         As in PowerStateGraph::findMaxExcess(), @c lambda is beaten
+ *         by a whole path if the excess along it is positive.
+ */
+const double OnlineDisaggregator::maxOpenExcess(
+        const Candidate& candidate,
+        const DisagTree::vertex_descriptor vertex,
+        const double lambda
+        )
+{
+    if ( openExcessFound[ vertex ] )
+        return openExcess[ vertex ];
+    openExcessFound[ vertex ] = true;
+
+    const DisagTree& disagTree = candidate.disagTree;
+    double& excess = openExcess[ vertex ];
+    excess = -numeric_limits<double>::infinity();
+
+    if ( vertex != 0 && disagTree[ vertex ].meanPower == 0 ) {
+        // findBestPath() ends the path here
+    } else if ( vertex < candidate.isOpen.size() && candidate.isOpen[ vertex ] ) {
+        excess = psg->pruneRemainingEdges * (1 - lambda);
+    } else {
+        for (DisagTree::edge_descriptor e = disagTree.firstOutEdge(vertex); e != DisagTree::NONE; e = disagTree.nextOutEdge(e)) {
+            const double below = maxOpenExcess( candidate, disagTree.target(e), lambda );
+            if ( below != -numeric_limits<double>::infinity() && disagTree.likelihood(e) - lambda + below > excess )
+                excess = disagTree.likelihood(e) - lambda + below;
+        }
+    }
+    return excess;
+}
+
+/**
+ * @brief Add every spike which can follow @c open.vertex to its
+ *        DisagTree, as PowerStateGraph::traceToEnd() would, and open
+ *        the new vertices.
+ */
+void OnlineDisaggregator::expand(
+        const OpenVertex& open
+        )
+{
+    Candidate& candidate = candidates[ open.candidate ];
+    DisagTree& disagTree = candidate.disagTree;
+
+    matches.clear();
+    psg->findNextSpikes( disagTree, open.vertex, &matches );
+
+    for (size_t i=0; i<matches.size(); i++) {
+        const PowerStateGraph::DisagState state = psg->nextState( disagTree, open.vertex, matches[i] );
+
+        // vertices with equal states have identical subtrees so share them
+        map< PowerStateGraph::DisagState, DisagTree::vertex_descriptor >::const_iterator shared
+            = candidate.states.find( state );
+        if ( shared != candidate.states.end() ) {
+            disagTree.addEdge( open.vertex, shared->second, matches[i].likelihood );
+            continue;
+        }
+
+        const DisagTree::vertex_descriptor newVertex = psg->addDisagVertex( &disagTree, open.vertex, matches[i], state );
+        candidate.states[ state ] = newVertex;
+
+        PowerStateGraph::PathSoFar pathSoFar;
+        pathSoFar.energy = open.pathSoFar.energy +
+                disagTree[open.vertex].meanPower * (matches[i].timestamp - disagTree[open.vertex].timestamp);
+        pathSoFar.likelihoodSum = open.pathSoFar.likelihoodSum + matches[i].likelihood;
+        pathSoFar.length = open.pathSoFar.length + 1;
+
+        // findBestPath() ends a path at the first vertex which uses no power
+        if ( disagTree[newVertex].meanPower == 0 && disagTree[open.vertex].meanPower != 0 ) {
+            const double avLikelihood = pathSoFar.likelihoodSum / pathSoFar.length;
+            if ( avLikelihood > candidate.bestCompleteAverage )
+                candidate.bestCompleteAverage = avLikelihood;
+        }
+
+        if ( state.psgVertex != psg->offVertex ) // else this path has finished
+            openVertex( open.candidate, newVertex, pathSoFar );
+    }
+}
+
+/**
+ * @brief Drop the samples which neither an open vertex nor the next
+ *        start spike search can reach back to.
+ *
+ * findSpike() looks one sample behind the one it's testing so we keep
+ * two sample periods before the earliest time still needed.  Samples
+ * are only dropped once at least half the window can go, so that the
+ * cost of moving the window stays proportional to the data appended.
+ */
+void OnlineDisaggregator::retire()
+{
+    const size_t size = window.getSize();
+    if ( size == 0 )
+        return;
+
+    size_t keepFrom = scanFrom;
+    if ( ! openTimestamps.empty() && *openTimestamps.begin() < keepFrom )
+        keepFrom = *openTimestamps.begin();
+
+    const size_t margin = 2 * window.getSamplePeriod();
+    keepFrom = (keepFrom > margin) ? keepFrom - margin : 0;
+
+    const size_t first = window[0].timestamp;
+    const size_t last = window[ size-1 ].timestamp;
+    if ( keepFrom > first && (keepFrom - first) * 2 >= (last - first) ) {
+        window.retireSamplesBefore( keepFrom );
+    }
+}
@@ -0,0 +1,182 @@
+/*
+ * OnlineDisaggregator.h
+ */
+
+#ifndef ONLINEDISAGGREGATOR_H_
+#define ONLINEDISAGGREGATOR_H_
+
+#include "PowerStateGraph.h"
+#include "AggregateData.h"
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <queue>
+#include <functional> // std::greater
+
+/**
+ * @brief Disaggregates aggregate data as it arrives, e.g. a reading
+ *        every 6 seconds from a meter, using a trained PowerStateGraph.
+ *
+ * Each possible start spike opens a candidate: a DisagTree which is
+ * grown as new samples arrive.  A vertex of the tree stays "open" until
+ * the data reaches past the end of its last search window (see
+ * PowerStateGraph::searchHorizon()); only then can every spike which
+ * might follow it be seen, so only then is it expanded.  Once none of a
+ * candidate's vertices are open, its best path is found and, if one
+ * reaches the off vertex, returned as a Fingerprint.
+ *
+ * Open vertices are kept in a queue ordered by search horizon, so each
+ * append only looks at the vertices which it has made ready.  Samples
+ * are retired once no open vertex (and no start spike search) can reach
+ * back to them.
+ *
+ * Of the PowerStateGraph's search settings, only the spike quantile
+ * (setSpikeQuantile()) and the remaining-edges argument of setPruning()
+ * are used.  The beam search, the energy and duration limits, the
+ * thread count and the expansion cache are ignored.  Without a number
+ * of remaining edges the results are the same as disaggregating all
+ * the data in one go with PowerStateGraph::disaggregate() and
+ * @c keep_overlapping set.
+ *
+ * With a number of remaining edges, a candidate finishes sooner: as
+ * soon as a path reaches off and no path through an open vertex could
+ * beat it, assuming every path ends within that many more edges.  That
+ * is a heuristic, as in setPruning(): if a longer path would have won,
+ * a different fingerprint is returned from disaggregate()'s.
+ */
+class OnlineDisaggregator {
+public:
+    typedef PowerStateGraph::Fingerprint Fingerprint;
+
+    explicit OnlineDisaggregator(
+            PowerStateGraph * _psg
+            );
+
+    ~OnlineDisaggregator();
+
+    void appendSamples(
+            const AggregateSample * samples,
+            const size_t n,
+            std::list<Fingerprint> * fingerprints
+            );
+
+    void finish(
+            std::list<Fingerprint> * fingerprints
+            );
+
+    const size_t getNumOpenCandidates() const;
+
+    const size_t getNumOpenVertices() const;
+
+    const size_t getNumStartSpikes() const;
+
+    const size_t getPeakWindowSize() const;
+
+private:
+    typedef PowerStateGraph::DisagTree DisagTree;
+
+    /**
+     * @brief A candidate whose DisagTree still has open vertices.
+     */
+    struct Candidate {
+        DisagTree disagTree;
+        std::map< PowerStateGraph::DisagState, DisagTree::vertex_descriptor > states; /**< so that
+                                    vertices with equal states share a subtree */
+        size_t deviceStart;
+        PowerStateGraph::LikelihoodAndVertex firstLAV; /**< see PowerStateGraph::startDisagTree() */
+        size_t numOpenVertices;
+        std::vector<bool> isOpen;  /**< per vertex */
+        double bestCompleteAverage; /**< average likelihood of a path to off, or 0 if none is known yet.
+                                         A lower bound on that of the best path. */
+    };
+
+    /**
+     * @brief A DisagTree vertex waiting for the data to reach @c horizon.
+     */
+    struct OpenVertex {
+        size_t horizon;
+        size_t candidate;
+        DisagTree::vertex_descriptor vertex;
+        size_t timestamp;          /**< of @c vertex */
+        PowerStateGraph::PathSoFar pathSoFar; /**< along the path which first reached @c vertex */
+
+        bool operator>(const OpenVertex& other) const
+        {
+            if (horizon != other.horizon)
+                return horizon > other.horizon;
+            if (candidate != other.candidate)
+                return candidate > other.candidate;
+            return vertex > other.vertex;
+        }
+    };
+
+    /**
+     * @brief Number of samples which must follow a sample before it can
+     *        be searched (AggregateData::getVariations() looks two ahead).
+     */
+    static const size_t LOOKAHEAD_SAMPLES = 3;
+
+    PowerStateGraph * psg;
+    AggregateData window;   /**< the samples which open vertices may still search */
+    size_t peakWindowSize;  /**< the most samples @c window has held */
+    AggregateData const * prevAggData;  /**< restored to @c psg by the destructor */
+    AggregateDataset * prevAggDataset;  /**< restored to @c psg by the destructor */
+    PowerStateGraph::PowerStateEdge firstEdgeStats; /**< the PSG's first edge (out of the off vertex) */
+
+    std::map< size_t, Candidate > candidates; /**< keyed by the order they were opened */
+    size_t nextCandidate;   /**< also the number of start spikes found so far */
+    std::priority_queue< OpenVertex, std::vector<OpenVertex>, std::greater<OpenVertex> > openVertices; /**< may
+                                    also hold vertices of candidates which finished early */
+    std::multiset< size_t > openTimestamps; /**< timestamps of the open vertices */
+
+    size_t scanFrom;        /**< start spikes have been searched for up to here */
+    bool scanStarted;
+
+    std::vector< PowerStateGraph::SpikeMatch > matches; /**< re-used by expand() */
+    std::set< size_t > expanded; /**< candidates expanded by the current advance() */
+    std::vector<double> openExcess;     /**< re-used by maxOpenExcess() */
+    std::vector<bool> openExcessFound;  /**< re-used by maxOpenExcess() */
+
+    void scanForStartSpikes(
+            const bool endOfData
+            );
+
+    void openVertex(
+            const size_t candidate,
+            const DisagTree::vertex_descriptor vertex,
+            const PowerStateGraph::PathSoFar& pathSoFar
+            );
+
+    void advance(
+            const bool endOfData,
+            std::list<Fingerprint> * fingerprints
+            );
+
+    void expand(
+            const OpenVertex& open
+            );
+
+    const bool cannotBeBeaten(
+            const Candidate& candidate
+            );
+
+    const double maxOpenExcess(
+            const Candidate& candidate,
+            const DisagTree::vertex_descriptor vertex,
+            const double lambda
+            );
+
+    void finishCandidate(
+            const size_t c,
+            std::list<Fingerprint> * fingerprints
+            );
+
+    void retire();
+
+    // Holds an AggregateData and points the PowerStateGraph at it, so don't allow copying
+    OnlineDisaggregator(const OnlineDisaggregator&);
+    OnlineDisaggregator& operator=(const OnlineDisaggregator&);
+};
+
+#endif /* ONLINEDISAGGREGATOR_H_ */
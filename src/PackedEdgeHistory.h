@@ -0,0 +1,176 @@
+/*
+ * PackedEdgeHistory.h
+ */
+
+#ifndef PACKEDEDGEHISTORY_H_
+#define PACKEDEDGEHISTORY_H_
+
+#include <cstddef> // size_t
+#include <stdint.h>
+#include <cassert>
+#include <ostream>
+
+/**
+ * @brief The last @c N (or fewer) edges of a path through a graph of
+ *        at most MAX_VERTICES vertices, packed into a few machine words.
+ *
+ * Each edge is stored as its source and target vertex indices, one byte
+ * each, in a 16-bit lane.  The newest edge is in the lowest lane of
+ * @c words[0]; push_back() shifts every lane up by one, so the oldest
+ * edge falls off the end once @c N edges are stored.  Copying a history
+ * copies a couple of words and a hash is kept up to date as edges are
+ * pushed, so histories make cheap keys for hash tables.
+ *
+ * matches() compares two histories lane by lane with bitwise tricks
+ * rather than looping over the edges.
+ */
+template <size_t N>
+class PackedEdgeHistory {
+public:
+    static const size_t MAX_VERTICES = 256;
+
+    PackedEdgeHistory()
+    : length(0), hashValue(0)
+    {
+        for (size_t w=0; w<NUM_WORDS; w++) {
+            words[w] = 0;
+        }
+    }
+
+    /**
+     * @brief Append the edge from @c source to @c target, forgetting
+     *        the oldest edge if we're full.
+     */
+    void push_back(
+            const size_t source,
+            const size_t target
+            )
+    {
+        if (N == 0)
+            return;
+
+        assert( source < MAX_VERTICES && target < MAX_VERTICES );
+
+        for (size_t w=NUM_WORDS-1; w>0; w--) {
+            words[w] = (words[w] << LANE_BITS) | (words[w-1] >> (WORD_BITS - LANE_BITS));
+        }
+        words[0] = (words[0] << LANE_BITS) | (source << 8) | target;
+        words[NUM_WORDS-1] &= LAST_WORD_MASK; // forget the edge which has fallen off the end
+
+        if (length < N)
+            length++;
+
+        hashValue = 0;
+        for (size_t w=0; w<NUM_WORDS; w++) {
+            hashValue = (hashValue ^ words[w]) * 0x9E3779B97F4A7C15ULL;
+        }
+        hashValue ^= length ^ (hashValue >> 29);
+    }
+
+    const size_t size() const { return length; }
+
+    /**
+     * @return the source of edge @c i, where edge 0 is the oldest.
+     */
+    const size_t source(const size_t i) const { return (lane(i) >> 8) & 0xFF; }
+
+    /**
+     * @return the target of edge @c i, where edge 0 is the oldest.
+     */
+    const size_t target(const size_t i) const { return lane(i) & 0xFF; }
+
+    const size_t hash() const { return hashValue; }
+
+    /**
+     * @brief Lenient comparison used to match a path against the
+     *        histories learnt during training.
+     *
+     * @return true if both histories hold the same number of edges and
+     *         no pair of corresponding edges differs in both its source
+     *         and its target.  Always true if @c N is 0.
+     */
+    const bool matches(const PackedEdgeHistory& other) const
+    {
+        if (N == 0)
+            return true;
+
+        if (length != other.length)
+            return false;
+
+        for (size_t w=0; w<NUM_WORDS; w++) {
+            // set the top bit of each byte in which the histories differ...
+            const uint64_t x = words[w] ^ other.words[w];
+            const uint64_t byteDiffers = (((x & LOW_7_BITS) + LOW_7_BITS) | x) & HIGH_BIT;
+            // ...and look for a lane in which both bytes differ
+            if ( byteDiffers & (byteDiffers << 8) & LANE_HIGH_BIT )
+                return false;
+        }
+        return true;
+    }
+
+    bool operator==(const PackedEdgeHistory& other) const
+    {
+        if (length != other.length || hashValue != other.hashValue)
+            return false;
+        for (size_t w=0; w<NUM_WORDS; w++) {
+            if (words[w] != other.words[w])
+                return false;
+        }
+        return true;
+    }
+
+    bool operator!=(const PackedEdgeHistory& other) const
+    {
+        return !(*this == other);
+    }
+
+    bool operator<(const PackedEdgeHistory& other) const
+    {
+        if (length != other.length)
+            return length < other.length;
+        for (size_t w=NUM_WORDS; w-->0; ) {
+            if (words[w] != other.words[w])
+                return words[w] < other.words[w];
+        }
+        return false;
+    }
+
+private:
+    static const size_t LANE_BITS = 16;
+    static const size_t WORD_BITS = 64;
+    static const size_t LANES_PER_WORD = WORD_BITS / LANE_BITS;
+    static const size_t NUM_WORDS = N ? (N + LANES_PER_WORD - 1) / LANES_PER_WORD : 1;
+    static const size_t LANES_IN_LAST_WORD = N - ((NUM_WORDS - 1) * LANES_PER_WORD);
+
+    static const uint64_t LAST_WORD_MASK = (LANES_IN_LAST_WORD >= LANES_PER_WORD || N == 0)
+            ? ~(uint64_t)0 : (((uint64_t)1 << (LANES_IN_LAST_WORD * LANE_BITS)) - 1);
+
+    static const uint64_t LOW_7_BITS    = 0x7F7F7F7F7F7F7F7FULL;
+    static const uint64_t HIGH_BIT      = 0x8080808080808080ULL;
+    static const uint64_t LANE_HIGH_BIT = 0x8000800080008000ULL;
+
+    uint64_t words[ NUM_WORDS ];
+    size_t length;
+    size_t hashValue;
+
+    const size_t lane(const size_t i) const
+    {
+        assert( i < length );
+        const size_t l = length - 1 - i; // lane 0 is the newest
+        return (words[ l / LANES_PER_WORD ] >> ((l % LANES_PER_WORD) * LANE_BITS)) & 0xFFFF;
+    }
+};
+
+/**
+ * @brief Write the edges, oldest first, as "(source,target)".
+ */
+template <size_t N>
+std::ostream& operator<<( std::ostream& o, const PackedEdgeHistory<N>& history )
+{
+    for (size_t i=0; i<history.size(); i++) {
+        o << "(" << history.source(i) << "," << history.target(i) << ")";
+    }
+    return o;
+}
+
+#endif /* PACKEDEDGEHISTORY_H_ */
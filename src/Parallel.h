@@ -0,0 +1,182 @@
+/*
+ * Parallel.h
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <cstddef> // size_t
+#include <cstring> // memchr()
+#include <cctype>  // isdigit()
+#include <vector>
+#include <thread>
+
+/**
+ * @brief Helpers for splitting work across cores.
+ */
+namespace Parallel {
+
+/**
+ * @return the number of hardware threads (at least 1).
+ */
+inline const size_t numThreads()
+{
+    const size_t n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+/**
+ * @brief Run @c function(i, args...) for every i in [0, n), each on its own thread.
+ *        The calling thread runs i=0 itself.  Returns when all calls have finished.
+ */
+template <class Function, class... Args>
+void forEach(
+        const size_t n,
+        Function function,
+        Args... args
+        )
+{
+    std::vector<std::thread> threads;
+    threads.reserve( n );
+    for (size_t i=1; i<n; i++) {
+        threads.push_back( std::thread( function, i, args... ) );
+    }
+
+    if ( n > 0 )
+        function( 0, args... );
+
+    for (size_t i=0; i<threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+/**
+ * @brief A text file split into chunks at newline boundaries so that
+ *        data lines can be parsed on several cores at once.
+ *
+ * Parsing happens in two phases.  The constructor counts the data lines
+ * in every chunk (in parallel).  A prefix sum of these counts gives the
+ * position in the destination array of each chunk's first line, so once
+ * the caller has allocated getNumDataLines() elements, parseInto() can
+ * parse every chunk straight into its final position.  There's no need
+ * to parse into per-thread buffers and then stitch them together.
+ *
+ * As with Utils::countDataPoints(), a "data line" is any line which starts
+ * with a digit.  All other lines are skipped.
+ */
+class LineChunks {
+public:
+    /**
+     * @param minChunkBytes  Chunks are never smaller than this, so small files
+     *                       are parsed on a single thread.  The thread start-up
+     *                       cost would be greater than the time saved.
+     */
+    LineChunks(
+            const char * const file, /**< first byte of a mapped file.  May be 0 if length is 0. */
+            const size_t length,     /**< length of the file in bytes */
+            const size_t maxChunks = numThreads(),
+            const size_t minChunkBytes = (1 << 20)
+            )
+    {
+        // Split the file at the first newline after each even division.
+        size_t nChunks = length / (minChunkBytes ? minChunkBytes : 1);
+        if ( nChunks > maxChunks )
+            nChunks = maxChunks;
+        if ( nChunks < 1 )
+            nChunks = 1;
+
+        const char * const end = file + length;
+        boundaries.push_back( file );
+        for (size_t c=1; c<nChunks; c++) {
+            const char * p = file + ((length / nChunks) * c);
+            if ( p < boundaries.back() )
+                continue;
+            const char * eol = static_cast<const char *>( memchr( p, '\n', end - p ) );
+            if ( eol == 0 )
+                break;
+            boundaries.push_back( eol + 1 );
+        }
+        boundaries.push_back( end );
+
+        // Phase 1: count data lines in each chunk
+        offsets.assign( getNumChunks() + 1, 0 );
+        forEach( getNumChunks(), countChunk, this );
+
+        // Prefix sum
+        for (size_t c=0; c<getNumChunks(); c++) {
+            offsets[c+1] += offsets[c];
+        }
+    }
+
+    const size_t getNumChunks() const
+    {
+        return boundaries.size() - 1;
+    }
+
+    const size_t getNumDataLines() const
+    {
+        return offsets.back();
+    }
+
+    /**
+     * @brief Phase 2: parse every data line into @c destination, in file order.
+     *
+     * @param parseLine  Called as parseLine(lineBegin, lineEnd, &destination[i])
+     *                   where lineEnd points at the newline (or the end of the file).
+     *                   Must be safe to call from several threads at once.
+     */
+    template <class T, class LineParser>
+    void parseInto(
+            T * destination, /**< must have room for getNumDataLines() elements */
+            LineParser parseLine
+            ) const
+    {
+        forEach( getNumChunks(), parseChunk<T, LineParser>, this, destination, parseLine );
+    }
+
+private:
+    std::vector<const char *> boundaries; /**< getNumChunks()+1 pointers. Each chunk starts at the start of a line. */
+    std::vector<size_t> offsets;          /**< index of first data line in each chunk, then the total */
+
+    static void countChunk(
+            const size_t c,
+            LineChunks * chunks
+            )
+    {
+        const char * p         = chunks->boundaries[c];
+        const char * const end = chunks->boundaries[c+1];
+        size_t count = 0;
+        while ( p < end ) {
+            if ( isdigit( (unsigned char)*p ) )
+                count++;
+            const char * eol = static_cast<const char *>( memchr( p, '\n', end - p ) );
+            p = (eol == 0) ? end : eol + 1;
+        }
+        chunks->offsets[c+1] = count;
+    }
+
+    template <class T, class LineParser>
+    static void parseChunk(
+            const size_t c,
+            const LineChunks * chunks,
+            T * destination,
+            LineParser parseLine
+            )
+    {
+        const char * p         = chunks->boundaries[c];
+        const char * const end = chunks->boundaries[c+1];
+        T * out = destination + chunks->offsets[c];
+        while ( p < end ) {
+            const char * eol = static_cast<const char *>( memchr( p, '\n', end - p ) );
+            if ( eol == 0 )
+                eol = end;
+            if ( isdigit( (unsigned char)*p ) )
+                parseLine( p, eol, out++ );
+            p = (eol == end) ? end : eol + 1;
+        }
+    }
+};
+
+} // namespace Parallel
+
+#endif /* PARALLEL_H_ */
@@ -7,15 +7,32 @@
 
 #include "PowerStateGraph.h"
 #include "AggregateData.h"
+#include "Parallel.h"
+#include "LruCache.h"
+#include "IntervalSelection.h"
+#include "OnlineDisaggregator.h"
 #include <iostream>
 #include <list>
+#include <vector>
+#include <map>
+#include <algorithm> // std::stable_sort()
+#include <atomic>
 #include <boost/graph/graphviz.hpp>
 #include <cstdio> // sprintf
+#include <cstdint> // uint32_t
+#include <cassert>
+#include <limits>
 
 using namespace std;
 
 PowerStateGraph::PowerStateGraph()
-: totalCount(0), aggData(0)
+: totalCount(0), aggData(0), aggDataset(0), numThreads(Parallel::numThreads()),
+  beamWidth(0), beamMinLikelihood(0), maxOverlap(1),
+  pruneEnergyFactor(0), pruneDurationFactor(0), pruneRemainingEdges(0), spikeQuantile(0),
+  expansionCacheSize(1 << 16),
+  expansionCacheHits(0), expansionCacheMisses(0), expansionCacheEvictions(0), sharedDisagVertices(0),
+  disagTreeVertices(0), disagTreeArenaGrowths(0), prunedByEnergy(0), prunedByDuration(0), prunedByLikelihood(0),
+  prunedCandidates(0)
 {
     using namespace boost;
 
@@ -29,14 +46,7 @@ void PowerStateGraph::addItemToEdgeHistory(
         const PSGraph::edge_descriptor& edge
         )
 {
-    // Check if edge histories are disabled
-    if (EDGE_HISTORY_SIZE == 0)
-        return;
-
-    if (edgeHistory.size() >= EDGE_HISTORY_SIZE)
-        edgeHistory.erase( edgeHistory.begin() );
-
-    edgeHistory.push_back(edge);
+    edgeHistory.push_back( source(edge, powerStateGraph), target(edge, powerStateGraph) );
 }
 
 const Statistic< double >& PowerStateGraph::getEnergyConsumption() const
@@ -57,7 +67,9 @@ void PowerStateGraph::update(
     cout << "Energy consumption from sig" << sig.getID() << " = "
          << energyConsumptionFromSig / J_PER_KWH << " kWh" << endl;
 
-    edgeHistory.clear();
+    runDuration.update( sig.getSize() * sig.getSamplePeriod() );
+
+    edgeHistory = EdgeHistory();
 
     // get the gradient spikes for the signature
     list<Signature::Spike> spikes = sig.getDeltaSpikes();
@@ -252,6 +264,10 @@ PowerStateGraph::PSGraph::vertex_descriptor PowerStateGraph::updateOrInsertVerte
         }
     } else {
         // Add a new vertex
+        if ( num_vertices(powerStateGraph) >= EdgeHistory::MAX_VERTICES ) {
+            Utils::fatalError( "Too many power states.  EdgeHistory can only store "
+                    + Utils::size_t_to_s( EdgeHistory::MAX_VERTICES ) + "." );
+        }
         vertex = add_vertex(powerStateGraph);
         powerStateGraph[vertex].postSpike = postSpikePowerState;
         powerStateGraph[vertex].betweenSpikes = betweenSpikesPowerState;
@@ -283,11 +299,12 @@ PowerStateGraph::PSGraph::vertex_descriptor PowerStateGraph::mostSimilarVertex(
     PSGraph::vertex_descriptor vertex=0;
     std::pair<PSG_vertex_iter, PSG_vertex_iter> vp;
     double tTest, highestTTest=0;
+    const StatSummary statSummary = stat.summary();
 
     // Find the best fit
     for (vp = boost::vertices(powerStateGraph); vp.first != vp.second; ++vp.first) {
         // t test
-        tTest = stat.tTest( powerStateGraph[*vp.first].postSpike );
+        tTest = statSummary.tTest( powerStateGraph[*vp.first].postSpike.summary() );
         if (tTest > highestTTest) {
             highestTTest = tTest;
             vertex = *vp.first;
@@ -353,14 +370,9 @@ void PowerStateGraph::updateOrInsertEdge(
     if ( edgeExistsAlready ) {
 
         if (verbose) {
-            for (list<PSGraph::edge_descriptor>::iterator edge=edgeHistory.begin(); edge!=edgeHistory.end(); edge++) {
-                cout << "                              edgeHistory = " << *edge << endl;
-            }
-            for (list<PSGraph::edge_descriptor>::iterator edge=powerStateGraph[existingEdge].edgeHistory.begin();
-                    edge!=powerStateGraph[existingEdge].edgeHistory.end(); edge++) {
-                cout << "powerStateGraph[existingEdge].edgeHistory = " << *edge << endl;
-            }
-            cout << endl;
+            cout << "                              edgeHistory = " << edgeHistory << endl
+                 << "powerStateGraph[existingEdge].edgeHistory = "
+                 << powerStateGraph[existingEdge].edgeHistory << endl << endl;
         }
 
         // check if any of the out edges from beforeVertex have the same
@@ -398,7 +410,7 @@ void PowerStateGraph::updateOrInsertEdge(
     // either way, we need to add a new edge:
 
     tie(newEdge, edgeExistsAlready) = boost::add_edge(beforeVertex, afterVertex, powerStateGraph);
-    powerStateGraph[newEdge].delta    = Statistic<double>( spikeDelta );
+    powerStateGraph[newEdge].delta    = DeltaStatistic( spikeDelta );
     powerStateGraph[newEdge].duration = Statistic<size_t>( samplesSinceLastSpike );
     powerStateGraph[newEdge].count    = 1;
     powerStateGraph[newEdge].edgeHistory = edgeHistory;
@@ -414,60 +426,35 @@ void PowerStateGraph::updateOrInsertEdge(
 
 /**
  * @brief Check if edge list @c a and edge list @c b are equal.
+ *
+ * The check is lenient: a pair of corresponding edges only counts as
+ * different if they differ in both their source and their target.
+ * See PackedEdgeHistory::matches().
  */
 const bool PowerStateGraph::edgeListsAreEqual(
-        const list< PSGraph::edge_descriptor >& a,
-        const list< PSGraph::edge_descriptor >& b,
+        const EdgeHistory& a,
+        const EdgeHistory& b,
         const bool verbose
         ) const
 {
-    // Check if edge histories are disabled
-    if (EDGE_HISTORY_SIZE == 0)
-        return true;
-
     //******************* DIAGNOSTICS *******************
     if (verbose ) {
         cout << "************" << endl
-                << "comparing lists:" << endl;
+                << "comparing lists:" << endl
+                << a << endl
+                << "----" << endl
+                << b << endl;
 
-        for (list< PSGraph::edge_descriptor >::const_iterator i=a.begin(); i!=a.end(); i++) {
-            cout << *i << endl;
-        }
-        cout << "----" << endl;
-        for (list< PSGraph::edge_descriptor >::const_iterator i=b.begin(); i!=b.end(); i++) {
-            cout << *i << endl;
+        if (a.size() != b.size()) {
+            cout << "sizes not equal" << endl;
         }
     }//___________________________________________________
 
-    if (a.size() != b.size()) {
-        if (verbose) cout << "sizes not equal" << endl;
-        return false;
-    }
-
-    if (verbose) cout << "************" << endl;
-
-    list<PSGraph::edge_descriptor>::const_iterator a_i, b_i;
-
-    a_i = a.begin();
-    b_i = b.begin();
+    const bool equal = a.matches( b );
 
-    while (a_i != a.end() && b_i != b.end()) {
+    if (verbose && !equal) cout << "edge list are not equal" << endl << endl;
 
-        if (verbose) cout << "*a_i=" << *a_i << " *b_i=" << *b_i << endl;
-
-        if ( source(*a_i, powerStateGraph) != source(*b_i, powerStateGraph) &&
-             target(*a_i, powerStateGraph) != target(*b_i, powerStateGraph)   ) {
-
-            if (verbose) cout << "edge list are not equal" << endl << endl;
-
-            return false;
-        }
-
-        a_i++;
-        b_i++;
-    }
-
-    return true;
+    return equal;
 }
 
 /**
@@ -534,7 +521,7 @@ void PowerStateGraph::updateEdges( const Signature& sig )
 
             if (addedEdge.second) { // then there was not an edge already in the graph
                 powerStateGraph[addedEdge.first].delta =
-                        Statistic<double>( prevSpike->delta );
+                        DeltaStatistic( prevSpike->delta );
                 powerStateGraph[addedEdge.first].duration =
                         Statistic<size_t>( prevSpike->index - previousIndex );
                 powerStateGraph[addedEdge.first].count = 1;
@@ -556,7 +543,7 @@ void PowerStateGraph::updateEdges( const Signature& sig )
     addedEdge = boost::add_edge(previousVertex, offVertex, powerStateGraph);
     if (addedEdge.second) { // then there was not an edge already in the graph
         powerStateGraph[addedEdge.first].delta =
-                Statistic<double>( prevSpike->delta );
+                DeltaStatistic( prevSpike->delta );
         powerStateGraph[addedEdge.first].duration =
                 Statistic<size_t>( prevSpike->index - previousIndex );
         powerStateGraph[addedEdge.first].count = 1;
@@ -583,6 +570,88 @@ void PowerStateGraph::writeGraphViz(ostream& out)
             );
 }
 
+/**
+ * @brief Freeze the trained powerStateGraph into @c model, the flat
+ *        structure which disaggregation runs against.
+ *
+ * Called by each disaggregate function, so it only needs calling by
+ * hand to inspect the model.  It must be called again after update().
+ */
+void PowerStateGraph::compile()
+{
+    model = CompiledModel();
+    spikeTables.clear();
+
+    const size_t numVertices = num_vertices( powerStateGraph );
+    const size_t numEdges    = num_edges( powerStateGraph );
+
+    model.firstOutEdge.reserve( numVertices + 1 );
+    model.betweenSpikesMean.reserve( numVertices );
+    model.betweenSpikesMin.reserve( numVertices );
+    model.source.reserve( numEdges );
+    model.target.reserve( numEdges );
+    model.durationMean.reserve( numEdges );
+    model.durationMin.reserve( numEdges );
+    model.durationMax.reserve( numEdges );
+    model.durationSlack.reserve( numEdges );
+    model.durationNonZeroStdev.reserve( numEdges );
+    model.edgeHistory.reserve( numEdges );
+    model.spikeSearch.reserve( numEdges );
+
+    PSG_vertex_iter v_i, v_end;
+    for (tie(v_i, v_end) = vertices(powerStateGraph); v_i != v_end; v_i++) {
+        model.firstOutEdge.push_back( model.source.size() );
+        model.betweenSpikesMean.push_back( powerStateGraph[*v_i].betweenSpikes.mean );
+        model.betweenSpikesMin.push_back( powerStateGraph[*v_i].betweenSpikes.min );
+
+        PSG_out_edge_iter e_i, e_end;
+        for (tie(e_i, e_end) = out_edges(*v_i, powerStateGraph); e_i != e_end; e_i++) {
+            const PowerStateEdge& edge = powerStateGraph[*e_i];
+            model.source.push_back( source(*e_i, powerStateGraph) );
+            model.target.push_back( target(*e_i, powerStateGraph) );
+            model.durationMean.push_back( edge.duration.mean );
+            model.durationMin.push_back( edge.duration.min );
+            model.durationMax.push_back( edge.duration.max );
+            model.durationSlack.push_back( edge.duration.nonZeroStdev() );
+            model.durationNonZeroStdev.push_back( edge.duration.nonZeroStdev() );
+            model.edgeHistory.push_back( edge.edgeHistory );
+            model.spikeSearch.push_back( AggregateData::SpikeSearch( edge.delta, spikeQuantile ) );
+        }
+    }
+    model.firstOutEdge.push_back( model.source.size() );
+}
+
+/**
+ * @brief Find every spike in @c aggData which matches each edge of
+ *        @c model, so that findNextSpikes() can look up the spikes in
+ *        each search window rather than scanning the window.
+ *
+ * Each edge's table is made with a single pass over the data.  The
+ * edges are shared out between threads.  Only possible when aggData
+ * was loaded in one go; otherwise findNextSpikes() scans as before.
+ */
+void PowerStateGraph::tabulateSpikes()
+{
+    spikeTables.clear();
+    if ( ! aggData->canTabulateSpikes() )
+        return;
+
+    spikeTables.resize( model.source.size() );
+    const size_t threads = std::min( numThreads, spikeTables.size() );
+    Parallel::forEach( threads, tabulateSpikesThread, threads, this );
+}
+
+void PowerStateGraph::tabulateSpikesThread(
+        const size_t thread,
+        const size_t numThreads,
+        PowerStateGraph * psg
+        )
+{
+    for (size_t e=thread; e<psg->spikeTables.size(); e+=numThreads) {
+        psg->aggData->findAllSpikes( psg->model.spikeSearch[e], &psg->spikeTables[e] );
+    }
+}
+
 /**
  * @brief This is the main public interface to the disaggregation algorithm
  *
@@ -623,13 +692,17 @@ const list<PowerStateGraph::Fingerprint> PowerStateGraph::disaggregate(
         Utils::fatalError( "powerStateGraph is empty. Cannot continue with disaggregation." );
     }
 
+    compile();
+
     // Store a pointer to aggregateData for use later.
     aggData = &aggregateData;
+    aggDataset = 0;
+
+    tabulateSpikes();
 
     /* Fingerprint is a struct for bundling start
      * timestamp, duration, energy and avLikelihood */
     list<Fingerprint> fingerprintList; // what we return
-    Fingerprint candidateFingerprint;
 
     /* Load the stats from the first PowerStateGraph edge.
      * The Boost Graph Lib provides an out_edges() function which returns
@@ -643,49 +716,630 @@ const list<PowerStateGraph::Fingerprint> PowerStateGraph::disaggregate(
 
     // Search through aggregateData for possible start spikes
     list<AggregateData::FoundSpike> posStartSpikes
-        = aggregateData.findSpike(firstEdgeStats.delta);
+        = aggregateData.findSpike( startSpikeSearch() );
 
     cout << " found " << posStartSpikes.size() << " possible start deltas. Following through... " << endl;
 
+    traceCandidates( posStartSpikes, firstEdgeStats, &fingerprintList, verbose );
+
+    cout << endl;
+
+    finishDisaggregation( &fingerprintList, keep_overlapping, aggregateData.getFilename() );
+
+    return fingerprintList;
+}
+
+/**
+ * @brief Disaggregate data which is being streamed from disk by @c aggregateData
+ *        (see AggregateData::openCurrentCostStream()).
+ *
+ * Only a sliding window of the aggregate data is held in memory so
+ * peak memory use does not depend on the length of the input.  We
+ * search for start spikes a chunk at a time.  The window always extends
+ * at least streamingWindowDuration() seconds past the last start spike
+ * in the chunk so that traceToEnd() sees the same data it would see
+ * if the whole file was loaded.  Once a chunk has been traced, the
+ * samples before it are retired from the window.
+ *
+ * Traces which last longer than streamingWindowDuration() are treated
+ * as if they had run past the end of the data.  Gaps in the data (e.g.
+ * meter outages) which are longer than the look-ahead are skipped over.
+ */
+const list<PowerStateGraph::Fingerprint> PowerStateGraph::disaggregateStream(
+        AggregateData * aggregateData, /**< An AggregateData opened for streaming */
+        const bool keep_overlapping, /**< Should we keep or remove overlapping candidates? */
+        const bool verbose
+        )
+{
+    cout << endl << "***** TRAINING FINISHED. STREAMING DISAGGREGATION STARTING. *****" << endl << endl;
+
+    if (num_vertices( powerStateGraph ) < 2) {
+        Utils::fatalError( "powerStateGraph is empty. Cannot continue with disaggregation." );
+    }
+
+    compile();
+
+    assert( aggregateData->isStreaming() );
+
+    aggData = aggregateData;
+    aggDataset = 0;
+
+    list<Fingerprint> fingerprintList; // what we return
+
+    PSG_out_edge_iter out_i, out_end;
+    tie(out_i, out_end) = out_edges(offVertex, powerStateGraph);
+    PowerStateEdge firstEdgeStats = powerStateGraph[*out_i];
+
+    const size_t lookahead = streamingWindowDuration();
+    cout << "Streaming window look-ahead = " << lookahead << " seconds." << endl;
+
+    // prime the window
+    aggregateData->streamSamplesUntil( 0 );
+    if ( aggregateData->getSize() == 0 ) {
+        cout << "No aggregate data." << endl;
+        return fingerprintList;
+    }
+
+    size_t scanFrom = (*aggregateData)[0].timestamp;
+    size_t fillUntil = scanFrom + (2 * lookahead);
+    size_t totalStartSpikes = 0;
+
+    while ( true ) {
+        // Fill the window so that it covers this chunk plus the look-ahead
+        aggregateData->streamSamplesUntil( fillUntil );
+
+        const size_t lastIndex = aggregateData->getSize() - 1;
+        const size_t lastTimestamp = (*aggregateData)[ lastIndex ].timestamp;
+        const bool lastChunk = aggregateData->endOfStream();
+
+        // Find the end of this chunk.  Chunks always end exactly on a
+        // sample so that consecutive calls to findSpike() neither
+        // overlap nor leave gaps.
+        size_t scanTo = lastTimestamp;
+        if ( ! lastChunk ) {
+            size_t i = lastIndex;
+            while ( i > 0 && (*aggregateData)[i].timestamp > lastTimestamp - lookahead ) {
+                i--;
+            }
+            scanTo = (*aggregateData)[i].timestamp;
+        }
+
+        if ( scanTo > scanFrom ) {
+            list<AggregateData::FoundSpike> posStartSpikes
+                = aggregateData->findSpike( startSpikeSearch(), scanFrom, scanTo );
+            totalStartSpikes += posStartSpikes.size();
+
+            traceCandidates( posStartSpikes, firstEdgeStats, &fingerprintList, verbose );
+
+            // findSpike() looks one sample behind the one it's testing.
+            const size_t samplePeriod = aggregateData->getSamplePeriod();
+            aggregateData->retireSamplesBefore( scanTo > samplePeriod * 2 ? scanTo - samplePeriod * 2 : 0 );
+            scanFrom = scanTo;
+            fillUntil = scanFrom + (2 * lookahead);
+        } else if ( ! lastChunk ) {
+            // There's a gap in the data longer than the look-ahead just
+            // after scanFrom so no sample can end this chunk.  Fill the
+            // window relative to the first sample after the gap instead.
+            size_t i = 0;
+            while ( (*aggregateData)[i].timestamp <= scanFrom ) {
+                i++;
+            }
+            fillUntil = (*aggregateData)[i].timestamp + (2 * lookahead);
+        }
+
+        if ( lastChunk )
+            break;
+    }
+
+    cout << endl << "Found " << totalStartSpikes << " possible start deltas. "
+         << "Peak window size = " << aggregateData->getCapacity() << " samples." << endl;
+
+    finishDisaggregation( &fingerprintList, keep_overlapping, aggregateData->getFilename() );
+
+    return fingerprintList;
+}
+
+/**
+ * @brief Disaggregate data which is being streamed from disk by @c aggregateData
+ *        one sample at a time, as if it was arriving from a meter, with an
+ *        OnlineDisaggregator.  Each fingerprint is displayed as soon as it
+ *        has been found.  See OnlineDisaggregator for which settings are
+ *        used and when the results can differ from disaggregate()'s.
+ */
+const list<PowerStateGraph::Fingerprint> PowerStateGraph::disaggregateOnline(
+        AggregateData * aggregateData, /**< An AggregateData opened for streaming */
+        const bool keep_overlapping, /**< Should we keep or remove overlapping candidates? */
+        const bool verbose
+        )
+{
+    cout << endl << "***** TRAINING FINISHED. ONLINE DISAGGREGATION STARTING. *****" << endl << endl;
+
+    assert( aggregateData->isStreaming() );
+
+    list<Fingerprint> fingerprintList; // what we return
+    list<Fingerprint> finished;
+    OnlineDisaggregator online( this );
+    size_t numSamples = 0, peakOpenCandidates = 0;
+
+    // read one sample at a time
+    aggregateData->streamSamplesUntil( 0 );
+    while ( aggregateData->getSize() > 0 ) {
+        const size_t timestamp = (*aggregateData)[0].timestamp;
+        online.appendSamples( &(*aggregateData)[0], 1, &finished );
+        numSamples++;
+
+        if ( online.getNumOpenCandidates() > peakOpenCandidates )
+            peakOpenCandidates = online.getNumOpenCandidates();
+
+        for (list<Fingerprint>::const_iterator it=finished.begin(); it!=finished.end(); it++) {
+            cout << "Fingerprint found after sample " << timestamp << ":" << endl << *it << endl;
+        }
+        fingerprintList.splice( fingerprintList.end(), finished );
+
+        aggregateData->retireSamplesBefore( timestamp + 1 );
+        aggregateData->streamSamplesUntil( timestamp + 1 );
+    }
+    online.finish( &fingerprintList );
+
+    cout << endl << "Found " << online.getNumStartSpikes() << " possible start deltas in "
+         << numSamples << " samples. Peak window size = " << online.getPeakWindowSize()
+         << " samples, peak open candidates = " << peakOpenCandidates << "." << endl;
+
+    // Candidates finish out of order.  Put them back in start order.
+    fingerprintList.sort( Fingerprint::startsBefore );
+
+    finishDisaggregation( &fingerprintList, keep_overlapping, aggregateData->getFilename() );
+
+    return fingerprintList;
+}
+
+/**
+ * @brief Disaggregate a multi-file dataset (e.g. one CSV file per day).
+ *
+ * Start spikes are searched for one file at a time.  Only the files
+ * which overlap the search windows are loaded: traceToEnd() extends
+ * the dataset's window onto the following files when a trace runs
+ * past the end of the files loaded so far.  The results are the same
+ * as disaggregating the concatenation of all the files.
+ */
+const list<PowerStateGraph::Fingerprint> PowerStateGraph::disaggregate(
+        AggregateDataset * aggregateDataset, /**< An opened AggregateDataset */
+        const bool keep_overlapping, /**< Should we keep or remove overlapping candidates? */
+        const bool verbose
+        )
+{
+    cout << endl << "***** TRAINING FINISHED. DISAGGREGATION STARTING. *****" << endl << endl;
+
+    if (num_vertices( powerStateGraph ) < 2) {
+        Utils::fatalError( "powerStateGraph is empty. Cannot continue with disaggregation." );
+    }
+
+    compile();
+
+    aggDataset = aggregateDataset;
+    aggData = &aggregateDataset->getWindow();
+
+    list<Fingerprint> fingerprintList; // what we return
+
+    PSG_out_edge_iter out_i, out_end;
+    tie(out_i, out_end) = out_edges(offVertex, powerStateGraph);
+    PowerStateEdge firstEdgeStats = powerStateGraph[*out_i];
+
+    size_t totalStartSpikes = 0;
+    const size_t numFiles = aggregateDataset->getNumFiles();
+    for (size_t f=0; f<numFiles; f++) {
+        // Scan up to (but not including) the first sample of the next file
+        // so that no sample is scanned twice or skipped.
+        const size_t scanFrom = aggregateDataset->getFile(f).firstTimestamp;
+        const size_t scanTo   = (f+1 < numFiles) ? aggregateDataset->getFile(f+1).firstTimestamp
+                                                 : aggregateDataset->getFile(f).lastTimestamp;
+        if ( scanTo <= scanFrom )
+            continue;
+
+        list<AggregateData::FoundSpike> posStartSpikes
+            = aggregateDataset->findSpike( startSpikeSearch(), scanFrom, scanTo );
+        totalStartSpikes += posStartSpikes.size();
+
+        traceCandidates( posStartSpikes, firstEdgeStats, &fingerprintList, verbose );
+    }
+
+    cout << endl << "Found " << totalStartSpikes << " possible start deltas. Loaded "
+         << aggregateDataset->getNumFilesLoaded() << " of " << numFiles << " files." << endl;
+
+    aggDataset = 0;
+
+    finishDisaggregation( &fingerprintList, keep_overlapping, aggregateDataset->getName() );
+
+    return fingerprintList;
+}
+
+/**
+ * @brief The length of time (in seconds) which the streaming window must
+ *        extend past a start spike.
+ *
+ * This is sized from the longest trained edge (its longest duration plus
+ * the widening applied to the search window in traceToEnd()).  A trace
+ * can traverse every edge in the graph so we allow for that many edges.
+ */
+const size_t PowerStateGraph::streamingWindowDuration() const
+{
+    size_t longestEdge = 0;
+    PSG_edge_iter e_i, e_end;
+    for (tie(e_i, e_end) = edges(powerStateGraph); e_i != e_end; e_i++) {
+        const size_t span = powerStateGraph[*e_i].duration.max
+                + WINDOW_FRAME + powerStateGraph[*e_i].duration.nonZeroStdev();
+        if ( span > longestEdge )
+            longestEdge = span;
+    }
+
+    return longestEdge * num_edges( powerStateGraph );
+}
+
+/**
+ * @brief State for findBestPath()'s search through a DisagTree.
+ *
+ * A path's "excess" is the sum of (likelihood - lambda) over its
+ * LikelihoodAndVertex items.  A path's average likelihood is greater
+ * than lambda if and only if its excess is positive.
+ *
+ * Each thread re-uses one BestPathSearch for all its candidates so
+ * the arrays are only allocated when a bigger tree comes along.
+ */
+struct PowerStateGraph::BestPathSearch {
+    const DisagTree * disagTree;
+    double lambda;
+
+    std::vector<double> maxExcess;         /**< per vertex: the largest excess of any completion
+                                                below the vertex, or -infinity if none reaches off */
+    std::vector<DisagTree::edge_descriptor> bestEdge; /**< per vertex: first edge of that completion */
+    std::vector<bool> excessFound;         /**< per vertex: have maxExcess and bestEdge been set
+                                                for this lambda?  Shared vertices are reached twice. */
+
+    std::vector<LikelihoodAndVertex> path; /**< the path currently being followed */
+    std::vector<LikelihoodAndVertex> bestPath;
+    double bestAvLikelihood;
+    bool foundGoodPath;
+    bool verbose;
+
+    size_t numGrowths; /**< number of times the arrays have had to grow */
+
+    BestPathSearch()
+    : disagTree(0), lambda(0), bestAvLikelihood(0), foundGoodPath(false), verbose(false),
+      numGrowths(0)
+    {}
+
+    /**
+     * @brief Get ready to search @c _disagTree.
+     */
+    void reset(const DisagTree& _disagTree, const bool _verbose)
+    {
+        disagTree = &_disagTree;
+        lambda = 0;
+        if ( _disagTree.getNumVertices() > maxExcess.capacity() )
+            numGrowths += 3;
+        maxExcess.resize( _disagTree.getNumVertices() );
+        bestEdge.resize( _disagTree.getNumVertices() );
+        excessFound.resize( _disagTree.getNumVertices() );
+        path.clear();
+        bestPath.clear();
+        bestAvLikelihood = 0;
+        foundGoodPath = false;
+        verbose = _verbose;
+    }
+
+    /**
+     * @return true if a path ends at @c vertex (i.e. it is an off state).
+     */
+    const bool isEndOfPath(const DisagTree::vertex_descriptor vertex) const
+    {
+        return vertex != 0 && // check we're not at the first vertex
+               (*disagTree)[ vertex ].meanPower == 0;
+    }
+
+};
+
+/**
+ * @brief Per-thread state used while tracing candidates.
+ *
+ * @c expansionCache is a transposition table holding the spikes which
+ * can follow each DisagState.  The same state is often reached from
+ * neighbouring start candidates, so it lives for a whole call to
+ * traceCandidates().  It can't live any longer because a streamed
+ * window may have grown since.  @c stateTable holds the states
+ * in the DisagTree currently being built, so that a state reached
+ * through a second branch can share the first branch's subtree.
+ *
+ * The arrays here are re-used from one candidate to the next, so they
+ * only grow when a tree is bigger than any tree this thread has built
+ * before.  The spike search itself, and misses in @c expansionCache,
+ * still allocate.
+ */
+struct PowerStateGraph::TraceScratch {
+    DisagTree disagTree; /**< cleared, not freed, between candidates */
+
+    LruCache< DisagState, vector<SpikeMatch> > expansionCache;
+
+    vector<DisagTree::vertex_descriptor> stateTable; /**< open-addressing hash table of the vertices
+                                                          in @c disagTree, keyed by DisagState */
+    vector<uint32_t> stateStamps; /**< per slot: the @c generation in which it was filled.
+                                       Older slots are empty, so reset() needn't touch the table. */
+    uint32_t generation;
+    size_t numStates;          /**< number of vertices in @c stateTable */
+
+    vector<SpikeMatch> matchStack; /**< traceToEnd()'s matches at every level of the recursion */
+
+    vector<bool> prunedBelow;  /**< per vertex: was a branch below it pruned for a reason which
+                                    depends on the path to it?  If so its subtree isn't shared. */
+    double bestCompleteAverage; /**< best average likelihood of any path in @c disagTree
+                                     which traceToEnd() has followed to an off state */
+
+    BestPathSearch bestPathSearch;
+
+    size_t sharedVertices;
+    size_t numVertices;        /**< in every tree built so far */
+    size_t numGrowths;         /**< times @c stateTable, @c matchStack or @c prunedBelow had to grow */
+    size_t prunedByEnergy, prunedByDuration, prunedByLikelihood;
+    size_t prunedCandidates;   /**< candidates which pruning left without a path to off */
+
+    TraceScratch(const size_t cacheSize)
+    : expansionCache(cacheSize), generation(1), numStates(0), bestCompleteAverage(0), sharedVertices(0),
+      numVertices(0), numGrowths(0), prunedByEnergy(0), prunedByDuration(0), prunedByLikelihood(0),
+      prunedCandidates(0)
+    {}
+
+    const size_t numPruned() const
+    {
+        return prunedByEnergy + prunedByDuration + prunedByLikelihood;
+    }
+
+    /**
+     * @brief Clear @c disagTree and @c stateTable ready for the next candidate.
+     */
+    void reset()
+    {
+        numVertices += disagTree.getNumVertices();
+        disagTree.clear();
+        if ( numStates > 0 ) {
+            // empty every slot in O(1) by moving on to the next generation
+            if ( ++generation == 0 ) {
+                stateStamps.assign( stateStamps.size(), 0 );
+                generation = 1;
+            }
+            numStates = 0;
+        }
+        prunedBelow.clear();
+        bestCompleteAverage = 0;
+    }
+
+    void setPrunedBelow(const DisagTree::vertex_descriptor vertex)
+    {
+        if ( vertex >= prunedBelow.size() ) {
+            if ( disagTree.getNumVertices() > prunedBelow.capacity() )
+                numGrowths++;
+            prunedBelow.resize( disagTree.getNumVertices(), false );
+        }
+        prunedBelow[ vertex ] = true;
+    }
+
+    const bool isPrunedBelow(const DisagTree::vertex_descriptor vertex) const
+    {
+        return vertex < prunedBelow.size() && prunedBelow[ vertex ];
+    }
+
+    /**
+     * @return the vertex in @c disagTree with @c state, or DisagTree::NONE.
+     */
+    const DisagTree::vertex_descriptor findVertex(const DisagState& state) const
+    {
+        if ( stateTable.empty() )
+            return DisagTree::NONE;
+
+        const size_t mask = stateTable.size() - 1;
+        for (size_t slot = hash( state ) & mask; isFilled( slot ); slot = (slot + 1) & mask) {
+            if ( stateOf( stateTable[slot] ) == state )
+                return stateTable[slot];
+        }
+        return DisagTree::NONE;
+    }
+
+    /**
+     * @brief Record that @c vertex has @c state.  The table is kept at
+     *        most half full.
+     */
+    void insertVertex(const DisagState& state, const DisagTree::vertex_descriptor vertex)
+    {
+        if ( (numStates + 1) * 2 > stateTable.size() ) {
+            // Double the size of the table and re-insert every vertex
+            const size_t newSize = stateTable.empty() ? 1024 : stateTable.size() * 2;
+            vector<DisagTree::vertex_descriptor> oldTable( newSize );
+            vector<uint32_t> oldStamps( newSize, 0 );
+            oldTable.swap( stateTable );
+            oldStamps.swap( stateStamps );
+            numGrowths += 2;
+            numStates = 0;
+            const uint32_t oldGeneration = generation;
+            generation = 1; // the new stamps are all 0
+            for (size_t i=0; i<oldTable.size(); i++) {
+                if ( oldStamps[i] == oldGeneration )
+                    insertSlot( stateOf( oldTable[i] ), oldTable[i] );
+            }
+        }
+        insertSlot( state, vertex );
+    }
+
+private:
+    static const size_t hash(const DisagState& state)
+    {
+        size_t h = state.timestamp * 0x9E3779B97F4A7C15ULL;
+        h ^= state.psgVertex + (h << 6) + (h >> 2);
+        h ^= state.edgeHistory.hash() + (h << 6) + (h >> 2);
+        return h ^ (h >> 29);
+    }
+
+    const bool isFilled(const size_t slot) const
+    {
+        return stateStamps[slot] == generation;
+    }
+
+    const DisagState stateOf(const DisagTree::vertex_descriptor v) const
+    {
+        DisagState state;
+        state.timestamp   = disagTree[v].timestamp;
+        state.psgVertex   = disagTree[v].psgVertex;
+        state.edgeHistory = disagTree[v].edgeHistory;
+        return state;
+    }
+
+    void insertSlot(const DisagState& state, const DisagTree::vertex_descriptor vertex)
+    {
+        const size_t mask = stateTable.size() - 1;
+        size_t slot = hash( state ) & mask;
+        while ( isFilled( slot ) )
+            slot = (slot + 1) & mask;
+        stateTable[slot] = vertex;
+        stateStamps[slot] = generation;
+        numStates++;
+    }
+};
+
+/**
+ * @brief The candidates shared between the threads started by traceCandidates().
+ */
+struct PowerStateGraph::TraceJob {
+    std::vector<AggregateData::FoundSpike> spikes;
+    std::vector<size_t> deviceStarts;
+    std::vector<Fingerprint> fingerprints; /**< one per spike, in the same order */
+    std::vector<TraceScratch> scratch;     /**< one per thread */
+    std::atomic<size_t> next;              /**< index of the next spike to trace */
+};
+
+/**
+ * @brief Trace candidates from @c job until there are none left.
+ *
+ * Each candidate builds and searches its own DisagTree and each thread
+ * has its own TraceScratch so the only state shared between threads is
+ * @c job->next.
+ */
+void PowerStateGraph::traceCandidatesThread(
+        const size_t thread,
+        const PowerStateGraph * psg,
+        TraceJob * job
+        )
+{
+    size_t i;
+    while ( (i = job->next++) < job->spikes.size() ) {
+        job->fingerprints[i] = psg->initTraceToEnd( job->spikes[i], job->deviceStarts[i], &job->scratch[thread] );
+    }
+}
+
+/**
+ * @brief Attempt to trace each of @c posStartSpikes to the end and add the
+ *        successful candidates to @c fingerprintList.
+ */
+void PowerStateGraph::traceCandidates(
+        const list<AggregateData::FoundSpike>& posStartSpikes,
+        const PowerStateEdge& firstEdgeStats,
+        list<Fingerprint> * fingerprintList, /**< output parameter */
+        const bool verbose
+        )
+{
+    TraceJob job;
+    job.spikes.assign( posStartSpikes.begin(), posStartSpikes.end() );
+    job.fingerprints.resize( job.spikes.size() );
+    job.next = 0;
+
+    for (size_t i=0; i<job.spikes.size(); i++) {
+        // time the device probably started
+        job.deviceStarts.push_back( job.spikes[i].timestamp - firstEdgeStats.duration.mean );
+    }
+
     // For each possible start spike in the delta aggregate, attempt
     // to find all the subsequent spikes specified by powerStateGraph edges.
-    for (list<AggregateData::FoundSpike>::const_iterator posStartSpike=posStartSpikes.begin();
-            posStartSpike!=posStartSpikes.end();
-            posStartSpike++) {
+    // Candidates are independent so they are shared out between threads.
+    // A multi-file dataset loads files into its window while tracing
+    // so must be traced on a single thread.
+    size_t threads = (aggDataset == 0) ? numThreads : 1;
+    if ( threads > job.spikes.size() )
+        threads = job.spikes.size();
+
+    job.scratch.assign( threads, TraceScratch( expansionCacheSize ) );
+    Parallel::forEach( threads, traceCandidatesThread, this, &job );
+
+    for (size_t t=0; t<job.scratch.size(); t++) {
+        expansionCacheHits      += job.scratch[t].expansionCache.getHits();
+        expansionCacheMisses    += job.scratch[t].expansionCache.getMisses();
+        expansionCacheEvictions += job.scratch[t].expansionCache.getEvictions();
+        sharedDisagVertices     += job.scratch[t].sharedVertices;
+        prunedByEnergy          += job.scratch[t].prunedByEnergy;
+        prunedByDuration        += job.scratch[t].prunedByDuration;
+        prunedByLikelihood      += job.scratch[t].prunedByLikelihood;
+        prunedCandidates        += job.scratch[t].prunedCandidates;
+        job.scratch[t].reset();
+        disagTreeVertices       += job.scratch[t].numVertices;
+        disagTreeArenaGrowths   += job.scratch[t].disagTree.getNumGrowths()
+                                 + job.scratch[t].numGrowths
+                                 + job.scratch[t].bestPathSearch.numGrowths;
+    }
 
-        // Attempt to recursively "follow through" from this posStartSpike.
-        // initTraceToEnd() calls the recursive function traceToEnd().
-        candidateFingerprint = initTraceToEnd(
-                *posStartSpike,
-                ( posStartSpike->timestamp - firstEdgeStats.duration.mean ) // time the device probably started
-                );
+    // Merge in start-spike order so the output is the same however many
+    // threads were used.
+    for (size_t i=0; i<job.fingerprints.size(); i++) {
 
         // If this start spike was successfully traced all the way to
         // an off power state then add this item to fingerprintList.
-        if ( candidateFingerprint.avLikelihood != -1 ) {
-            fingerprintList.push_back( candidateFingerprint );
+        if ( job.fingerprints[i].avLikelihood != -1 ) {
+            fingerprintList->push_back( job.fingerprints[i] );
             if (verbose)
-                cout << endl << "candidate found at " << endl << candidateFingerprint << endl;
+                cout << endl << "candidate found at " << endl << job.fingerprints[i] << endl;
             else {
                 cout << ".";
                 cout.flush();
             }
         }
     }
+}
 
-    cout << endl;
+/**
+ * @brief Remove overlapping fingerprints (if required) then display and plot the results.
+ */
+void PowerStateGraph::finishDisaggregation(
+        list<Fingerprint> * fingerprintList, /**< Input and output parameter */
+        const bool keep_overlapping,
+        const string& aggDataFilename
+        )
+{
+    const size_t lookups = expansionCacheHits + expansionCacheMisses;
+    if ( lookups > 0 ) {
+        cout << "Expansion cache: " << expansionCacheHits << " hits in " << lookups << " look-ups ("
+             << (100.0 * expansionCacheHits) / lookups << "% hit rate), "
+             << expansionCacheEvictions << " evictions.  "
+             << sharedDisagVertices << " DisagTree vertices shared." << endl;
+        cout << "DisagTree arenas: " << disagTreeVertices << " vertices built; arrays grown "
+             << disagTreeArenaGrowths << " times." << endl;
+    }
+    expansionCacheHits = expansionCacheMisses = expansionCacheEvictions = sharedDisagVertices = 0;
+    disagTreeVertices = disagTreeArenaGrowths = 0;
+
+    if ( pruneEnergyFactor > 0 || pruneDurationFactor > 0 || pruneRemainingEdges > 0 ) {
+        cout << "Pruned " << prunedByEnergy + prunedByDuration + prunedByLikelihood << " DisagTree branches: "
+             << prunedByEnergy << " over the energy limit, "
+             << prunedByDuration << " over the duration limit and "
+             << prunedByLikelihood << " unable to beat the best path." << endl;
+        if ( prunedCandidates > 0 )
+            cout << "Warning: pruning left " << prunedCandidates << " candidates without a path to off.  "
+                 << "The pruning limits may be too tight." << endl;
+    }
+    prunedByEnergy = prunedByDuration = prunedByLikelihood = prunedCandidates = 0;
 
-    if ( fingerprintList.empty() ) {
+    if ( fingerprintList->empty() ) {
         cout << "No signatures found." << endl;
     } else {
         if (!keep_overlapping) {
-            removeOverlapping( &fingerprintList );
+            removeOverlapping( fingerprintList );
         }
 
-        displayAndPlotFingerprintList( fingerprintList, aggregateData.getFilename() );
+        displayAndPlotFingerprintList( *fingerprintList, aggDataFilename );
     }
-
-    return fingerprintList;
 }
 
 void PowerStateGraph::displayAndPlotFingerprintList(
@@ -741,43 +1395,35 @@ void PowerStateGraph::displayAndPlotFingerprintList(
 }
 
 /**
- * Remove any overlapping list entries and leave the one with the highest likelihood
+ * Remove overlapping list entries, keeping the set of candidates with
+ * the highest total likelihood in which no more than @c maxOverlap
+ * candidates overlap at any time (see IntervalSelection).  The candidates
+ * which are kept stay in their original order.
  */
 void PowerStateGraph::removeOverlapping(
         list<Fingerprint> * fingerprintList, /**< Input and output parameter */
         const bool verbose
         )
 {
-    list<Fingerprint>::iterator currentDisagItem, prevDisagItem;
-    size_t count = 0;
-
-    currentDisagItem = prevDisagItem = fingerprintList->begin();
-    advance( currentDisagItem, 1 );
-    while ( currentDisagItem != fingerprintList->end() ) {
-
-        // check to see whether the two disag items overlap
-        if ( (prevDisagItem->timestamp + prevDisagItem->duration) >= currentDisagItem->timestamp ) {
-
-            count++;
-
-            if (verbose) {
-                cout << "Overlap detected between items with start timestamps "
-                    << prevDisagItem->timestamp << " and " << currentDisagItem->timestamp << " ...";
-            }
+    vector<IntervalSelection::Interval> intervals;
+    intervals.reserve( fingerprintList->size() );
+    for (list<Fingerprint>::const_iterator it=fingerprintList->begin(); it!=fingerprintList->end(); it++) {
+        intervals.push_back(
+                IntervalSelection::Interval( it->timestamp, it->timestamp + it->duration, it->avLikelihood ) );
+    }
 
-            // they overlap.  so find which needs to be replaced
-            if (prevDisagItem->avLikelihood < currentDisagItem->avLikelihood) {
-                if (verbose) cout << "erasing item with timestamp " << prevDisagItem->timestamp << endl;
-                fingerprintList->erase( prevDisagItem );
-                prevDisagItem = currentDisagItem++;
-            } else {
-                if (verbose) cout << "erasing item with timestamp " << currentDisagItem->timestamp << endl;
-                fingerprintList->erase( currentDisagItem++ );
-                // don't change prevDisagItem
-            }
+    vector<bool> selected;
+    IntervalSelection::select( intervals, maxOverlap, &selected );
 
+    size_t count = 0, i = 0;
+    list<Fingerprint>::iterator disagItem = fingerprintList->begin();
+    while ( disagItem != fingerprintList->end() ) {
+        if ( selected[i++] ) {
+            disagItem++;
         } else {
-            prevDisagItem = currentDisagItem++;
+            count++;
+            if (verbose) cout << "erasing overlapping item with timestamp " << disagItem->timestamp << endl;
+            fingerprintList->erase( disagItem++ );
         }
     }
 
@@ -789,193 +1435,481 @@ void PowerStateGraph::removeOverlapping(
 }
 
 /**
+ * @brief Start a DisagTree for the candidate which begins with @c spike:
+ *        vertex 0 represents "off" at @c deviceStart and vertex 1 the
+ *        power state after @c spike.  @c disagTree must be empty.
  *
- * @return DisaggregatedStruct.likelihood will be set to -1 if
- * this looks like it's not a good candidate match.
+ * @return the vertex after @c spike and the likelihood of the edge to
+ *         it, which is the first item of every path through the tree.
  */
-const PowerStateGraph::Fingerprint PowerStateGraph::initTraceToEnd(
+const PowerStateGraph::LikelihoodAndVertex PowerStateGraph::startDisagTree(
+        DisagTree * disagTree_p, /**< output parameter */
         const AggregateData::FoundSpike& spike,
-        const size_t deviceStart, /**< The possible time the device started. */
-        const bool verbose
-        )
+        const size_t deviceStart /**< The possible time the device started. */
+        ) const
 {
-    DisagTree disagTree;
+    DisagTree& disagTree = *disagTree_p;
 
     // make the first vertex (which represents "off")
-    DisagTree::vertex_descriptor disagOffVertex = add_vertex(disagTree);
+    DisagTree::vertex_descriptor disagOffVertex = disagTree.addVertex();
     disagTree[disagOffVertex].timestamp = deviceStart;
     disagTree[disagOffVertex].meanPower = 0; // this is "off"
     disagTree[disagOffVertex].psgVertex = offVertex;
 
     // add a vertex to represent the first true power state
-    DisagTree::vertex_descriptor firstVertex = add_vertex(disagTree);
+    DisagTree::vertex_descriptor firstVertex = disagTree.addVertex();
 
     // retrieve info for firstVertex and for edge between disagOffVertex and firstVertex
-    PSG_out_edge_iter out_e_i, out_e_end;
-    PSG_vertex_iter v_i, v_end;
-    tie(out_e_i, out_e_end) = out_edges(offVertex, powerStateGraph);
-    PowerStateEdge firstEdgeStats = powerStateGraph[*out_e_i];
-    tie(v_i, v_end) = vertices(powerStateGraph);
-    v_i++;
+    // (the first out-edge of offVertex and the vertex after offVertex)
+    const size_t firstEdge = model.firstOutEdge[offVertex];
+    const PSGraph::vertex_descriptor firstPsgVertex = 1;
 
     disagTree[firstVertex].timestamp = spike.timestamp;
-    disagTree[firstVertex].meanPower = powerStateGraph[*v_i].betweenSpikes.mean;
-    disagTree[firstVertex].psgVertex = *v_i;
-    disagTree[firstVertex].psgEdge   = *out_e_i;
-    if (EDGE_HISTORY_SIZE)
-        disagTree[firstVertex].edgeHistory.push_back(*out_e_i);
+    disagTree[firstVertex].meanPower = model.betweenSpikesMean[firstPsgVertex];
+    disagTree[firstVertex].psgVertex = firstPsgVertex;
+    disagTree[firstVertex].psgEdge   = firstEdge;
+    disagTree[firstVertex].edgeHistory.push_back( model.source[firstEdge], model.target[firstEdge] );
 
     // add an edge between disagOffVertex and firstVertex
-    DisagTree::edge_descriptor edge;
-    bool existingEdge;
-    tie(edge, existingEdge) = add_edge(
+    DisagTree::edge_descriptor edge = disagTree.addEdge(
             disagOffVertex,   // source vertex
             firstVertex,      // target vertex
-            spike.likelihood, // edge value
-            disagTree);
+            spike.likelihood  // edge value
+            );
 
-    // now recursively trace from this edge to the end
-    traceToEnd( &disagTree, firstVertex, deviceStart );
+    LikelihoodAndVertex firstLAV;
+    firstLAV.vertex = firstVertex;
+    firstLAV.likelihood = disagTree.likelihood(edge);
+    return firstLAV;
+}
+
+/**
+ *
+ * @return DisaggregatedStruct.likelihood will be set to -1 if
+ * this looks like it's not a good candidate match.
+ */
+const PowerStateGraph::Fingerprint PowerStateGraph::initTraceToEnd(
+        const AggregateData::FoundSpike& spike,
+        const size_t deviceStart, /**< The possible time the device started. */
+        TraceScratch * scratch,
+        const bool verbose
+        ) const
+{
+    scratch->reset();
+    DisagTree& disagTree = scratch->disagTree;
+
+    const LikelihoodAndVertex firstLAV = startDisagTree( &disagTree, spike, deviceStart );
+    const DisagTree::vertex_descriptor disagOffVertex = 0;
+    const DisagTree::vertex_descriptor firstVertex = firstLAV.vertex;
+
+    // now trace from this edge to the end
+    const size_t prunedBefore = scratch->numPruned();
+    if ( beamWidth == 0 ) {
+        PathSoFar pathSoFar;
+        pathSoFar.energy = 0; // disagOffVertex uses no power
+        pathSoFar.likelihoodSum = 2 * spike.likelihood; // findBestPath() counts the first edge twice
+        pathSoFar.length = 2;
+        traceToEnd( &disagTree, firstVertex, deviceStart, pathSoFar, scratch );
+    } else {
+        traceBeam( &disagTree, firstVertex, spike.likelihood, scratch );
+    }
 
     if (verbose) {
-        write_graphviz(cout, disagTree,
+        disagTree.writeGraphViz(cout,
             Disag_vertex_writer(disagTree), Disag_edge_writer(disagTree));
     }
 
-    // find route through the tree with highest average edge likelihoods
-    listOfPaths.clear();
+    // Return the most confident path through the disagTree
+    const Fingerprint fingerprint =
+            findBestPath( disagTree, &scratch->bestPathSearch, disagOffVertex, firstLAV, deviceStart );
 
-    LikelihoodAndVertex nextLAV;
-    nextLAV.vertex = firstVertex;
-    nextLAV.likelihood = disagTree[edge];
+    // A limit which removes every path is too tight to trust
+    if ( fingerprint.avLikelihood == -1 && scratch->numPruned() > prunedBefore )
+        scratch->prunedCandidates++;
 
-    findListOfPathsThroughDisagTree(
-            disagTree,
-            disagOffVertex,
-            nextLAV);
+    return fingerprint;
+}
 
-    // Return the most confident path through the disagTree
-    return findBestPath( disagTree, deviceStart );
+/**
+ * @brief Bottom-up pass which sets @c search->maxExcess and
+ *        @c search->bestEdge for @c vertex and every vertex below it.
+ */
+void PowerStateGraph::findMaxExcess(
+        BestPathSearch * search, /**< input and output parameter */
+        const DisagTree::vertex_descriptor vertex
+        ) const
+{
+    const DisagTree& disagTree = *search->disagTree;
+
+    if ( search->excessFound[ vertex ] )
+        return;
+    search->excessFound[ vertex ] = true;
 
+    // base case = we're at the end
+    if ( search->isEndOfPath( vertex ) ) {
+        search->maxExcess[ vertex ] = 0;
+        return;
+    }
+
+    search->maxExcess[ vertex ] = -numeric_limits<double>::infinity();
+
+    for (DisagTree::edge_descriptor e = disagTree.firstOutEdge(vertex); e != DisagTree::NONE; e = disagTree.nextOutEdge(e)) {
+        const DisagTree::vertex_descriptor downstreamVertex = disagTree.target(e);
+        findMaxExcess( search, downstreamVertex );
+
+        if ( search->maxExcess[ downstreamVertex ] == -numeric_limits<double>::infinity() )
+            continue; // no completion through this edge
+
+        const double excess = disagTree.likelihood(e) - search->lambda + search->maxExcess[ downstreamVertex ];
+        if ( excess > search->maxExcess[ vertex ] ) {
+            search->maxExcess[ vertex ] = excess;
+            search->bestEdge[ vertex ] = e;
+        }
+    }
 }
 
 /**
- * @brief Trace the tree downwards from @c vertex recursively finding
- * every path which successfully completes (i.e. reaches an off state).
+ * @brief Trace the tree downwards from @c vertex following only the paths
+ *        whose excess could be within @c EXCESS_TOLERANCE of zero (i.e.
+ *        whose average likelihood could equal the best average) and keep
+ *        the best of them in @c search->bestPath.
+ *
+ * Paths are visited in the same order as the full enumeration used to
+ * visit them, and ties go to the last path visited, so this picks
+ * exactly the same path as enumerating every path would.
  */
-void PowerStateGraph::findListOfPathsThroughDisagTree(
-        const DisagTree& disagTree,
+void PowerStateGraph::findBestPathsThroughDisagTree(
+        BestPathSearch * search, /**< input and output parameter */
         const DisagTree::vertex_descriptor vertex,
-        const LikelihoodAndVertex lav,
-        list<PowerStateGraph::LikelihoodAndVertex> path /**< Deliberately called-by-value because we want a copy. */
-    )
+        const LikelihoodAndVertex& lav,
+        const double partialExcess /**< excess of search->path plus lav */
+        ) const
 {
-    path.push_back( lav );
+    static const double EXCESS_TOLERANCE = 1e-9;
 
-    // base case = we're at the end
-    if ( vertex != 0 && // check we're not at the first vertex
-            disagTree[ vertex ].meanPower == 0 ) {
-        listOfPaths.push_back( path );
+    if ( partialExcess + search->maxExcess[ vertex ] < -EXCESS_TOLERANCE )
         return;
-    }
 
-    // iterate through each out-edge
-    Disag_out_edge_iter out_e_i, out_e_end;
-    tie(out_e_i, out_e_end) = out_edges(vertex, disagTree);
+    const DisagTree& disagTree = *search->disagTree;
+    if ( search->path.size() == search->path.capacity() )
+        search->numGrowths++;
+    search->path.push_back( lav );
 
-    for (; out_e_i!=out_e_end; out_e_i++) {
+    if ( search->isEndOfPath( vertex ) ) {
+        double likelihoodAccumulator = 0;
+        for (size_t i=0; i<search->path.size(); i++) {
+            if (search->verbose) cout << "vertex=" << search->path[i].vertex << " conf=" << search->path[i].likelihood << ", ";
+            likelihoodAccumulator += search->path[i].likelihood;
+        }
+        if (search->verbose) cout << endl << endl;
 
-        DisagTree::vertex_descriptor downstreamVertex = target(*out_e_i, disagTree);
+        const double avLikelihood = likelihoodAccumulator / search->path.size();
 
-        LikelihoodAndVertex nextLav;
-        nextLav.vertex = downstreamVertex;
-        nextLav.likelihood = disagTree[*out_e_i];
+        // if this is the most confident path we've seen yet then record its details.
+        if ( avLikelihood >= search->bestAvLikelihood ) {
+            search->bestAvLikelihood = avLikelihood;
+            if ( search->path.size() > search->bestPath.capacity() )
+                search->numGrowths++;
+            search->bestPath.assign( search->path.begin(), search->path.end() );
+            search->foundGoodPath = true;
+        }
+    } else {
+        for (DisagTree::edge_descriptor e = disagTree.firstOutEdge(vertex); e != DisagTree::NONE; e = disagTree.nextOutEdge(e)) {
 
-        // we haven't hit the end yet so recursively follow tree downwards.
-        findListOfPathsThroughDisagTree(
-                disagTree,
-                downstreamVertex,
-                nextLav,
-                path );
+            LikelihoodAndVertex nextLav;
+            nextLav.vertex = disagTree.target(e);
+            nextLav.likelihood = disagTree.likelihood(e);
 
+            findBestPathsThroughDisagTree(
+                    search,
+                    nextLav.vertex,
+                    nextLav,
+                    partialExcess + nextLav.likelihood - search->lambda );
+        }
     }
-    return;
+
+    search->path.pop_back();
 }
 
 
 /**
- * Trace from startVertex to the off state in PSGraph
+ * Trace from startVertex to the off state in PSGraph.  This is the
+ * exhaustive search: every matching spike is followed unless
+ * pruneBranch() rules it out.
+ *
+ * @return true if a branch below @c disagVertex was pruned for a reason
+ *         which depends on the path to @c disagVertex.
  */
-void PowerStateGraph::traceToEnd(
+const bool PowerStateGraph::traceToEnd(
         DisagTree * disagTree_p, /**< input and output parameter */
         const DisagTree::vertex_descriptor& disagVertex,
         const size_t prevTimestamp, /**< timestamp of previous vertex */
+        const PathSoFar& pathSoFar, /**< the path from the root down to @c disagVertex */
+        TraceScratch * scratch,
         const bool verbose
         ) const
 {
 
     if (verbose) cout << "***traceToEnd... prevTimestamp=" << prevTimestamp << " DisagTree startVertex=" << disagVertex << endl;
 
-    list<AggregateData::FoundSpike> foundSpikes;
-
     // A handy reference to make the code more readable
     DisagTree& disagTree = *disagTree_p;
 
     // base case
     if ( disagTree[disagVertex].psgVertex == offVertex ) {
-        return;
+        return false;
     }
 
-    // For each out-edge from disagVertex.psgVertex, retrieve a list of
-    // spikes which match and create a new DisagTree vertex for each match.
-    PSG_out_edge_iter psg_out_i, psg_out_end;
-    tie(psg_out_i, psg_out_end) =
-            out_edges(disagTree[disagVertex].psgVertex, powerStateGraph);
+    // The matches for this level go on top of scratch->matchStack.
+    // Deeper levels push theirs above ours (and may move the stack)
+    // so we refer to our matches by index.
+    const size_t firstMatch = scratch->matchStack.size();
+    const size_t capacity = scratch->matchStack.capacity();
+    if (verbose)
+        findNextSpikes( disagTree, disagVertex, &scratch->matchStack, verbose );
+    else
+        cachedNextSpikes( disagTree, disagVertex, scratch, &scratch->matchStack );
+    const size_t endMatch = scratch->matchStack.size();
+    if ( scratch->matchStack.capacity() != capacity )
+        scratch->numGrowths++;
+
+    bool pathDependent = false;
+
+    // for each candidate spike, create a new vertex in disagTree
+    // and recursively trace this to the end
+    for (size_t i=firstMatch; i<endMatch; i++) {
+        const SpikeMatch match = scratch->matchStack[i];
+        const DisagState state = nextState( disagTree, disagVertex, match );
+
+        PathSoFar nextPath;
+        nextPath.energy = pathSoFar.energy +
+                disagTree[disagVertex].meanPower * (match.timestamp - disagTree[disagVertex].timestamp);
+        nextPath.likelihoodSum = pathSoFar.likelihoodSum + match.likelihood;
+        nextPath.length = pathSoFar.length + 1;
+
+        if ( pruneBranch( disagTree, state, nextPath, scratch, &pathDependent ) )
+            continue;
 
-    const size_t WINDOW_FRAME = 8; // number of seconds to widen window by
+        // If another branch has already reached this state then its
+        // subtree is exactly the subtree we'd build, so share it.
+        // Unless pruning cut that subtree short for the other branch.
+        const DisagTree::vertex_descriptor shared = scratch->findVertex( state );
+        if ( shared != DisagTree::NONE && ! scratch->isPrunedBelow( shared ) ) {
+            disagTree.addEdge( disagVertex, shared, match.likelihood );
+            scratch->sharedVertices++;
+            continue;
+        }
 
-    for (; psg_out_i!=psg_out_end; psg_out_i++ ) {
+        DisagTree::vertex_descriptor newVertex = addDisagVertex( disagTree_p, disagVertex, match, state );
+        if ( shared == DisagTree::NONE )
+            scratch->insertVertex( state, newVertex );
 
-        // Commented out alternative strategy for getting edge history. Almost certainly slower than
-        // using disagTree[disagVertex].edgeHistory
-//        std::list< PSGraph::edge_descriptor > eHistory = getEdgeHistoryForVertex(disagTree, disagVertex);
+        // findBestPath() ends a path at the first vertex which uses no power
+        if ( disagTree[newVertex].meanPower == 0 ) {
+            const double avLikelihood = nextPath.likelihoodSum / nextPath.length;
+            if ( avLikelihood > scratch->bestCompleteAverage )
+                scratch->bestCompleteAverage = avLikelihood;
+        }
 
-        if ( ! edgeListsAreEqual(
-//                eHistory,
-                disagTree[disagVertex].edgeHistory,
-                powerStateGraph[*psg_out_i].edgeHistory ) ) {
-            if (verbose) cout << "edge histories not equal" << endl;
-            continue;
+        if ( traceToEnd(disagTree_p, newVertex, disagTree[disagVertex].timestamp, nextPath, scratch) ) {
+            scratch->setPrunedBelow( newVertex );
+            pathDependent = true;
+        }
+    }
+
+    scratch->matchStack.resize( firstMatch );
+    return pathDependent;
+}
+
+/**
+ * @brief Heuristic pruning test for the branch which would add a vertex
+ *        with @c state to the DisagTree.  See setPruning().
+ *
+ * The duration limit only depends on @c state.  The energy limit and
+ * the remaining-edges limit depend on the path to @c state so, if either
+ * prunes the branch, @c *pathDependent is set.
+ *
+ * @return true if the branch should not be followed.
+ */
+const bool PowerStateGraph::pruneBranch(
+        const DisagTree& disagTree,
+        const DisagState& state,
+        const PathSoFar& pathSoFar, /**< the path down to and including the new vertex */
+        TraceScratch * scratch,
+        bool * pathDependent /**< output parameter.  Set if the branch is pruned because of its path. */
+        ) const
+{
+    static const double LIKELIHOOD_TOLERANCE = 1e-9;
+    const size_t deviceStart = disagTree[0].timestamp; // vertex 0 is the root
+
+    if ( pruneDurationFactor > 0 &&
+            state.timestamp - deviceStart > pruneDurationFactor * runDuration.getMax() ) {
+        scratch->prunedByDuration++;
+        return true;
+    }
+
+    // energy only goes up as the path gets longer
+    if ( pruneEnergyFactor > 0 &&
+            pathSoFar.energy > pruneEnergyFactor * energyConsumption.getMax() ) {
+        scratch->prunedByEnergy++;
+        *pathDependent = true;
+        return true;
+    }
+
+    // Each edge's likelihood is at most 1 so, if the path ends within
+    // pruneRemainingEdges more edges, its average can't exceed this.
+    // Longer paths can, so this is a heuristic not a true bound.
+    if ( pruneRemainingEdges > 0 && model.betweenSpikesMean[ state.psgVertex ] != 0 ) {
+        const double bound = (pathSoFar.likelihoodSum + pruneRemainingEdges)
+                           / (pathSoFar.length + pruneRemainingEdges);
+        if ( bound < scratch->bestCompleteAverage - LIKELIHOOD_TOLERANCE ) {
+            scratch->prunedByLikelihood++;
+            *pathDependent = true;
+            return true;
         }
+    }
+
+    return false;
+}
+
+/**
+ * @brief findNextSpikes() via the transposition table in @c scratch.
+ */
+void PowerStateGraph::cachedNextSpikes(
+        const DisagTree& disagTree,
+        const DisagTree::vertex_descriptor& disagVertex,
+        TraceScratch * scratch,
+        vector<SpikeMatch> * matches /**< output parameter.  Matches are appended. */
+        ) const
+{
+    DisagState state;
+    state.timestamp   = disagTree[disagVertex].timestamp;
+    state.psgVertex   = disagTree[disagVertex].psgVertex;
+    state.edgeHistory = disagTree[disagVertex].edgeHistory;
+
+    const vector<SpikeMatch> * cached = scratch->expansionCache.find( state );
+    if ( cached ) {
+        matches->insert( matches->end(), cached->begin(), cached->end() );
+    } else {
+        const size_t firstMatch = matches->size();
+        findNextSpikes( disagTree, disagVertex, matches );
+        scratch->expansionCache.insert( state, vector<SpikeMatch>( matches->begin() + firstMatch, matches->end() ) );
+    }
+}
+
+/**
+ * @brief Work out the window of time in which findNextSpikes() looks for
+ *        a spike matching @c psgEdge after @c disagVertex.
+ *
+ * @return false if @c psgEdge can't follow @c disagVertex because their
+ *         edge histories differ.
+ */
+const bool PowerStateGraph::searchWindow(
+        const DisagTree& disagTree,
+        const DisagTree::vertex_descriptor& disagVertex,
+        const size_t psgEdge, /**< an out-edge of @c disagVertex's PSG vertex */
+        size_t * begOfSearchWindow, /**< output parameter.  UNIX timestamp. */
+        size_t * endOfSearchWindow, /**< output parameter.  UNIX timestamp. */
+        const bool verbose
+        ) const
+{
+    // Commented out alternative strategy for getting edge history. Almost certainly slower than
+    // using disagTree[disagVertex].edgeHistory
+//    EdgeHistory eHistory = getEdgeHistoryForVertex(disagTree, disagVertex);
+
+    if ( ! edgeListsAreEqual(
+//            eHistory,
+            disagTree[disagVertex].edgeHistory,
+            model.edgeHistory[psgEdge] ) ) {
+        if (verbose) cout << "edge histories not equal" << endl;
+        return false;
+    }
+
+    size_t e = model.durationSlack[psgEdge];
+
+    if (verbose)  cout << "disagTree[startVertex].timestamp=" << disagTree[disagVertex].timestamp << endl;
+
+    *begOfSearchWindow = (disagTree[disagVertex].timestamp + model.durationMin[psgEdge])
+            - WINDOW_FRAME - e;
+
+    *endOfSearchWindow = (disagTree[disagVertex].timestamp + model.durationMax[psgEdge])
+            + WINDOW_FRAME + e;
 
+    //********************** DIAGNOSTICS *************************
+    if (verbose) {
+        cout << "endOfSearchWindow=" << *endOfSearchWindow
+                << " disagTree[startVertex].timestamp=" << disagTree[disagVertex].timestamp
+                << " model.durationMax[psgEdge]=" << model.durationMax[psgEdge]
+                << " model.durationMean[psgEdge]=" << model.durationMean[psgEdge]
+                << " model.durationNonZeroStdev[psgEdge]=" << model.durationNonZeroStdev[psgEdge]
+                << endl;
+    }//__________________________________________________________
+
+    // ensure we're not looking backwards in time
+    if (*begOfSearchWindow <= disagTree[disagVertex].timestamp) {
+        *begOfSearchWindow =
+                disagTree[disagVertex].timestamp
+                + model.durationMin[psgEdge]
+                - (model.durationMin[psgEdge] / 10);
+    }
+
+    return true;
+}
+
+/**
+ * @return the end of the last of @c disagVertex's search windows (see
+ *         searchWindow()), i.e. the time up to which the aggregate data
+ *         must reach before findNextSpikes() can see every spike which
+ *         could follow @c disagVertex.  0 if nothing can follow it.
+ */
+const size_t PowerStateGraph::searchHorizon(
+        const DisagTree& disagTree,
+        const DisagTree::vertex_descriptor& disagVertex
+        ) const
+{
+    const PSGraph::vertex_descriptor psgVertex = disagTree[disagVertex].psgVertex;
+    size_t horizon = 0;
+    for (size_t psgEdge = model.firstOutEdge[psgVertex]; psgEdge < model.firstOutEdge[psgVertex+1]; psgEdge++) {
         size_t begOfSearchWindow, endOfSearchWindow;
+        if ( searchWindow( disagTree, disagVertex, psgEdge, &begOfSearchWindow, &endOfSearchWindow )
+                && endOfSearchWindow > horizon ) {
+            horizon = endOfSearchWindow;
+        }
+    }
+    return horizon;
+}
 
-        size_t e = powerStateGraph[*psg_out_i].duration.nonZeroStdev();
+/**
+ * @brief Find every spike which could follow @c disagVertex.
+ *
+ * Matches are appended to @c matches in out-edge order and, for
+ * each out-edge, in time order.
+ */
+void PowerStateGraph::findNextSpikes(
+        const DisagTree& disagTree,
+        const DisagTree::vertex_descriptor& disagVertex,
+        vector<SpikeMatch> * matches, /**< output parameter */
+        const bool verbose
+        ) const
+{
+    // For each out-edge from disagVertex.psgVertex, work out the window
+    // in which to search for a matching spike.  All the windows are then
+    // searched in a single pass with AggregateData::findSpikes().
+    const PSGraph::vertex_descriptor psgVertex = disagTree[disagVertex].psgVertex;
 
-        if (verbose)  cout << "disagTree[startVertex].timestamp=" << disagTree[disagVertex].timestamp << endl;
+    vector<size_t> searchedEdges;
+    vector<AggregateData::SpikeQuery> queries;
 
-        begOfSearchWindow = (disagTree[disagVertex].timestamp + powerStateGraph[*psg_out_i].duration.min)
-                - WINDOW_FRAME - e;
+    for (size_t psgEdge = model.firstOutEdge[psgVertex]; psgEdge < model.firstOutEdge[psgVertex+1]; psgEdge++) {
 
-        endOfSearchWindow = (disagTree[disagVertex].timestamp + powerStateGraph[*psg_out_i].duration.max)
-                + WINDOW_FRAME + e;
+        size_t begOfSearchWindow, endOfSearchWindow;
+        if ( ! searchWindow( disagTree, disagVertex, psgEdge, &begOfSearchWindow, &endOfSearchWindow, verbose ) )
+            continue;
 
-        //********************** DIAGNOSTICS *************************
-        if (verbose) {
-            cout << "endOfSearchWindow=" << endOfSearchWindow
-                    << " disagTree[startVertex].timestamp=" << disagTree[disagVertex].timestamp
-                    << " powerStateGraph[*psg_out_i].duration.max=" << powerStateGraph[*psg_out_i].duration.max
-                    << " powerStateGraph[*psg_out_i].duration.mean=" << powerStateGraph[*psg_out_i].duration.mean
-                    << " powerStateGraph[*psg_out_i].duration.stdev=" << powerStateGraph[*psg_out_i].duration.stdev
-                    << endl;
-        }//__________________________________________________________
-
-        // ensure we're not looking backwards in time
-        if (begOfSearchWindow <= disagTree[disagVertex].timestamp) {
-            begOfSearchWindow =
-                    disagTree[disagVertex].timestamp
-                    + powerStateGraph[*psg_out_i].duration.min
-                    - (powerStateGraph[*psg_out_i].duration.min / 10);
+        // if aggData is a window onto a multi-file dataset then
+        // make sure the window reaches the end of the search window
+        if (aggDataset != 0) {
+            aggDataset->extendWindowTo( endOfSearchWindow );
         }
 
         // check that we're not looking past the end of aggData
@@ -983,127 +1917,306 @@ void PowerStateGraph::traceToEnd(
             continue; // we can't process this if we're trying to look past the end of the aggData
         }
 
-        //************************************************************//
-        // get a list of candidate spikes matching this PSG-out-edge  //
+        searchedEdges.push_back( psgEdge );
+        queries.push_back(
+                AggregateData::SpikeQuery(
+                        model.spikeSearch[psgEdge],
+                        begOfSearchWindow,
+                        endOfSearchWindow ) );
+    }
+
+    //************************************************************//
+    // get a list of candidate spikes matching each PSG-out-edge  //
+
+    // The spikes for searchedEdges[i] are foundSpikes[ endOfEdge[i-1] ] to foundSpikes[ endOfEdge[i]-1 ]
+    vector<AggregateData::FoundSpike> foundSpikes;
+    vector<size_t> endOfEdge;
+
+    if ( spikeTables.empty() ) {
+        vector< list<AggregateData::FoundSpike> > foundSpikesPerEdge;
+        aggData->findSpikes( queries, &foundSpikesPerEdge );
+        for (size_t edge_i=0; edge_i<searchedEdges.size(); edge_i++) {
+            foundSpikes.insert( foundSpikes.end(), foundSpikesPerEdge[edge_i].begin(), foundSpikesPerEdge[edge_i].end() );
+            endOfEdge.push_back( foundSpikes.size() );
+        }
+    } else {
+        for (size_t edge_i=0; edge_i<searchedEdges.size(); edge_i++) {
+            aggData->findSpikes( spikeTables[ searchedEdges[edge_i] ],
+                    queries[edge_i].startTime, queries[edge_i].endTime, &foundSpikes );
+            endOfEdge.push_back( foundSpikes.size() );
+        }
+    }
 
-        foundSpikes.clear();
-        foundSpikes = aggData->findSpike(
-                powerStateGraph[*psg_out_i].delta,  // spike stats
-                begOfSearchWindow,
-                endOfSearchWindow
-                );
+    // Work out the likelihoods of the spikes' times, one batch per edge
+    vector<double> durations( foundSpikes.size() );
+    vector<double> durationLikelihoods( foundSpikes.size() );
+    for (size_t s=0; s<foundSpikes.size(); s++) {
+        durations[s] = foundSpikes[s].timestamp - disagTree[disagVertex].timestamp;
+    }
+    for (size_t edge_i=0; edge_i<searchedEdges.size(); edge_i++) {
+        const size_t first = edge_i ? endOfEdge[edge_i-1] : 0;
+        if ( endOfEdge[edge_i] > first ) {
+            model.durationLikelihoods( searchedEdges[edge_i],
+                    &durations[first], endOfEdge[edge_i] - first, &durationLikelihoods[first] );
+        }
+    }
 
+    for (size_t edge_i=0; edge_i<searchedEdges.size(); edge_i++) {
 
-        //***************************************************************//
-        // for each candidate spike, create a new vertex in disagTree   //
-        // and recursively trace this to the end                         //
+        const size_t psgEdge = searchedEdges[edge_i];
 
-        for (list<AggregateData::FoundSpike>::const_iterator spike=foundSpikes.begin();
-                spike!=foundSpikes.end();
+        for (vector<AggregateData::FoundSpike>::const_iterator spike=foundSpikes.begin() + (edge_i ? endOfEdge[edge_i-1] : 0);
+                spike!=foundSpikes.begin() + endOfEdge[edge_i];
                 spike++) {
 
             // ensure that the absolute value of the aggregate data signal
             // does not drop below the minimum for our current power state
-            if (aggData->readingGoesBelowPowerState(
+            if (aggData->readingGoesBelow(
                     disagTree[disagVertex].timestamp,
                     spike->timestamp,
-                    powerStateGraph[ disagTree[disagVertex].psgVertex ].betweenSpikes ) ) {
+                    model.betweenSpikesMin[ psgVertex ] ) ) {
 
                 continue;
             }
 
-            double normalisedLikelihoodForTime = powerStateGraph[*psg_out_i].duration.normalisedLikelihood(
-                    spike->timestamp - disagTree[disagVertex].timestamp);
+            double normalisedLikelihoodForTime = durationLikelihoods[ spike - foundSpikes.begin() ];
 
             // merge probability for time and for spike delta
-            double avLikelihood = ( normalisedLikelihoodForTime + spike->likelihood ) / 2;
-
-            // create new vertex
-            DisagTree::vertex_descriptor newVertex=add_vertex( disagTree );
-
-            // create new edge
-            DisagTree::edge_descriptor newEdge;
-            bool existingEdge;
-            tie(newEdge, existingEdge) =
-                    add_edge( disagVertex, newVertex, avLikelihood, disagTree );
-
-            // add details to newVertex
-            disagTree[newVertex].timestamp = spike->timestamp;
-            // get vertex that *psg_out_i points to
-            disagTree[newVertex].psgVertex = target(*psg_out_i, powerStateGraph);
-            disagTree[newVertex].psgEdge   = *psg_out_i;
-            disagTree[newVertex].meanPower =
-                    powerStateGraph[disagTree[newVertex].psgVertex].betweenSpikes.mean;
-
-            if (EDGE_HISTORY_SIZE) {
-                disagTree[newVertex].edgeHistory = disagTree[disagVertex].edgeHistory;
-                disagTree[newVertex].edgeHistory.push_back(*psg_out_i);
-                if (disagTree[newVertex].edgeHistory.size() > EDGE_HISTORY_SIZE) {
-                    disagTree[newVertex].edgeHistory.erase( disagTree[newVertex].edgeHistory.begin() );
-                }
+            SpikeMatch match;
+            match.psgEdge    = psgEdge;
+            match.timestamp  = spike->timestamp;
+            match.likelihood = ( normalisedLikelihoodForTime + spike->likelihood ) / 2;
+            matches->push_back( match );
+        }
+    }
+}
+
+/**
+ * @return the state of the vertex which @c match would add downstream of @c disagVertex.
+ */
+const PowerStateGraph::DisagState PowerStateGraph::nextState(
+        const DisagTree& disagTree,
+        const DisagTree::vertex_descriptor& disagVertex,
+        const SpikeMatch& match
+        ) const
+{
+    DisagState state;
+    state.timestamp = match.timestamp;
+    state.psgVertex = model.target[match.psgEdge]; // get vertex that psgEdge points to
+
+    state.edgeHistory = disagTree[disagVertex].edgeHistory;
+    state.edgeHistory.push_back( // forgets the oldest edge if full
+            model.source[match.psgEdge], state.psgVertex );
+
+    return state;
+}
+
+/**
+ * @brief Add a vertex for @c match to @c disagTree, downstream of @c disagVertex.
+ *
+ * @return the new vertex.
+ */
+const PowerStateGraph::DisagTree::vertex_descriptor PowerStateGraph::addDisagVertex(
+        DisagTree * disagTree_p, /**< input and output parameter */
+        const DisagTree::vertex_descriptor& disagVertex,
+        const SpikeMatch& match,
+        const DisagState& state /**< from nextState() */
+        ) const
+{
+    DisagTree& disagTree = *disagTree_p;
+
+    // create new vertex
+    DisagTree::vertex_descriptor newVertex=disagTree.addVertex();
+
+    // create new edge
+    disagTree.addEdge( disagVertex, newVertex, match.likelihood );
+
+    // add details to newVertex
+    disagTree[newVertex].timestamp   = state.timestamp;
+    disagTree[newVertex].psgVertex   = state.psgVertex;
+    disagTree[newVertex].psgEdge     = match.psgEdge;
+    disagTree[newVertex].edgeHistory = state.edgeHistory;
+    disagTree[newVertex].meanPower   = model.betweenSpikesMean[ state.psgVertex ];
+
+    return newVertex;
+}
+
+/**
+ * @brief A possible next step for one of the partial paths in traceBeam().
+ */
+struct PowerStateGraph::BeamStep {
+    size_t parent;          /**< index into the beam */
+    size_t order;           /**< position in the order the exhaustive search would visit steps */
+    SpikeMatch match;
+    double avLikelihood;    /**< running average likelihood of the path including this step */
+
+    static bool isMoreLikely(const BeamStep& a, const BeamStep& b)
+    {
+        return a.avLikelihood > b.avLikelihood;
+    }
+
+    static bool isEarlier(const BeamStep& a, const BeamStep& b)
+    {
+        return a.order < b.order;
+    }
+};
+
+/**
+ * @brief Beam-search alternative to traceToEnd().
+ *
+ * The tree is grown one depth at a time.  At each depth, every step
+ * which could extend the partial paths in the beam is found, steps with
+ * a likelihood below @c beamMinLikelihood are dropped and only the
+ * @c beamWidth steps with the highest running average likelihood are
+ * added to the tree.  Steps which reach the off state complete a path;
+ * the rest form the beam for the next depth.  The width of the tree is
+ * therefore bounded by @c beamWidth however noisy the aggregate data is.
+ */
+void PowerStateGraph::traceBeam(
+        DisagTree * disagTree_p, /**< input and output parameter */
+        const DisagTree::vertex_descriptor& firstVertex,
+        const double firstLikelihood, /**< likelihood of the edge into firstVertex */
+        TraceScratch * scratch,
+        const bool verbose
+        ) const
+{
+    DisagTree& disagTree = *disagTree_p;
+
+    // The partial paths.  findBestPath() counts the first edge twice
+    // so do the same here.
+    vector<DisagTree::vertex_descriptor> beam( 1, firstVertex );
+    vector<double> likelihoodSums( 1, firstLikelihood * 2 );
+    vector<size_t> pathLengths( 1, 2 );
+
+    vector<SpikeMatch> matches;
+    vector<BeamStep> steps;
+
+    while ( ! beam.empty() ) {
+
+        // find every step out of the beam
+        steps.clear();
+        for (size_t b=0; b<beam.size(); b++) {
+            matches.clear();
+            cachedNextSpikes( disagTree, beam[b], scratch, &matches );
+            for (size_t i=0; i<matches.size(); i++) {
+                if ( matches[i].likelihood < beamMinLikelihood )
+                    continue;
+
+                BeamStep step;
+                step.parent = b;
+                step.order = steps.size();
+                step.match = matches[i];
+                step.avLikelihood = ( likelihoodSums[b] + matches[i].likelihood ) / ( pathLengths[b] + 1 );
+                steps.push_back( step );
             }
+        }
 
-            // recursively trace to end.
-            traceToEnd(disagTree_p, newVertex, disagTree[disagVertex].timestamp);
+        // keep the most likely steps.  A stable sort keeps ties in
+        // the order in which the exhaustive search would visit them.
+        stable_sort( steps.begin(), steps.end(), BeamStep::isMoreLikely );
+        if ( steps.size() > beamWidth )
+            steps.resize( beamWidth );
+
+        if (verbose) cout << "beam: " << beam.size() << " paths, keeping " << steps.size() << " steps" << endl;
+
+        // Add the steps to the tree in the order in which the exhaustive
+        // search would add them, so that ties between complete paths are
+        // resolved the same way.
+        sort( steps.begin(), steps.end(), BeamStep::isEarlier );
+
+        vector<DisagTree::vertex_descriptor> nextBeam;
+        vector<double> nextLikelihoodSums;
+        vector<size_t> nextPathLengths;
+        for (size_t i=0; i<steps.size(); i++) {
+            const DisagTree::vertex_descriptor& parent = beam[ steps[i].parent ];
+            DisagTree::vertex_descriptor newVertex = addDisagVertex(
+                    disagTree_p, parent, steps[i].match, nextState( disagTree, parent, steps[i].match ) );
+
+            if ( disagTree[newVertex].psgVertex == offVertex )
+                continue; // this path is complete
+
+            nextBeam.push_back( newVertex );
+            nextLikelihoodSums.push_back( likelihoodSums[ steps[i].parent ] + steps[i].match.likelihood );
+            nextPathLengths.push_back( pathLengths[ steps[i].parent ] + 1 );
         }
+
+        beam.swap( nextBeam );
+        likelihoodSums.swap( nextLikelihoodSums );
+        pathLengths.swap( nextPathLengths );
     }
 }
 
 /**
- * @brief Iterates through each path in @c listOfPaths
- *        to find the one with the highest likelihood.
+ * @brief Find the path from @c rootVertex to an off state with the
+ *        highest average likelihood.
  *
- * To be called after @c listOfPaths has been populated by findListOfPathsThroughDisagTree().
+ * The paths are not enumerated.  Instead, Dinkelbach's method finds the
+ * best average: for a given lambda, findMaxExcess() finds the path
+ * maximising sum(likelihood - lambda) in one bottom-up pass; lambda is
+ * then set to that path's average and the pass repeated until no path
+ * beats lambda.  Only the paths whose average could equal lambda are
+ * then followed to pick the winner.  Memory use is linear in the size
+ * of the tree rather than exponential in its depth.
  *
  * @return details of the best path.  Confidence is set to -1 if no paths are available.
  */
 const PowerStateGraph::Fingerprint PowerStateGraph::findBestPath(
         const DisagTree& disagTree,
+        BestPathSearch * search_p, /**< re-used between candidates to save allocations */
+        const DisagTree::vertex_descriptor rootVertex,
+        const LikelihoodAndVertex& firstLAV, /**< the first item of every path */
         const size_t deviceStart,
         const bool verbose
-        )
+        ) const
 {
     Fingerprint fingerprint;
     fingerprint.timestamp = deviceStart;
 
-    // first check that listOfPaths is populated
-    if ( listOfPaths.empty() ) {
-        fingerprint.avLikelihood = -1; // return error code
-        return fingerprint;
-    }
+    BestPathSearch& search = *search_p;
+    search.reset( disagTree, verbose );
 
-    fingerprint.avLikelihood = 0;
+    while (true) {
+        search.excessFound.assign( search.excessFound.size(), false );
+        findMaxExcess( &search, rootVertex );
 
-    list< list<LikelihoodAndVertex> >::const_iterator path_i, bestPath_i;
-    list< LikelihoodAndVertex >::const_iterator lav_i;
+        // first check that at least one path reaches an off state
+        if ( search.maxExcess[ rootVertex ] == -numeric_limits<double>::infinity() ) {
+            fingerprint.avLikelihood = -1; // return error code
+            return fingerprint;
+        }
 
-    if (verbose) cout << "path dump:" << endl;
+        // average likelihood of the path with the largest excess
+        double likelihoodAccumulator = firstLAV.likelihood;
+        size_t length = 1;
+        for (DisagTree::vertex_descriptor v = rootVertex;
+                ! search.isEndOfPath( v );
+                v = disagTree.target( search.bestEdge[v] )) {
+            likelihoodAccumulator += disagTree.likelihood( search.bestEdge[v] );
+            length++;
+        }
 
-    double likelihoodAccumulator, avLikelihood;
-    bool foundGoodPath = false;
+        const double avLikelihood = likelihoodAccumulator / length;
+        if ( avLikelihood <= search.lambda )
+            break; // no path beats lambda so lambda is the best average
 
-    // iterate through each path to find the one with the highest likelihood
-    for (path_i=listOfPaths.begin(); path_i!=listOfPaths.end(); path_i++) {
+        search.lambda = avLikelihood;
+    }
 
-        likelihoodAccumulator = 0;
-        for ( lav_i=path_i->begin(); lav_i!=path_i->end(); lav_i++ ) {
-            if (verbose) cout << "vertex=" << lav_i->vertex << " conf=" << lav_i->likelihood << ", ";
-            likelihoodAccumulator += lav_i->likelihood;
-        }
+    if (verbose) cout << "path dump:" << endl;
 
-        avLikelihood = likelihoodAccumulator / path_i->size();
+    findBestPathsThroughDisagTree(
+            &search,
+            rootVertex,
+            firstLAV,
+            firstLAV.likelihood - search.lambda );
 
-        // if this is the most confident path we've seen yet then record its details.
-        if ( avLikelihood >= fingerprint.avLikelihood ) {
-            fingerprint.avLikelihood = avLikelihood;
-            bestPath_i = path_i;
-            foundGoodPath = true;
-        }
+    fingerprint.avLikelihood = search.bestAvLikelihood;
 
-        if (verbose) cout << endl << endl;
-    }
+    vector< LikelihoodAndVertex >::const_iterator lav_i;
+    const vector< LikelihoodAndVertex >& bestPath = search.bestPath;
+    const bool foundGoodPath = search.foundGoodPath;
 
-    // now get energy usage and duration from bestPath_i
+    // now get energy usage and duration from bestPath
     size_t prevTimestamp, duration;
     double prevMeanPower = 0;
 
@@ -1113,10 +2226,10 @@ const PowerStateGraph::Fingerprint PowerStateGraph::findBestPath(
     prevTimestamp = deviceStart;
     size_t count = 0;
     if (foundGoodPath) {
-        for (lav_i=bestPath_i->begin(); lav_i != bestPath_i->end(); lav_i++) {
+        for (lav_i=bestPath.begin(); lav_i != bestPath.end(); lav_i++) {
 
             // Add to timeAndPower list for read-out later when we plot the power states
-            if ( lav_i != bestPath_i->begin() ) {
+            if ( lav_i != bestPath.begin() ) {
                 fingerprint.timeAndPower.push_back( TimeAndPower(
                         disagTree[ lav_i->vertex ].timestamp-1 ,
                         (count==1 ? 0 : prevMeanPower)
@@ -1146,25 +2259,40 @@ const PowerStateGraph::Fingerprint PowerStateGraph::findBestPath(
     return fingerprint;
 }
 
+/**
+ * @brief findBestPath() with a BestPathSearch of its own.
+ */
+const PowerStateGraph::Fingerprint PowerStateGraph::findBestPath(
+        const DisagTree& disagTree,
+        const DisagTree::vertex_descriptor rootVertex,
+        const LikelihoodAndVertex& firstLAV,
+        const size_t deviceStart
+        ) const
+{
+    BestPathSearch search;
+    return findBestPath( disagTree, &search, rootVertex, firstLAV, deviceStart );
+}
+
 /**
  * @brief Trace the disagTree backwards.
  */
-list< PowerStateGraph::PSGraph::edge_descriptor > PowerStateGraph::getEdgeHistoryForVertex(
+const PowerStateGraph::EdgeHistory PowerStateGraph::getEdgeHistoryForVertex(
         const DisagTree& disagTree,
         const DisagTree::vertex_descriptor& startVertex
         ) const
 {
-    list< PSGraph::edge_descriptor > eHistory;
+    vector<size_t> edges; // newest first
     DisagTree::vertex_descriptor disagVertex = startVertex;
 
-    DisagTree::in_edge_iterator in_e_i, in_e_end;
-
-    while (disagTree[disagVertex].psgVertex != offVertex && eHistory.size() < EDGE_HISTORY_SIZE) {
-        eHistory.push_front( disagTree[disagVertex].psgEdge );
-        tie(in_e_i, in_e_end) = in_edges(disagVertex, disagTree);
-        disagVertex = source( *in_e_i, disagTree ); // the vertex upstream from in_e_i
+    while (disagTree[disagVertex].psgVertex != offVertex && edges.size() < EDGE_HISTORY_SIZE) {
+        edges.push_back( disagTree[disagVertex].psgEdge );
+        disagVertex = disagTree.parent( disagVertex ); // the vertex upstream from disagVertex
     }
 
+    EdgeHistory eHistory;
+    for (size_t i=edges.size(); i-->0; ) {
+        eHistory.push_back( model.source[ edges[i] ], model.target[ edges[i] ] );
+    }
     return eHistory;
 }
 
@@ -1173,6 +2301,106 @@ void PowerStateGraph::setDeviceName(const string& _deviceName)
     deviceName = _deviceName;
 }
 
+/**
+ * @brief Set the number of threads used to trace candidates during
+ *        disaggregation.  0 means one per hardware thread.
+ */
+void PowerStateGraph::setNumThreads(const size_t n)
+{
+    numThreads = n ? n : Parallel::numThreads();
+}
+
+/**
+ * @brief Set the maximum number of entries in each thread's cache of
+ *        the spikes which can follow each DisagState.  0 disables it.
+ */
+void PowerStateGraph::setExpansionCacheSize(const size_t n)
+{
+    expansionCacheSize = n;
+}
+
+/**
+ * @brief Use a beam search (see traceBeam()) instead of the exhaustive
+ *        search when tracing candidates.
+ */
+void PowerStateGraph::setBeamSearch(
+        const size_t width,        /**< maximum number of partial paths kept at each
+                                        depth.  0 means use the exhaustive search. */
+        const double minLikelihood /**< steps less likely than this are dropped */
+        )
+{
+    beamWidth = width;
+    beamMinLikelihood = minLikelihood;
+}
+
+/**
+ * @brief Set how many candidate fingerprints may overlap at any time
+ *        once removeOverlapping() has run, e.g. for a household with
+ *        more than one of the device.
+ */
+void PowerStateGraph::setMaxOverlap(const size_t n)
+{
+    if (n == 0) {
+        Utils::fatalError( "The maximum overlap must be at least 1." );
+    }
+    maxOverlap = n;
+}
+
+/**
+ * @brief Prune the exhaustive search in traceToEnd().
+ *        Each limit is disabled by setting it to 0.  The beam search
+ *        (see setBeamSearch()) is not pruned.
+ *
+ * All three limits are heuristics and may prune the path which would
+ * have won.  In particular @c remainingEdges is not an admissible bound:
+ * a path which runs for more than that many further edges can still
+ * raise its average likelihood towards 1 and overtake the best path.
+ *
+ * Limits which leave a candidate without any path to off are too tight
+ * to trust; disaggregate() warns when that happens.
+ */
+void PowerStateGraph::setPruning(
+        const double energyFactor,   /**< prune a branch once it has used more than this multiple of
+                                          the largest energy consumption seen in training */
+        const double durationFactor, /**< prune a branch once it has run for longer than this
+                                          multiple of the longest training signature */
+        const size_t remainingEdges  /**< prune a branch if, were it to end within this many more
+                                          edges, it couldn't beat the best path found so far */
+        )
+{
+    if (energyFactor < 0 || durationFactor < 0) {
+        Utils::fatalError( "Pruning factors must not be negative." );
+    }
+    pruneEnergyFactor = energyFactor;
+    pruneDurationFactor = durationFactor;
+    pruneRemainingEdges = remainingEdges;
+}
+
+/**
+ * @brief Choose findSpike()'s search limits for each edge from the
+ *        quantiles of the spike deltas seen in training rather than
+ *        from their min and max plus a fraction of their mean (see
+ *        AggregateData::SpikeSearch).  Takes effect at the next compile().
+ */
+void PowerStateGraph::setSpikeQuantile(
+        const double q /**< search around the [q, 1-q] quantile range.  0 disables this. */
+        )
+{
+    if (q < 0 || q >= 0.5) {
+        Utils::fatalError( "The spike quantile must be at least 0 and less than 0.5." );
+    }
+    spikeQuantile = q;
+}
+
+/**
+ * @return the compiled search for spikes which match the first edge out
+ *         of the off vertex, i.e. for possible start spikes.
+ */
+const AggregateData::SpikeSearch& PowerStateGraph::startSpikeSearch() const
+{
+    return model.spikeSearch[ model.firstOutEdge[ offVertex ] ];
+}
+
 std::ostream& operator<<( std::ostream& o, const PowerStateGraph& psg )
 {
     PowerStateGraph::PSG_vertex_index_map index = boost::get(boost::vertex_index, psg.powerStateGraph);
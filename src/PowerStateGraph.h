@@ -17,6 +17,11 @@
 #include "Common.h"    // for Sample_t
 #include "Signature.h"
 #include "AggregateData.h"
+#include "AggregateDataset.h"
+#include "ArenaTree.h"
+#include "PackedEdgeHistory.h"
+
+class OnlineDisaggregator;
 
 /**
  * @brief This class does most of the work behind the "graphs and spikes" disaggregation approach.
@@ -67,6 +72,11 @@ public:
               << " equivalent to " << ddi.energy / J_PER_KWH << " kWh";
             return o;
         }
+
+        const static bool startsBefore( const Fingerprint& first, const Fingerprint& second )
+        {
+            return first.timestamp < second.timestamp;
+        }
     };
 
     const std::list<Fingerprint> disaggregate(
@@ -75,17 +85,70 @@ public:
             const bool verbose = false
             );
 
+    const std::list<Fingerprint> disaggregate(
+            AggregateDataset * aggregateDataset,
+            const bool keep_overlapping = false,
+            const bool verbose = false
+            );
+
+    const std::list<Fingerprint> disaggregateStream(
+            AggregateData * aggregateData,
+            const bool keep_overlapping = false,
+            const bool verbose = false
+            );
+
+    const std::list<Fingerprint> disaggregateOnline(
+            AggregateData * aggregateData,
+            const bool keep_overlapping = false,
+            const bool verbose = false
+            );
+
+    const size_t streamingWindowDuration() const;
+
     void setDeviceName(const std::string& _deviceName);
 
+    void setNumThreads(const size_t n);
+
+    void setBeamSearch(
+            const size_t width,
+            const double minLikelihood = 0
+            );
+
+    void setExpansionCacheSize(const size_t n);
+
+    void setMaxOverlap(const size_t n);
+
+    void setPruning(
+            const double energyFactor,
+            const double durationFactor,
+            const size_t remainingEdges
+            );
+
+    void setSpikeQuantile(const double q);
+
+    void compile();
+
     const Statistic< double >& getEnergyConsumption() const;
 
     friend std::ostream& operator<<( std::ostream& o, const PowerStateGraph& psg );
 
+    friend class OnlineDisaggregator;
+    friend struct compiledModelMatchesGraph; // in PowerStateGraphTest
+
 private:
     /***********************************
      * P.S.G. GRAPH USED FOR TRAINING: *
      * (PSG = Power State Graph)       *
      ***********************************/
+    static const size_t EDGE_HISTORY_SIZE = 5; /**< @brief Set to 0 to disable. */
+
+    /**
+     * @brief The last EDGE_HISTORY_SIZE (or fewer) PSG edges on a path.
+     *        Edges are stored as their source and target vertex indices,
+     *        which is all that edgeListsAreEqual() looks at.
+     */
+    typedef PackedEdgeHistory< EDGE_HISTORY_SIZE > EdgeHistory;
+
     struct PowerStateEdge; // forward declared to fix interdependency introduced by edgeHistory
 
     struct PowerStateVertex {
@@ -114,19 +177,29 @@ private:
             PowerStateEdge    // our custom edge type
             > PSGraph;
 
+    /**
+     * @brief Spike deltas also keep a QuantileSketch so that the limits
+     *        findSpike() searches within can come from learned quantiles
+     *        (see setSpikeQuantile()).
+     *
+     * An edge sees far fewer than k=128 deltas in training, so its sketch
+     * simply holds them: a few bytes per delta on top of the moments.
+     */
+    typedef Statistic< double, SketchedMoments<double> > DeltaStatistic;
+
     struct PowerStateEdge {
-        Statistic<double> delta;
+        DeltaStatistic delta;
         Statistic<size_t> duration;
         size_t count; /**< @brief The number of times this edge has been
                                   traversed during training.  Used with @c totalCount
                                   to determine which edges are traversed most often.
                                   @deprecated we're not using this. */
-        std::list< PSGraph::edge_descriptor > edgeHistory; /**< @brief a "rolling" list storing
-                                                                the previous few edges we've seen.
-                                                                This serves exactly the same purpose
-                                                                as @c getEdgeHistoryForVertex(). @todo
-                                                                benchmark the 2 approaches and delete
-                                                                the slowest.  */
+        EdgeHistory edgeHistory; /**< @brief a "rolling" list storing
+                                      the previous few edges we've seen.
+                                      This serves exactly the same purpose
+                                      as @c getEdgeHistoryForVertex(). @todo
+                                      benchmark the 2 approaches and delete
+                                      the slowest.  */
     };
 
 
@@ -135,7 +208,6 @@ private:
     typedef boost::graph_traits<PSGraph>::out_edge_iterator PSG_out_edge_iter;
 
     typedef boost::property_map<PSGraph, boost::vertex_index_t>::type PSG_vertex_index_map;
-    typedef boost::property_map<PSGraph, boost::edge_index_t >::type PSG_edge_index_map;
 
     struct PSG_vertex_writer {
 
@@ -171,10 +243,8 @@ private:
                         << " durMin=" << g[e].duration.min << " \\n"
                         << " durMax=" << g[e].duration.max << " \\n" ;
 
-                    for (std::list< PSGraph::edge_descriptor >::const_iterator
-                            edge=g[e].edgeHistory.begin();
-                            edge != g[e].edgeHistory.end(); edge++) {
-                        out << " \\n" << *edge;
+                    for (size_t i=0; i<g[e].edgeHistory.size(); i++) {
+                        out << " \\n(" << g[e].edgeHistory.source(i) << "," << g[e].edgeHistory.target(i) << ")";
                     }
 
                     out << "\"]";
@@ -188,6 +258,46 @@ private:
      * GRAPH USED FOR DISAGGREGATION: *
      **********************************/
 
+    /**
+     * @brief A read-only copy of the trained powerStateGraph holding only
+     *        what disaggregation needs.  Made by compile().
+     *
+     * Out-edges are stored in compressed sparse row form: the out-edges
+     * of vertex v are edges firstOutEdge[v] to firstOutEdge[v+1]-1, in
+     * the order that out_edges() returns them.  Each property has its
+     * own contiguous array, indexed by vertex or by edge.
+     */
+    struct CompiledModel {
+        // Vertices
+        std::vector<size_t> firstOutEdge;      /**< @brief one entry per vertex, plus one */
+        std::vector<double> betweenSpikesMean;
+        std::vector<Sample_t> betweenSpikesMin;
+
+        // Edges
+        std::vector<PSGraph::vertex_descriptor> source;
+        std::vector<PSGraph::vertex_descriptor> target;
+        std::vector<double> durationMean;
+        std::vector<size_t> durationMin, durationMax;
+        std::vector<size_t> durationSlack;     /**< @brief duration.nonZeroStdev(), used to widen search windows */
+        std::vector<double> durationNonZeroStdev; /**< @brief for durationLikelihoods() */
+        std::vector<EdgeHistory> edgeHistory;  /**< @brief includes a precomputed hash */
+        std::vector<AggregateData::SpikeSearch> spikeSearch; /**< @brief built from the delta stats */
+
+        /**
+         * @brief Statistic::normalisedLikelihood() of each of the @c n
+         *        @c durations for edge @c e, in one batch.
+         */
+        void durationLikelihoods(
+                const size_t e,
+                const double * durations,
+                const size_t n,
+                double * likelihoods
+                ) const
+        {
+            Likelihood::normalisedGaussian( durations, n, durationMean[e], durationNonZeroStdev[e], likelihoods );
+        }
+    };
+
     /**
      * @brief A vertex for the directed acylic graphs used by getStartTimes()
      */
@@ -195,20 +305,21 @@ private:
         size_t timestamp; /**< @brief UNIX timestamp taken from AggregateData. */
         double meanPower; /**< @brief Mean power used between this and the previous vertex. */
         PSGraph::vertex_descriptor psgVertex; /**< @brief link to vertex in Power State Graph. */
-        PSGraph::edge_descriptor psgEdge; /**< @brief the PSG edge which got us to where we are. */
-        std::list< PSGraph::edge_descriptor > edgeHistory; /**< @brief a "rolling" list storing
-                                                                the previous few edges we've seen. */
+        size_t psgEdge; /**< @brief the PSG edge which got us to where we are
+                             (an edge index in the CompiledModel). */
+        EdgeHistory edgeHistory; /**< @brief a "rolling" list storing
+                                      the previous few edges we've seen. */
 
 
         DisagVertex()
-        : timestamp(0), meanPower(0), psgVertex(0)
+        : timestamp(0), meanPower(0), psgVertex(0), psgEdge(0)
         {}
 
         DisagVertex(
                 const size_t _timestamp,
                 const double _meanPower,
                 const PSGraph::vertex_descriptor _psgVertex,
-                const PSGraph::edge_descriptor _psgEdge
+                const size_t _psgEdge
                 )
         : timestamp(_timestamp), meanPower(_meanPower), psgVertex(_psgVertex), psgEdge(_psgEdge)
         {}
@@ -217,54 +328,49 @@ private:
 
     /**
      * @brief Tree structure used to keep track of all the
-     * possible solutions during disaggregation.
+     * possible solutions during disaggregation.  Edges store likelihoods.
+     *
+     * Strictly it's a DAG: vertices with the same DisagState are
+     * shared rather than expanded twice (see traceToEnd()).
      *
-     * Implemented using the Boost Graph Library.
+     * Each thread builds its DisagTrees in the same ArenaTree, which is
+     * cleared rather than freed between candidates.
      */
-    typedef boost::adjacency_list<
-            boost::setS, boost::vecS, boost::bidirectionalS,
-            DisagVertex,   // our custom vertex (node) type
-            double         // our custom edge type (for storing likelihood)
-            > DisagTree;
-
-    typedef boost::graph_traits<DisagTree>::out_edge_iterator Disag_out_edge_iter;
-    typedef boost::graph_traits<DisagTree>::edge_descriptor Disag_edge_desc;
+    typedef ArenaTree<DisagVertex> DisagTree;
 
     /**
-     * @brief used for write_graphviz for DisagGraph.
+     * @brief used for DisagTree::writeGraphViz().
      */
     struct Disag_vertex_writer {
 
-            Disag_vertex_writer(DisagTree& g_) : g (g_) {};
+            Disag_vertex_writer(const DisagTree& g_) : g (g_) {};
 
-            template <class Vertex>
-            void operator()(std::ostream& out, Vertex e) {
+            void operator()(std::ostream& out, DisagTree::vertex_descriptor v) const {
                     out << " [label=\""
-                        << "$t = " << g[e].timestamp << "$, "
-                        << "$p = " << g[e].meanPower << "$ "
+                        << "$t = " << g[v].timestamp << "$, "
+                        << "$p = " << g[v].meanPower << "$ "
                         << "\"]";
             };
 
-            DisagTree g;
+            const DisagTree& g;
     };
 
     /**
-     * @brief used for write_graphviz for DisagGraph.
+     * @brief used for DisagTree::writeGraphViz().
      */
     struct Disag_edge_writer {
 
-            Disag_edge_writer(DisagTree& g_) : g (g_) {};
+            Disag_edge_writer(const DisagTree& g_) : g (g_) {};
 
-            template <class Edge>
-            void operator()(std::ostream& out, Edge e) {
+            void operator()(std::ostream& out, DisagTree::edge_descriptor e) const {
                 out.precision(0);
                 out.setf( std::ios::fixed );
                 out << " [label=\""
-                        <<  g[e]*100
+                        <<  g.likelihood(e)*100
                         << "\\%\", lblstyle=\"fill=black!10,inner sep=1pt,align=center,anchor=west\"]";
             };
 
-            DisagTree g;
+            const DisagTree& g;
     };
 
 
@@ -276,6 +382,13 @@ private:
 
     PSGraph powerStateGraph; /**< @brief store the power state graph learnt during training. */
 
+    CompiledModel model; /**< @brief powerStateGraph as used during disaggregation. See compile(). */
+
+    std::vector<AggregateData::SpikeTable> spikeTables; /**< @brief every spike in aggData which matches
+                                                             each edge of @c model, or empty if the
+                                                             spikes haven't been tabulated.
+                                                             See tabulateSpikes(). */
+
     PSGraph::vertex_descriptor offVertex; /**< @todo we probably don't need this as the offVertex will probably always been vertex index 0. */
 
     size_t totalCount; /**< @brief the total number of times any edge
@@ -284,9 +397,13 @@ private:
 
     AggregateData const * aggData;
 
-    static const size_t EDGE_HISTORY_SIZE = 5; /**< @brief Set to 0 to disable. */
-    std::list< PSGraph::edge_descriptor > edgeHistory; /**< @brief a "rolling" list storing
-                                                            the previous few edges we've seen. */
+    AggregateDataset * aggDataset; /**< @brief if aggData is a window onto a multi-file
+                                        dataset then this is the dataset, else 0. */
+
+    static const size_t WINDOW_FRAME = 8; /**< @brief number of seconds to widen
+                                               traceToEnd()'s search window by. */
+    EdgeHistory edgeHistory; /**< @brief a "rolling" list storing
+                              the previous few edges we've seen. */
 
     struct LikelihoodAndVertex {
         double likelihood;
@@ -301,11 +418,96 @@ private:
         {}
     };
 
-    std::list< std::list<LikelihoodAndVertex> > listOfPaths;
+    struct BestPathSearch; // defined in PowerStateGraph.cpp
+
+    size_t numThreads; /**< @brief number of threads which traceCandidates() fans out to. */
+
+    size_t beamWidth;         /**< @brief 0 for the exhaustive search, else see traceBeam() */
+    double beamMinLikelihood; /**< @brief see traceBeam() */
+
+    size_t maxOverlap; /**< @brief see removeOverlapping() */
+
+    double pruneEnergyFactor;   /**< @brief see setPruning().  0 disables the energy limit. */
+    double pruneDurationFactor; /**< @brief see setPruning().  0 disables the duration limit. */
+    size_t pruneRemainingEdges; /**< @brief see setPruning().  0 disables the (heuristic)
+                                     remaining-edges likelihood limit. */
+
+    double spikeQuantile; /**< @brief see setSpikeQuantile().  0 uses the delta's min and max. */
+
+    struct TraceJob; // defined in PowerStateGraph.cpp
+
+    /**
+     * @brief A spike which could follow a DisagTree vertex.
+     */
+    struct SpikeMatch {
+        size_t psgEdge; /**< the PSG edge the spike matches (an edge index in @c model) */
+        size_t timestamp;
+        double likelihood; /**< likelihood of both the spike delta and the time since the last spike */
+    };
+
+    struct BeamStep; // defined in PowerStateGraph.cpp
+
+    /**
+     * @brief Everything which determines how a DisagTree vertex is
+     *        expanded by traceToEnd().  Vertices with equal states
+     *        have identical subtrees.
+     */
+    struct DisagState {
+        size_t timestamp;
+        PSGraph::vertex_descriptor psgVertex;
+        EdgeHistory edgeHistory;
+
+        bool operator<(const DisagState& other) const
+        {
+            if (timestamp != other.timestamp)
+                return timestamp < other.timestamp;
+            if (psgVertex != other.psgVertex)
+                return psgVertex < other.psgVertex;
+            return edgeHistory < other.edgeHistory;
+        }
+
+        bool operator==(const DisagState& other) const
+        {
+            return timestamp == other.timestamp &&
+                   psgVertex == other.psgVertex &&
+                   edgeHistory == other.edgeHistory;
+        }
+    };
+
+    /**
+     * @brief What traceToEnd() knows about the path from the root of the
+     *        DisagTree down to a vertex.  Used to prune branches.
+     */
+    struct PathSoFar {
+        double energy;        /**< energy used before the vertex, as findBestPath() adds it up */
+        double likelihoodSum; /**< sum of the likelihoods findBestPath() would average */
+        size_t length;        /**< number of likelihoods in @c likelihoodSum */
+    };
+
+    struct TraceScratch; // defined in PowerStateGraph.cpp
+
+    size_t expansionCacheSize; /**< @brief maximum number of entries in each thread's
+                                    cache of findNextSpikes() results */
+
+    size_t expansionCacheHits;      /**< @brief counted since the last finishDisaggregation() */
+    size_t expansionCacheMisses;    /**< @brief counted since the last finishDisaggregation() */
+    size_t expansionCacheEvictions; /**< @brief counted since the last finishDisaggregation() */
+    size_t sharedDisagVertices;     /**< @brief counted since the last finishDisaggregation() */
+    size_t disagTreeVertices;       /**< @brief counted since the last finishDisaggregation() */
+    size_t disagTreeArenaGrowths;   /**< @brief times the DisagTree arenas and TraceScratch arrays
+                                         grew since the last finishDisaggregation().  Other heap
+                                         allocations, e.g. by findNextSpikes(), aren't counted. */
+    size_t prunedByEnergy;          /**< @brief branches pruned by traceToEnd() since the last finishDisaggregation() */
+    size_t prunedByDuration;        /**< @brief branches pruned by traceToEnd() since the last finishDisaggregation() */
+    size_t prunedByLikelihood;      /**< @brief branches pruned by traceToEnd() since the last finishDisaggregation() */
+    size_t prunedCandidates;        /**< @brief candidates left without a path to off by pruning
+                                         since the last finishDisaggregation() */
 
     Statistic< double > energyConsumption; /**< @brief Energy consumption in Joules
                                                 obtained from training signatures */
 
+    Statistic< double > runDuration; /**< @brief Duration in seconds of the training signatures */
+
     std::string deviceName; /**< @brief All PowerStateGraphs are associated with a single device.  */
 
     /****************************
@@ -350,16 +552,111 @@ private:
 
     void updateEdges( const Signature& sig );
 
+    const AggregateData::SpikeSearch& startSpikeSearch() const;
+
+    void traceCandidates(
+            const std::list<AggregateData::FoundSpike>& posStartSpikes,
+            const PowerStateEdge& firstEdgeStats,
+            std::list<Fingerprint> * fingerprintList,
+            const bool verbose = false
+            );
+
+    void finishDisaggregation(
+            std::list<Fingerprint> * fingerprintList,
+            const bool keep_overlapping,
+            const std::string& aggDataFilename
+            );
+
+    void tabulateSpikes();
+
+    static void tabulateSpikesThread(
+            const size_t thread,
+            const size_t numThreads,
+            PowerStateGraph * psg
+            );
+
+    static void traceCandidatesThread(
+            const size_t thread,
+            const PowerStateGraph * psg,
+            TraceJob * job
+            );
+
+    const LikelihoodAndVertex startDisagTree(
+            DisagTree * disagTree,
+            const AggregateData::FoundSpike& spike,
+            const size_t deviceStart
+            ) const;
+
     const Fingerprint initTraceToEnd(
             const AggregateData::FoundSpike& spike,
             const size_t deviceStart,
+            TraceScratch * scratch,
             const bool verbose = false // set true to see graphviz output of trees
-            );
+            ) const;
 
-    void traceToEnd(
+    const bool traceToEnd(
             DisagTree * disagTree,
             const DisagTree::vertex_descriptor& vertex,
             const size_t prevTimestamp,
+            const PathSoFar& pathSoFar,
+            TraceScratch * scratch,
+            const bool verbose = false
+            ) const;
+
+    const bool pruneBranch(
+            const DisagTree& disagTree,
+            const DisagState& state,
+            const PathSoFar& pathSoFar,
+            TraceScratch * scratch,
+            bool * pathDependent
+            ) const;
+
+    const bool searchWindow(
+            const DisagTree& disagTree,
+            const DisagTree::vertex_descriptor& disagVertex,
+            const size_t psgEdge,
+            size_t * begOfSearchWindow,
+            size_t * endOfSearchWindow,
+            const bool verbose = false
+            ) const;
+
+    const size_t searchHorizon(
+            const DisagTree& disagTree,
+            const DisagTree::vertex_descriptor& disagVertex
+            ) const;
+
+    void findNextSpikes(
+            const DisagTree& disagTree,
+            const DisagTree::vertex_descriptor& disagVertex,
+            std::vector<SpikeMatch> * matches,
+            const bool verbose = false
+            ) const;
+
+    void cachedNextSpikes(
+            const DisagTree& disagTree,
+            const DisagTree::vertex_descriptor& disagVertex,
+            TraceScratch * scratch,
+            std::vector<SpikeMatch> * matches
+            ) const;
+
+    const DisagState nextState(
+            const DisagTree& disagTree,
+            const DisagTree::vertex_descriptor& disagVertex,
+            const SpikeMatch& match
+            ) const;
+
+    const DisagTree::vertex_descriptor addDisagVertex(
+            DisagTree * disagTree,
+            const DisagTree::vertex_descriptor& disagVertex,
+            const SpikeMatch& match,
+            const DisagState& state
+            ) const;
+
+    void traceBeam(
+            DisagTree * disagTree,
+            const DisagTree::vertex_descriptor& firstVertex,
+            const double firstLikelihood,
+            TraceScratch * scratch,
             const bool verbose = false
             ) const;
 
@@ -368,28 +665,43 @@ private:
             );
 
     const bool edgeListsAreEqual(
-            const std::list< PSGraph::edge_descriptor >& a,
-            const std::list< PSGraph::edge_descriptor >& b,
+            const EdgeHistory& a,
+            const EdgeHistory& b,
             const bool verbose = false
             ) const;
 
-    std::list< PSGraph::edge_descriptor > getEdgeHistoryForVertex(
+    const EdgeHistory getEdgeHistoryForVertex(
             const DisagTree& disagTree,
             const DisagTree::vertex_descriptor& startVertex
             ) const;
 
-    void findListOfPathsThroughDisagTree(
-            const DisagTree& disagTree,
+    void findMaxExcess(
+            BestPathSearch * search,
+            const DisagTree::vertex_descriptor vertex
+            ) const;
+
+    void findBestPathsThroughDisagTree(
+            BestPathSearch * search,
             const DisagTree::vertex_descriptor vertex,
-            const LikelihoodAndVertex lav,
-            std::list<LikelihoodAndVertex> path = std::list<LikelihoodAndVertex>(0)
-            );
+            const LikelihoodAndVertex& lav,
+            const double partialExcess
+            ) const;
 
     const Fingerprint findBestPath(
             const DisagTree& disagTree,
+            BestPathSearch * search,
+            const DisagTree::vertex_descriptor rootVertex,
+            const LikelihoodAndVertex& firstLAV,
             const size_t deviceStart,
             const bool verbose = false
-            );
+            ) const;
+
+    const Fingerprint findBestPath(
+            const DisagTree& disagTree,
+            const DisagTree::vertex_descriptor rootVertex,
+            const LikelihoodAndVertex& firstLAV,
+            const size_t deviceStart
+            ) const;
 
     void removeOverlapping(
             std::list<Fingerprint> * disagList, /**< Input and output parameter */
@@ -0,0 +1,314 @@
+/*
+ * QuantileSketch.h
+ */
+
+#ifndef QUANTILESKETCH_H_
+#define QUANTILESKETCH_H_
+
+#include <cstddef> // size_t
+#include <cmath>   // ceil()
+#include <vector>
+#include <algorithm> // sort(), max()
+#include <utility>   // pair
+#include <random>
+
+/**
+ * @brief Approximate quantiles of a stream of values in bounded memory.
+ *
+ * A KLL sketch (Karnin, Lang & Liberty, "Optimal Quantile Approximation
+ * in Streams", 2016).  Values are held in a stack of compactors; a value
+ * in compactor @c h stands for 2^h of the original values.  When a
+ * compactor fills up it is sorted and every other value (the odd or the
+ * even ones, alternately) is promoted to the compactor above; the rest
+ * are dropped.  Compactors get smaller by a factor of 2/3 going down
+ * from the top one, which holds up to @c k values, so about 3k values
+ * are retained however many are added.  The rank error of quantile() is
+ * roughly proportional to 1/k.
+ *
+ * Sketches of different data can be merged, so partial sketches (e.g.
+ * one per thread) can be combined.
+ */
+template <class T>
+class QuantileSketch {
+public:
+    explicit QuantileSketch(
+            const size_t _k = 128 /**< capacity of the top compactor (at least 8) */
+            )
+    : k( std::max( _k, (size_t)8 ) ), numDataPoints(0), min(0), max(0), compactors(1), oddOffset(1, false)
+    {}
+
+    void add(
+            const T value
+            )
+    {
+        updateMinAndMax( value, value );
+        numDataPoints++;
+
+        compactors[0].push_back( value );
+        if ( compactors[0].size() >= capacity(0) )
+            compress();
+    }
+
+    void merge(
+            const QuantileSketch<T>& other
+            )
+    {
+        if ( other.numDataPoints == 0 )
+            return;
+
+        updateMinAndMax( other.min, other.max );
+        numDataPoints += other.numDataPoints;
+
+        while ( compactors.size() < other.compactors.size() ) {
+            addLevel();
+        }
+        for (size_t h=0; h<other.compactors.size(); h++) {
+            compactors[h].insert( compactors[h].end(), other.compactors[h].begin(), other.compactors[h].end() );
+        }
+        compress();
+    }
+
+    /**
+     * @return a value whose rank is close to @c q * getNumDataPoints(),
+     *         i.e. the smallest retained value which, counting the values
+     *         each retained value stands for, at least that many values
+     *         are less than or equal to.  @c q <= 0 and @c q >= 1 give the
+     *         exact min and max.  Returns 0 if no values have been added.
+     */
+    const T quantile(
+            const double q
+            ) const
+    {
+        if ( numDataPoints == 0 )
+            return 0;
+        if ( q <= 0 )
+            return min;
+        if ( q >= 1 )
+            return max;
+
+        std::vector< std::pair<T, size_t> > weighted;
+        weighted.reserve( getNumRetained() );
+        for (size_t h=0; h<compactors.size(); h++) {
+            for (size_t i=0; i<compactors[h].size(); i++) {
+                weighted.push_back( std::make_pair( compactors[h][i], (size_t)1 << h ) );
+            }
+        }
+        std::sort( weighted.begin(), weighted.end() );
+
+        size_t totalWeight = 0;
+        for (size_t i=0; i<weighted.size(); i++) {
+            totalWeight += weighted[i].second;
+        }
+
+        const double rank = q * totalWeight;
+        size_t cumulativeWeight = 0;
+        for (size_t i=0; i<weighted.size(); i++) {
+            cumulativeWeight += weighted[i].second;
+            if ( cumulativeWeight >= rank )
+                return weighted[i].first;
+        }
+        return max;
+    }
+
+    const size_t getNumDataPoints() const { return numDataPoints; }
+
+    /**
+     * @return the number of values held.  Bounded by about 3k.
+     */
+    const size_t getNumRetained() const
+    {
+        size_t n = 0;
+        for (size_t h=0; h<compactors.size(); h++) {
+            n += compactors[h].size();
+        }
+        return n;
+    }
+
+private:
+    size_t k;
+    size_t numDataPoints;
+    T min;
+    T max;
+    std::vector< std::vector<T> > compactors; /**< compactors[h] holds values of weight 2^h */
+    std::vector<bool> oddOffset; /**< which half each compactor promotes next time */
+
+    void updateMinAndMax(
+            const T otherMin,
+            const T otherMax
+            )
+    {
+        if ( numDataPoints == 0 ) {
+            min = otherMin;
+            max = otherMax;
+        } else {
+            if ( otherMin < min ) min = otherMin;
+            if ( otherMax > max ) max = otherMax;
+        }
+    }
+
+    /**
+     * @return the capacity of compactor @c h; @c k for the top compactor,
+     *         2/3 as much for each one below and never less than 2.
+     */
+    const size_t capacity(
+            const size_t h
+            ) const
+    {
+        const size_t depth = compactors.size() - 1 - h;
+        return std::max( (size_t)ceil( k * pow( 2.0/3.0, (double)depth ) ), (size_t)2 );
+    }
+
+    void addLevel()
+    {
+        compactors.push_back( std::vector<T>() );
+        oddOffset.push_back( false );
+    }
+
+    /**
+     * @brief Compact every compactor which is full, from the bottom up.
+     */
+    void compress()
+    {
+        for (size_t h=0; h<compactors.size(); h++) {
+            if ( compactors[h].size() < capacity(h) )
+                continue;
+
+            if ( h+1 == compactors.size() )
+                addLevel();
+
+            std::vector<T>& compactor = compactors[h];
+            std::sort( compactor.begin(), compactor.end() );
+
+            // if there's an odd number of values, the largest stays behind
+            T leftOver = 0;
+            const bool odd = compactor.size() % 2;
+            if ( odd ) {
+                leftOver = compactor.back();
+                compactor.pop_back();
+            }
+
+            for (size_t i=oddOffset[h]; i<compactor.size(); i+=2) {
+                compactors[h+1].push_back( compactor[i] );
+            }
+            oddOffset[h] = ! oddOffset[h];
+
+            compactor.clear();
+            if ( odd )
+                compactor.push_back( leftOver );
+        }
+    }
+};
+
+
+/**
+ * @brief A uniform random sample of up to @c capacity values from a
+ *        stream (Vitter's Algorithm R).
+ *
+ * Reservoirs of different data can be merged: the number of values
+ * taken from each side follows the same hypergeometric distribution as
+ * a sample of the combined data would.
+ */
+template <class T>
+class Reservoir {
+public:
+    explicit Reservoir(
+            const size_t _capacity = 0, /**< 0 disables the reservoir */
+            const unsigned int seed = 5489
+            )
+    : capacity(_capacity), numDataPoints(0)
+    {
+        if ( capacity > 0 )
+            rng.push_back( std::mt19937( seed ) );
+    }
+
+    void add(
+            const T value
+            )
+    {
+        if ( capacity == 0 )
+            return;
+
+        numDataPoints++;
+        if ( samples.size() < capacity ) {
+            samples.push_back( value );
+        } else {
+            const size_t j = randomIndex( numDataPoints );
+            if ( j < capacity )
+                samples[j] = value;
+        }
+    }
+
+    void merge(
+            const Reservoir<T>& other
+            )
+    {
+        if ( capacity == 0 || other.numDataPoints == 0 )
+            return;
+
+        std::vector<T> pool( samples );
+        std::vector<T> otherPool( other.samples );
+        size_t remaining = numDataPoints;
+        size_t otherRemaining = other.numDataPoints;
+        const size_t numToTake = std::min( capacity, remaining + otherRemaining );
+
+        // Each draw comes from one side with probability proportional to
+        // the number of values it has left to give.  Each side's pool is
+        // a uniform sample of its data, so a random value from the pool
+        // stands for a random value from the data.  If the reservoirs
+        // have different capacities, one pool can run out first; the
+        // rest of the draws then come from the other.
+        samples.clear();
+        while ( samples.size() < numToTake && ! (pool.empty() && otherPool.empty()) ) {
+            const bool fromThis = otherPool.empty() ||
+                    ( ! pool.empty() && randomIndex( remaining + otherRemaining ) < remaining );
+            if ( fromThis ) {
+                takeRandom( &pool, &samples );
+                remaining--;
+            } else {
+                takeRandom( &otherPool, &samples );
+                otherRemaining--;
+            }
+        }
+
+        numDataPoints += other.numDataPoints;
+    }
+
+    const std::vector<T>& getSamples() const { return samples; }
+
+    const size_t getNumDataPoints() const { return numDataPoints; }
+
+    const size_t getCapacity() const { return capacity; }
+
+private:
+    size_t capacity;
+    size_t numDataPoints;
+    std::vector<T> samples;
+    std::vector<std::mt19937> rng; /**< empty if @c capacity is 0.  A generator is about 5KB. */
+
+    /**
+     * @return a uniformly distributed integer in [0, n)
+     */
+    const size_t randomIndex(
+            const size_t n
+            )
+    {
+        std::uniform_int_distribution<size_t> dist( 0, n-1 );
+        return dist( rng.front() );
+    }
+
+    /**
+     * @brief Move a random value from @c pool to @c destination.
+     */
+    void takeRandom(
+            std::vector<T> * pool,
+            std::vector<T> * destination
+            )
+    {
+        const size_t i = randomIndex( pool->size() );
+        destination->push_back( (*pool)[i] );
+        (*pool)[i] = pool->back();
+        pool->pop_back();
+    }
+};
+
+#endif /* QUANTILESKETCH_H_ */
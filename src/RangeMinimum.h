@@ -0,0 +1,172 @@
+/*
+ * RangeMinimum.h
+ */
+
+#ifndef RANGEMINIMUM_H_
+#define RANGEMINIMUM_H_
+
+#include <cstddef> // size_t
+#include <vector>
+#include <stdint.h>
+#include <cassert>
+
+/**
+ * @brief Answers "what is the smallest value in [first, last)?" in
+ *        constant time after a linear-time build.
+ *
+ * Block-decomposed range minimum query.  The values are split into
+ * blocks of BLOCK_SIZE.  A sparse table over the block minimums
+ * answers the whole-block part of a query with two look-ups.  The
+ * partial blocks at each end are answered with a 32-bit mask per
+ * value which records the stack of "minimum so far" candidates in
+ * the BLOCK_SIZE values ending at that value; the position of the
+ * minimum is then just the highest set bit of the masked stack.
+ */
+template <class T>
+class RangeMinimum {
+public:
+    RangeMinimum()
+    {}
+
+    /**
+     * @brief Build the structure for @c n values.  @c values is copied.
+     */
+    template <class Iterator>
+    void build(
+            Iterator values, /**< iterator to the first value */
+            const size_t n   /**< number of values */
+            )
+    {
+        clear();
+        this->values.reserve( n );
+        for (size_t i=0; i<n; i++, ++values) {
+            this->values.push_back( *values );
+        }
+
+        // Masks for the in-block queries
+        masks.resize( n );
+        uint32_t currentMask = 0;
+        for (size_t i=0; i<n; i++) {
+            currentMask <<= 1; // forget the value which is now BLOCK_SIZE behind
+            while ( currentMask != 0 &&
+                    this->values[i] <= this->values[ i - lowestBit( currentMask ) ] ) {
+                currentMask &= currentMask - 1; // pop candidates which are not smaller than values[i]
+            }
+            currentMask |= 1;
+            masks[i] = currentMask;
+        }
+
+        // Sparse table over the block minimums
+        const size_t numBlocks = n / BLOCK_SIZE;
+        if ( numBlocks == 0 )
+            return;
+
+        sparseTable.push_back( std::vector<size_t>( numBlocks ) );
+        for (size_t b=0; b<numBlocks; b++) {
+            sparseTable[0][b] = minIndexEndingAt( (b * BLOCK_SIZE) + BLOCK_SIZE - 1, BLOCK_SIZE );
+        }
+        for (size_t level=1; ((size_t)1 << level) <= numBlocks; level++) {
+            const size_t half = (size_t)1 << (level-1);
+            sparseTable.push_back( std::vector<size_t>( numBlocks - (half*2) + 1 ) );
+            for (size_t b=0; b+(half*2)<=numBlocks; b++) {
+                sparseTable[level][b] = smaller( sparseTable[level-1][b], sparseTable[level-1][b+half] );
+            }
+        }
+    }
+
+    void clear()
+    {
+        values.clear();
+        masks.clear();
+        sparseTable.clear();
+    }
+
+    const size_t size() const
+    {
+        return values.size();
+    }
+
+    /**
+     * @return the smallest value in [first, last).  @c first must be < @c last.
+     */
+    const T min(
+            const size_t first,
+            const size_t last
+            ) const
+    {
+        return values[ minIndex( first, last ) ];
+    }
+
+    /**
+     * @return the index of the smallest value in [first, last).
+     *         @c first must be < @c last.
+     */
+    const size_t minIndex(
+            const size_t first,
+            const size_t last
+            ) const
+    {
+        assert( first < last && last <= values.size() );
+
+        const size_t length = last - first;
+        if ( length <= BLOCK_SIZE )
+            return minIndexEndingAt( last-1, length );
+
+        // The BLOCK_SIZE values at each end...
+        size_t best = smaller( minIndexEndingAt( first + BLOCK_SIZE - 1, BLOCK_SIZE ),
+                               minIndexEndingAt( last-1, BLOCK_SIZE ) );
+
+        // ...and the whole blocks in between
+        const size_t firstBlock = (first / BLOCK_SIZE) + 1;
+        const size_t lastBlock  = ((last-1) / BLOCK_SIZE); // one past
+        if ( firstBlock < lastBlock ) {
+            const size_t level = highestBit( lastBlock - firstBlock );
+            best = smaller( best, smaller( sparseTable[level][firstBlock],
+                                           sparseTable[level][lastBlock - ((size_t)1 << level)] ) );
+        }
+
+        return best;
+    }
+
+private:
+    static const size_t BLOCK_SIZE = 32; /**< @brief must equal the number of bits in a mask */
+
+    std::vector<T> values;
+    std::vector<uint32_t> masks; /**< @brief bit j of masks[i] is set if values[i-j] is
+                                      smaller than every value after it up to values[i]. */
+    std::vector< std::vector<size_t> > sparseTable; /**< @brief sparseTable[level][b] is the index
+                                                         of the minimum of blocks [b, b + 2^level) */
+
+    /**
+     * @return index of the minimum of the @c length values ending at @c last (inclusive).
+     */
+    const size_t minIndexEndingAt(
+            const size_t last,
+            const size_t length /**< 1 to BLOCK_SIZE */
+            ) const
+    {
+        const uint32_t mask = (length == BLOCK_SIZE) ? masks[last]
+                                                     : masks[last] & ((1u << length) - 1);
+        return last - highestBit( mask );
+    }
+
+    const size_t smaller(
+            const size_t a,
+            const size_t b
+            ) const
+    {
+        return (values[b] < values[a]) ? b : a;
+    }
+
+    static const size_t highestBit( const uint64_t x )
+    {
+        return 63 - __builtin_clzll( x );
+    }
+
+    static const size_t lowestBit( const uint32_t x )
+    {
+        return __builtin_ctz( x );
+    }
+};
+
+#endif /* RANGEMINIMUM_H_ */
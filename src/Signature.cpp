@@ -44,12 +44,8 @@ Signature::Signature(
         )
 : samplePeriod(_samplePeriod), sigID(_sigID)
 {
-    fstream dataFile;
-    Utils::openFile( dataFile, filename, fstream::in );
-
     Array<Sample_t> data;
-    data.loadData( dataFile );
-    dataFile.close();
+    data.loadData( filename );
 
     size_t newCropFront = cropFront ? cropFront : data.getNumLeadingZeros();
     size_t newCropBack  = cropBack  ? cropBack  : data.getNumTrailingZeros();
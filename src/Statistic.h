@@ -12,15 +12,307 @@
 #include <cassert>
 #include <cmath>
 #include <iostream>
-#include <boost/math/distributions/students_t.hpp>
-#include <boost/math/distributions/normal.hpp>
+#include <iomanip> // setw()
 #include <limits> // for std::numeric_limits<std::size_t>::max()
+#include <vector>
 #include "Array.h"
 #include "Common.h"
 #include "Histogram.h"
+#include "QuantileSketch.h"
+#include "Likelihood.h"
 
 
+/**
+ * @brief Just the summary statistics of a Statistic (see
+ *        Statistic::summary()), without its storage.  Trivially
+ *        copyable, so it's cheap to pass around and to compare
+ *        Statistics with different storage policies.  The hypothesis
+ *        tests and likelihoods all run on this.
+ */
+struct StatSummary {
+    double mean;
+    double stdev;
+    double min;
+    double max;
+    size_t numDataPoints;
+
+    /**
+     * @brief Uses a two-sided Student T-Test to determine
+     *        if @c other.mean is 'similar' to the calling object's mean.
+     *
+     * @return true if @c other is 'similar' to calling object.
+     */
+    const bool similar(
+            const StatSummary& other,
+            const double alpha=0.05        /**< significance level */
+            ) const
+    {
+        // deal with case where one or both Statistic arrays only has a single data point
+        if (numDataPoints == 1  ||  other.numDataPoints == 1)
+            return (mean == other.mean);
+
+        return tTest(other) > (alpha/2);
+    }
+
+    /**
+     * @brief A two-sided Student T-Test.
+     *
+     * Uses a Chi-Squared test for equal variances first.
+     *
+     * Code adapted from
+     * <a href="http://www.boost.org/doc/libs/1_43_0/libs/math/doc/sf_and_dist/html/math_toolkit/dist/stat_tut/weg/st_eg/two_sample_students_t.html">boost tutorial on Comparing the means of two samples with the Students-t test</a>
+     *
+     * @return complement of probability (the probability
+     *         that the difference is due to chance).  i.e. the
+     *         higher this value, the more likely the two distributions
+     *         have similar means.
+     */
+    const double tTest(
+            const StatSummary& other
+            ) const
+    {
+        if (mean == other.mean)
+            return 1.0;
+        // deal with case where numDataPoints is too low to be able to do a t-test
+        else if (numDataPoints<2 || other.numDataPoints<2)
+            return 0.0;
+
+        double nonzeroStdev = nonZeroStdev();
+
+        // Degrees of freedom (using Chi-Squared test):
+        double v = nonzeroStdev * nonzeroStdev / numDataPoints +
+                other.nonZeroStdev() * other.nonZeroStdev() / other.numDataPoints;
+        v *= v;
+        double t1 = nonzeroStdev * nonzeroStdev / numDataPoints;
+        t1 *= t1;
+        t1 /=  (numDataPoints - 1);
+        double t2 = other.nonZeroStdev() * other.nonZeroStdev() / other.numDataPoints;
+        t2 *= t2;
+        t2 /= (other.numDataPoints - 1);
+        v /= (t1 + t2);
+
+        // t-statistic:
+        double t_stat = (mean - other.mean) /
+                sqrt(nonzeroStdev * nonzeroStdev / numDataPoints +
+                        other.nonZeroStdev() * other.nonZeroStdev() / other.numDataPoints);
+
+        // calculate complement of probability (the probability that the difference is due to chance)
+        return Likelihood::studentTUpperTail( fabs(t_stat), v );
+    }
+
+    /**
+     * @brief Returns stdev if stdev > mean/10, else returns mean/10
+     */
+    const double nonZeroStdev() const {
+        if (stdev < 1)
+            return fabs(mean/10);
+        else
+            return stdev;
+    }
+
+    /**
+     * @brief The likelihood is normalised by dividing the raw likelihood
+     *    by the likelihood of the distribution's mean. The end result
+     *    is that we get a number between 0 and 1 which tells us how
+     *    close we are to the distribution's mean; if we're right on
+     *    target then the normalised likelihood will be 1.
+     */
+    const double normalisedLikelihood(
+            const double x
+            ) const
+    {
+        return Likelihood::normalisedGaussian( x, mean, nonZeroStdev() );
+    }
+};
+
+
+/**
+ * @brief Statistic storage policy which keeps running moments only
+ *        (Welford's algorithm), so each update takes O(1) time and
+ *        memory however many data points have been seen.
+ *
+ * Keeps its own count and mean so that the sum of squared deviations
+ * stays accurate when data points arrive in batches.
+ */
 template <class T>
+class StreamingMoments {
+public:
+    StreamingMoments()
+    : count(0), runningMean(0), m2(0)
+    {}
+
+    void add(
+            const T datum
+            )
+    {
+        count++;
+        const double delta = datum - runningMean;
+        runningMean += delta / count;
+        m2 += delta * (datum - runningMean);
+    }
+
+    /**
+     * @brief Combine with moments of other data (Chan et al.'s pairwise update).
+     */
+    void merge(
+            const StreamingMoments<T>& other
+            )
+    {
+        if (other.count == 0)
+            return;
+
+        const double total = count + other.count;
+        const double delta = other.runningMean - runningMean;
+        runningMean += delta * (other.count / total);
+        m2 += other.m2 + delta * delta * ((double)count * other.count / total);
+        count += other.count;
+    }
+
+    /**
+     * @return the sum of squared deviations from the mean of the data added so far.
+     */
+    const double sumOfSquaredDeviations(
+            const double /* mean (unused; the running mean is used instead) */
+            ) const
+    {
+        return m2;
+    }
+
+private:
+    size_t count;
+    double runningMean;
+    double m2; /**< sum of squared deviations from @c runningMean */
+};
+
+
+/**
+ * @brief Statistic storage policy which keeps running moments plus a
+ *        QuantileSketch, so quantile() can be answered in bounded memory,
+ *        and, if @c RESERVOIR_SIZE > 0, a uniform random sample of up to
+ *        @c RESERVOIR_SIZE data points.
+ */
+template <class T, size_t RESERVOIR_SIZE = 0>
+class SketchedMoments : public StreamingMoments<T> {
+public:
+    SketchedMoments()
+    : reservoir(RESERVOIR_SIZE)
+    {}
+
+    void add(
+            const T datum
+            )
+    {
+        StreamingMoments<T>::add( datum );
+        sketch.add( datum );
+        reservoir.add( datum );
+    }
+
+    void merge(
+            const SketchedMoments<T, RESERVOIR_SIZE>& other
+            )
+    {
+        StreamingMoments<T>::merge( other );
+        sketch.merge( other.sketch );
+        reservoir.merge( other.reservoir );
+    }
+
+    const T quantile(
+            const double q
+            ) const
+    {
+        return sketch.quantile( q );
+    }
+
+    const QuantileSketch<T>& getSketch() const { return sketch; }
+
+    const Reservoir<T>& getReservoir() const { return reservoir; }
+
+private:
+    QuantileSketch<T> sketch;
+    Reservoir<T> reservoir;
+};
+
+
+/**
+ * @brief Statistic storage policy which stores every data point we've
+ *        ever seen so we can re-calculate an exact stdev on every update.
+ *
+ * Memory-hungry (a list node per data point) and each update takes
+ * time proportional to the number of data points seen.  DOES NOT WORK
+ * with histogram data.
+ */
+template <class T>
+class ExactDataStore {
+public:
+    void add(
+            const T datum
+            )
+    {
+        dataStore.push_back(datum);
+    }
+
+    void merge(
+            const ExactDataStore<T>& other
+            )
+    {
+        dataStore.insert( dataStore.end(), other.dataStore.begin(), other.dataStore.end() );
+    }
+
+    const double sumOfSquaredDeviations(
+            const double mean
+            ) const
+    {
+        double stdevAccumulator = 0;
+        for (typename std::list<T>::const_iterator i=dataStore.begin(); i!=dataStore.end(); i++) {
+            stdevAccumulator += pow( ( *i - mean ), 2 );
+        }
+        return stdevAccumulator;
+    }
+
+    /**
+     * @return the exact quantile, with the same definition of rank as
+     *         QuantileSketch::quantile()
+     *
+     * The data points are sorted on the first call after any are added
+     * and the sorted copy is kept for later calls, so don't call this
+     * from more than one thread at once.
+     */
+    const T quantile(
+            const double q
+            ) const
+    {
+        if (dataStore.empty())
+            return 0;
+
+        // data points are only ever added, so a change of size means new data
+        if ( sorted.size() != dataStore.size() ) {
+            sorted.assign( dataStore.begin(), dataStore.end() );
+            std::sort( sorted.begin(), sorted.end() );
+        }
+
+        const double rank = ceil( q * sorted.size() );
+        if (rank <= 1)
+            return sorted.front();
+        if (rank >= sorted.size())
+            return sorted.back();
+        return sorted[ (size_t)rank - 1 ];
+    }
+
+    std::list<T> dataStore;
+
+private:
+    mutable std::vector<T> sorted; /**< @c dataStore, sorted by quantile() */
+};
+
+
+/**
+ * @brief Summary statistics of a set of data points.
+ *
+ * @c Storage decides how the stdev is kept up to date: @c StreamingMoments
+ * (the default), @c SketchedMoments or @c ExactDataStore.  The last two
+ * can also answer quantile().
+ */
+template <class T, class Storage = StreamingMoments<T> >
 struct Statistic {
     /************************
      *  Member variables    *
@@ -31,10 +323,7 @@ struct Statistic {
     T max;
     size_t numDataPoints;
 
-    std::list<T> dataStore; /**< @brief store every data point we've ever seen so we can
-                                   re-calculate an accurate stdev on every update.
-                                   @details Memory-hungry but accurate. DOES NOT WORK with
-                                   histogram data. */
+    Storage storage; /**< @brief whatever @c Storage needs to calculate the stdev */
 
     /************************
      *  Member functions    *
@@ -55,7 +344,7 @@ struct Statistic {
             )
     : mean(value), stdev(0), min(value), max(value), numDataPoints(1)
     {
-        dataStore.push_back(value);
+        storage.add(value);
     }
 
 
@@ -121,7 +410,7 @@ struct Statistic {
         if ( beginning >= (end-1) || beginning==end ) {
             min = max = mean = data[beginning];
             numDataPoints = 1;
-            dataStore.push_back( data[beginning] );
+            storage.add( data[beginning] );
             return;
         }
 
@@ -144,7 +433,7 @@ struct Statistic {
         for (size_t i=beginning; i<end; i++) {
             currentVal = data[i];
 
-            dataStore.push_back(currentVal);
+            storage.add(currentVal);
 
             accumulator += currentVal;
 
@@ -210,7 +499,7 @@ struct Statistic {
                 }
             }
 
-            dataStore.push_back(currentVal);
+            storage.add(currentVal);
 
             accumulator += currentVal;
 
@@ -233,31 +522,68 @@ struct Statistic {
 
     /**
      * @brief Update an existing Statistic with data from an existing statistic.
+     *
+     * With @c StreamingMoments this takes constant time (the counts, means,
+     * sums of squared deviations, min and max are combined pairwise) so
+     * partial Statistics, e.g. one per thread, can be merged cheaply.
+     * With @c ExactDataStore the other side's data points are copied.
      */
     void update(
-            const Statistic<T>& otherStat
+            const Statistic& otherStat
             )
     {
-        Array<T> otherStatArray( otherStat.dataStore.size() );
+        if (otherStat.numDataPoints == 0)
+            return;
 
-        size_t count = 0;
-        typename std::list<T>::const_iterator it;
-        for (it=otherStat.dataStore.begin(); it!=otherStat.dataStore.end(); it++) {
-            otherStatArray[count++] = *it;
+        if (numDataPoints == 0) {
+            min = otherStat.min;
+            max = otherStat.max;
+        } else {
+            if ( otherStat.max > max )
+                max = otherStat.max;
+
+            if ( otherStat.min < min )
+                min = otherStat.min;
         }
 
-        update( otherStatArray ); // re-use the existing update() function which expects an array
+        size_t numExistingDataPoints = numDataPoints;
+        numDataPoints = numExistingDataPoints + otherStat.numDataPoints;
+        mean = (mean * ((double)numExistingDataPoints/numDataPoints))
+                + (otherStat.mean * ((double)otherStat.numDataPoints/numDataPoints) );
+
+        storage.merge( otherStat.storage );
+        stdev = calcStdev();
+    }
+
+
+    /**
+     * @brief Merge partial Statistics into one.
+     *
+     * Merges neighbouring pairs, then neighbouring pairs of the results and
+     * so on, so that rounding errors grow with the log of the number of
+     * partials rather than with the number of partials.
+     */
+    static const Statistic reduce(
+            const std::vector<Statistic>& partials
+            )
+    {
+        if (partials.empty())
+            return Statistic();
+
+        std::vector<Statistic> level( partials );
+        for (size_t stride=1; stride<level.size(); stride*=2) {
+            for (size_t i=0; i+stride<level.size(); i+=stride*2) {
+                level[i].update( level[i+stride] );
+            }
+        }
+        return level[0];
     }
 
 
     const double calcStdev() const
     {
         if (numDataPoints > 1) {
-            double stdevAccumulator = 0;
-            for (typename std::list<T>::const_iterator i=dataStore.begin(); i!=dataStore.end(); i++) {
-                stdevAccumulator += pow( ( *i - mean ), 2 );
-            }
-            return sqrt(stdevAccumulator / (numDataPoints-1));
+            return sqrt(storage.sumOfSquaredDeviations(mean) / (numDataPoints-1));
         } else
             return 0;
     }
@@ -287,113 +613,60 @@ struct Statistic {
                 + (datum * ((double)1.0/numDataPoints) );
 
         /** Update the sample standard deviation with the new data. */
-        dataStore.push_back(datum);
+        storage.add(datum);
         stdev = calcStdev();
     }
 
     /**
-     * @brief Uses a two-sided Student T-Test to determine
-     *        if @c other.mean is 'similar' to the calling object's mean.
-     *
-     * @return true if @c other is 'similar' to calling object.
+     * @return the summary statistics without the storage
+     */
+    const StatSummary summary() const
+    {
+        const StatSummary s = { mean, stdev, (double)min, (double)max, numDataPoints };
+        return s;
+    }
+
+    /**
+     * @brief See StatSummary::similar()
      */
     const bool similar(
-            const Statistic<T> other,
+            const Statistic& other,
             const double alpha=0.05        /**< significance level */
             ) const
     {
-        // deal with case where one or both Statistic arrays only has a single data point
-        if (numDataPoints == 1  ||  other.numDataPoints == 1)
-            return (mean == other.mean);
-
-        return tTest(other) > (alpha/2);
+        return summary().similar( other.summary(), alpha );
     }
 
     /**
-     * @brief A two-sided Student T-Test.
-     *
-     * Uses a Chi-Squared test for equal variances first.
-     *
-     * Code adapted from
-     * <a href="http://www.boost.org/doc/libs/1_43_0/libs/math/doc/sf_and_dist/html/math_toolkit/dist/stat_tut/weg/st_eg/two_sample_students_t.html">boost tutorial on Comparing the means of two samples with the Students-t test</a>
-     *
-     * @return complement of probability (the probability
-     *         that the difference is due to chance).  i.e. the
-     *         higher this value, the more likely the two distributions
-     *         have similar means.
+     * @brief See StatSummary::tTest()
      */
     const double tTest(
-                const Statistic<T> other
-                ) const
-        {
-
-        if (mean == other.mean)
-            return 1.0;
-        // deal with case where numDataPoints is too low to be able to do a t-test
-        else if (numDataPoints<2 || other.numDataPoints<2)
-            return 0.0;
-
-        using namespace boost::math;
-
-        double nonzeroStdev = nonZeroStdev();
-
-        // Degrees of freedom (using Chi-Squared test):
-        double v = nonzeroStdev * nonzeroStdev / numDataPoints +
-                other.nonZeroStdev() * other.nonZeroStdev() / other.numDataPoints;
-        v *= v;
-        double t1 = nonzeroStdev * nonzeroStdev / numDataPoints;
-        t1 *= t1;
-        t1 /=  (numDataPoints - 1);
-        double t2 = other.nonZeroStdev() * other.nonZeroStdev() / other.numDataPoints;
-        t2 *= t2;
-        t2 /= (other.numDataPoints - 1);
-        v /= (t1 + t2);
-
-        // t-statistic:
-        double t_stat = (mean - other.mean) /
-                sqrt(nonzeroStdev * nonzeroStdev / numDataPoints +
-                        other.nonZeroStdev() * other.nonZeroStdev() / other.numDataPoints);
-
-        // define our distribution object
-        students_t dist( v );
-
-        // calculate complement of probability (the probability that the difference is due to chance)
-        double q = cdf(complement(dist, fabs(t_stat)));
-
-        return q;
+            const Statistic& other
+            ) const
+    {
+        return summary().tTest( other.summary() );
     }
 
     /**
-     * @brief Returns stdev if stdev > mean/10, else returns mean/10
+     * @brief See StatSummary::nonZeroStdev()
      */
-    const double nonZeroStdev() const {
-        if (stdev < 1)
-            return fabs(mean/10);
-        else
-            return stdev;
+    const double nonZeroStdev() const
+    {
+        return summary().nonZeroStdev();
     }
 
     /**
-     * @brief The likelihood is normalised by dividing the raw likelihood
-     *    by the likelihood of the distribution's mean. The end result
-     *    is that we get a number between 0 and 1 which tells us how
-     *    close we are to the distribution's mean; if we're right on
-     *    target then the normalised likelihood will be 1.
+     * @brief See StatSummary::normalisedLikelihood()
      */
     const double normalisedLikelihood(
             const double x
             ) const
     {
-        // Create a normal distribution
-        boost::math::normal dist(mean, nonZeroStdev());
-
-        // Calculate normalised likelihood
-        return  boost::math::pdf(dist, x) /
-                boost::math::pdf(dist, mean);
+        return summary().normalisedLikelihood( x );
     }
 
 
-    friend std::ostream& operator<<(std::ostream& o, const Statistic<T>& s)
+    friend std::ostream& operator<<(std::ostream& o, const Statistic& s)
     {
         const size_t w = 6;
         using namespace std;
@@ -413,6 +686,17 @@ struct Statistic {
         o << mean << " " << 0 << " " << min << " " << max << std::endl;
     }
 
+    /**
+     * @return roughly the value below which a fraction @c q of the data
+     *         points lie.  Only available if @c Storage has quantile().
+     */
+    const T quantile(
+            const double q
+            ) const
+    {
+        return storage.quantile(q);
+    }
+
     const double getMean()          const { return mean;  }
     const double getStdev()         const { return stdev; }
     const T      getMin()           const { return min;   }
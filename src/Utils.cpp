@@ -11,6 +11,12 @@
 #include <time.h>
 #include <fstream>
 #include <iostream>
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+#include <sys/time.h> // gettimeofday()
+#include <fcntl.h>    // open()
+#include <unistd.h>   // close()
+#include <cstring>    // memcpy()
 
 const int Utils::roundToNearestInt( const double input )
 {
@@ -101,6 +107,105 @@ const bool Utils::fileExists( const std::string& filename )
     return (bool)ifile;
 }
 
+/**
+ * @brief Memory-map @c filename read-only.
+ *
+ * The mapping outlives the file descriptor, which is closed before returning.
+ * Release the mapping with unmapFile().
+ *
+ * @return pointer to the first byte of the file, or 0 if the file is empty.
+ *         @c length is also used as a return parameter.
+ */
+const char * Utils::mapFile(
+        const std::string& filename, /**< including path and suffix */
+        size_t * length /**< return parameter: length of file in bytes */
+        )
+{
+    const int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd == -1 ) {
+        fatalError("Failed to open " + filename + " for reading.");
+    }
+
+    struct stat sb;
+    if ( fstat( fd, &sb ) == -1 ) {
+        close( fd );
+        fatalError("Failed to stat " + filename);
+    }
+
+    *length = sb.st_size;
+    if ( *length == 0 ) {
+        close( fd );
+        return 0;
+    }
+
+    void * addr = mmap( 0, *length, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( addr == MAP_FAILED ) {
+        fatalError("Failed to mmap " + filename);
+    }
+
+    // we read the file front-to-back exactly once
+    madvise( addr, *length, MADV_SEQUENTIAL );
+
+    return static_cast<const char *>(addr);
+}
+
+void Utils::unmapFile(
+        const char * addr,
+        const size_t length
+        )
+{
+    if ( addr != 0 ) {
+        munmap( const_cast<char *>(addr), length );
+    }
+}
+
+/**
+ * @brief Wall-clock timer.  Call with @c start=0 to get a start time
+ *        then pass that start time back in to get the elapsed time.
+ *
+ * @return seconds since @c start.
+ */
+const double Utils::secondsSince( const double start )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return (tv.tv_sec + (tv.tv_usec / 1000000.0)) - start;
+}
+
+/**
+ * @brief A fast, non-cryptographic 64-bit checksum.
+ *
+ * Works a word at a time (FNV-1a style mixing with a final avalanche)
+ * so it is cheap enough to run over large files on every load.
+ */
+const uint64_t Utils::checksum(
+        const char * data,
+        const size_t length
+        )
+{
+    const uint64_t PRIME = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL ^ length;
+
+    size_t i = 0;
+    uint64_t word;
+    for (; i+8 <= length; i+=8) {
+        memcpy( &word, data+i, 8 );
+        hash = (hash ^ word) * PRIME;
+        hash ^= hash >> 29;
+    }
+    for (; i<length; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * PRIME;
+    }
+
+    // final avalanche
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
 /**
  * @brief Compares 2 doubles.  Are they within (a * tolerance) of each other?
  */
@@ -10,6 +10,7 @@
 
 #include <string>
 #include <fstream>
+#include <stdint.h>
 
 namespace Utils {
 
@@ -30,6 +31,23 @@ const size_t countDataPoints( std::fstream& fs );
 
 const bool fileExists( const std::string& filename );
 
+const char * mapFile(
+        const std::string& filename,
+        size_t * length
+        );
+
+void unmapFile(
+        const char * addr,
+        const size_t length
+        );
+
+const double secondsSince( const double start );
+
+const uint64_t checksum(
+        const char * data,
+        const size_t length
+        );
+
 const bool roughlyEqual(
         const double a,
         const double b,
@@ -6,22 +6,115 @@
 #include <boost/test/unit_test.hpp>
 #include <iostream>
 #include <list>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // rmdir()
+#include <vector>
 
 
 BOOST_AUTO_TEST_CASE( findTime )
 {
     AggregateData aggData;
-    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv" );
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
 
     BOOST_CHECK_EQUAL( aggData.findTime(1310252400), 0 );
     BOOST_CHECK_EQUAL( aggData.findTime(1310255190), 427);
     BOOST_CHECK_EQUAL( aggData.findTime(1310338795), 12988);
 }
 
+/**
+ * @return the last index whose timestamp is <= time.  Slow but obviously correct.
+ */
+size_t bruteForceFindTime( const AggregateData& aggData, const size_t time )
+{
+    size_t i = 0;
+    while ( i+1 < aggData.getSize() && aggData[i+1].timestamp <= time ) {
+        i++;
+    }
+    return i;
+}
+
+BOOST_AUTO_TEST_CASE( findTimeWithGaps )
+{
+    // earlyAugust has plenty of dropped readings
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/earlyAugust.csv", false );
+
+    const size_t first = aggData[0].timestamp;
+    const size_t last  = aggData[ aggData.getSize()-1 ].timestamp;
+
+    BOOST_CHECK_EQUAL( aggData.findTime( first-1 ), AggregateData::TIME_OUT_OF_RANGE );
+    BOOST_CHECK_EQUAL( aggData.findTime( last+1 ),  AggregateData::TIME_OUT_OF_RANGE );
+    BOOST_CHECK_EQUAL( aggData.findTime( last ),    aggData.getSize()-1 );
+
+    size_t mismatches = 0;
+    size_t expected = 0;
+    for (size_t t=first; t<=first+(3600*24); t++) {
+        while ( expected+1 < aggData.getSize() && aggData[expected+1].timestamp <= t ) {
+            expected++;
+        }
+        if ( aggData.findTime(t) != expected )
+            mismatches++;
+    }
+    BOOST_CHECK_EQUAL( mismatches, 0 );
+
+    // The index must stay correct when samples are retired from the front
+    AggregateData streamed;
+    streamed.openCurrentCostStream( "data/input/current_cost/earlyAugust.csv" );
+    streamed.streamSamplesUntil( first + 7200 );
+    streamed.retireSamplesBefore( first + 3600 );
+    streamed.streamSamplesUntil( first + 10800 );
+    mismatches = 0;
+    for (size_t t=streamed[0].timestamp; t<=streamed[ streamed.getSize()-1 ].timestamp; t++) {
+        if ( streamed.findTime(t) != bruteForceFindTime( streamed, t ) )
+            mismatches++;
+    }
+    BOOST_CHECK_EQUAL( mismatches, 0 );
+    BOOST_CHECK_EQUAL( streamed.findTime( first ), AggregateData::TIME_OUT_OF_RANGE );
+}
+
+BOOST_AUTO_TEST_CASE( findTimeAfterOutage )
+{
+    // Appending after a multi-year outage must not grow the time index by
+    // one bucket per sample period of the outage (that would be ~100 million).
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+    const size_t beforeOutage = aggData.getSize();
+    const size_t lastBefore = aggData[ beforeOutage-1 ].timestamp;
+    const size_t outage = 20 * 365 * 24 * 3600;
+
+    for (size_t i=0; i<200; i++) {
+        AggregateSample sample;
+        sample.timestamp = lastBefore + outage + (i * 6) + ( i >= 100 ? outage : 0 );
+        sample.reading = 100;
+        aggData.appendSamples( &sample, 1 );
+    }
+
+    BOOST_CHECK_EQUAL( aggData.findTime( lastBefore ), beforeOutage-1 );
+    BOOST_CHECK_EQUAL( aggData.findTime( lastBefore + 1 ), beforeOutage-1 );
+    BOOST_CHECK_EQUAL( aggData.findTime( lastBefore + outage - 1 ), beforeOutage-1 );
+
+    size_t mismatches = 0;
+    for (size_t i=beforeOutage; i+1<aggData.getSize(); i++) {
+        const size_t t = aggData[i].timestamp;
+        if ( aggData.findTime( t ) != i || aggData.findTime( t+1 ) != bruteForceFindTime( aggData, t+1 ) )
+            mismatches++;
+    }
+    BOOST_CHECK_EQUAL( mismatches, 0 );
+
+    size_t inFirstSamples = 0;
+    for (size_t t=aggData[0].timestamp; t<aggData[0].timestamp+3600; t++) {
+        if ( aggData.findTime( t ) != bruteForceFindTime( aggData, t ) )
+            inFirstSamples++;
+    }
+    BOOST_CHECK_EQUAL( inFirstSamples, 0 );
+}
+
 BOOST_AUTO_TEST_CASE( findSpike )
 {
     AggregateData aggData;
-    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv" );
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
 
     std::list<AggregateData::FoundSpike> foundSpikes = aggData.findSpike(Statistic<Sample_t>(245));
 
@@ -36,3 +129,324 @@ BOOST_AUTO_TEST_CASE( findSpike )
 
     std::cout << "done" << std::endl;
 }
+
+BOOST_AUTO_TEST_CASE( findSpikeWithDeltaIndex )
+{
+    // A fully loaded AggregateData searches its sorted delta index.
+    // A streamed one has no index and scans.  Both must agree.
+    const std::string filename = "data/input/current_cost/earlyAugust.csv";
+    AggregateData indexed;
+    indexed.loadCurrentCostData( filename, false );
+
+    AggregateData scanned;
+    scanned.openCurrentCostStream( filename );
+    scanned.streamSamplesUntil( (size_t)-1 );
+    BOOST_REQUIRE_EQUAL( scanned.getSize(), indexed.getSize() );
+
+    const size_t first = indexed[0].timestamp;
+    const size_t windows[][2] = { {0, 0}, {first+7, first+600}, {first+5000, first+200000}, {first, first+6} };
+    const double means[] = { 245, -245, 2000, -2000, 30 };
+
+    for (size_t w=0; w<4; w++) {
+        for (size_t m=0; m<5; m++) {
+            Statistic<Sample_t> stats( means[m] );
+            std::list<AggregateData::FoundSpike> a = indexed.findSpike( stats, windows[w][0], windows[w][1] );
+            std::list<AggregateData::FoundSpike> b = scanned.findSpike( stats, windows[w][0], windows[w][1] );
+            BOOST_REQUIRE_EQUAL( a.size(), b.size() );
+            std::list<AggregateData::FoundSpike>::const_iterator bi = b.begin();
+            for (std::list<AggregateData::FoundSpike>::const_iterator ai=a.begin(); ai!=a.end(); ai++, bi++) {
+                BOOST_CHECK_EQUAL( ai->timestamp, bi->timestamp );
+                BOOST_CHECK_EQUAL( ai->delta, bi->delta );
+                BOOST_CHECK_EQUAL( ai->likelihood, bi->likelihood );
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( spikeSearchQuantileLimits )
+{
+    // deltas of about 2000 with one outlier
+    const double deltas[] = { 1990, 2010, 2000, 1995, 2005, 2002, 1998, 2003, 1997, 2600 };
+    Statistic<Sample_t> plain;
+    Statistic< Sample_t, SketchedMoments<Sample_t> > sketched;
+    for (size_t i=0; i<sizeof(deltas)/sizeof(double); i++) {
+        plain.update( deltas[i] );
+        sketched.update( deltas[i] );
+    }
+
+    // without a tail quantile the limits are the same as for a plain Statistic
+    const AggregateData::SpikeSearch fromPlain( plain );
+    const AggregateData::SpikeSearch fromSketch( sketched );
+    BOOST_CHECK_EQUAL( fromSketch.wideLower,   fromPlain.wideLower );
+    BOOST_CHECK_EQUAL( fromSketch.wideUpper,   fromPlain.wideUpper );
+    BOOST_CHECK_EQUAL( fromSketch.narrowLower, fromPlain.narrowLower );
+    BOOST_CHECK_EQUAL( fromSketch.narrowUpper, fromPlain.narrowUpper );
+
+    // with one, the outlier no longer stretches the limits
+    const AggregateData::SpikeSearch fromQuantiles( sketched, 0.1 );
+    BOOST_CHECK( fromQuantiles.narrowMatch( 2000 ) );
+    BOOST_CHECK( fromQuantiles.narrowUpper < 2600 );
+    BOOST_CHECK( fromQuantiles.wideUpper < fromPlain.wideUpper );
+    BOOST_CHECK( fromQuantiles.wideLower > fromPlain.wideLower );
+    BOOST_CHECK_EQUAL( fromQuantiles.likelihood( sketched.mean ), 1.0 );
+
+    // too few data points for quantiles so fall back to min and max
+    Statistic< Sample_t, SketchedMoments<Sample_t> > few( 2000.0 );
+    const AggregateData::SpikeSearch fromFew( few, 0.1 );
+    BOOST_CHECK_EQUAL( fromFew.narrowLower, AggregateData::SpikeSearch( Statistic<Sample_t>( 2000.0 ) ).narrowLower );
+}
+
+BOOST_AUTO_TEST_CASE( singlePassLoader )
+{
+    const char * files[] = {"10July.csv", "earlyAugust.csv", "earlyJuly.csv",
+            "fakeWasher.csv", "fakeWasherNoisy.csv", "test.csv"};
+
+    for (size_t f=0; f<(sizeof(files)/sizeof(files[0])); f++) {
+        const std::string filename = std::string("data/input/current_cost/") + files[f];
+
+        AggregateData reference;
+        double start = Utils::secondsSince(0);
+        reference.loadCurrentCostDataWithIostreams( filename );
+        const double iostreamTime = Utils::secondsSince(start);
+
+        AggregateData aggData;
+        start = Utils::secondsSince(0);
+        aggData.loadCurrentCostData( filename, false );
+        const double mmapTime = Utils::secondsSince(start);
+
+        BOOST_REQUIRE_EQUAL( aggData.getSize(), reference.getSize() );
+        for (size_t i=0; i<aggData.getSize(); i++) {
+            BOOST_CHECK_EQUAL( aggData[i].timestamp, reference[i].timestamp );
+            BOOST_CHECK_EQUAL( aggData[i].reading,   reference[i].reading   );
+        }
+
+        std::cout << files[f] << ": iostreams loader = " << iostreamTime*1000 << "ms"
+                  << ", single-pass loader = " << mmapTime*1000 << "ms"
+                  << ", speedup = " << iostreamTime / mmapTime << "x" << std::endl;
+    }
+}
+
+BOOST_AUTO_TEST_CASE( binaryCache )
+{
+    // Work on a copy of the CSV, in a temporary directory, so we can
+    // modify it and so the cache isn't written next to the input data
+    char tmpDir[] = "/tmp/aggDataTestXXXXXX";
+    BOOST_REQUIRE( mkdtemp( tmpDir ) );
+    const std::string filename = std::string( tmpDir ) + "/binaryCacheTest.csv";
+    const std::string cacheFilename = filename + AggregateData::CACHE_SUFFIX;
+    {
+        std::ifstream src( "data/input/current_cost/10July.csv", std::ios::binary );
+        std::ofstream dst( filename.c_str(), std::ios::binary );
+        dst << src.rdbuf();
+    }
+    remove( cacheFilename.c_str() );
+
+    AggregateData reference;
+    reference.loadCurrentCostData( filename, false );
+
+    // First load should write the cache
+    AggregateData firstLoad;
+    firstLoad.loadCurrentCostData( filename );
+    BOOST_CHECK( Utils::fileExists( cacheFilename ) );
+
+    // Second load should read from the cache
+    AggregateData cached;
+    double start = Utils::secondsSince(0);
+    cached.loadCurrentCostData( filename );
+    std::cout << "Loading from cache took " << Utils::secondsSince(start)*1000 << "ms" << std::endl;
+
+    BOOST_REQUIRE_EQUAL( cached.getSize(), reference.getSize() );
+    BOOST_CHECK_EQUAL( cached.getSamplePeriod(), reference.getSamplePeriod() );
+    size_t mismatches = 0;
+    for (size_t i=0; i<cached.getSize(); i++) {
+        if ( cached[i].timestamp != reference[i].timestamp ||
+             cached[i].reading   != reference[i].reading )
+            mismatches++;
+    }
+    BOOST_CHECK_EQUAL( mismatches, 0 );
+
+    // Changing the CSV should invalidate the cache
+    {
+        std::ofstream dst( filename.c_str(), std::ios::binary | std::ios::app );
+        dst << "1310338801\t1234\n";
+    }
+    AggregateData modified;
+    modified.loadCurrentCostData( filename );
+    BOOST_REQUIRE_EQUAL( modified.getSize(), reference.getSize()+1 );
+    BOOST_CHECK_EQUAL( modified[ modified.getSize()-1 ].timestamp, 1310338801 );
+    BOOST_CHECK_EQUAL( modified[ modified.getSize()-1 ].reading, 1234 );
+
+    // ...and the rebuilt cache should hold the new data
+    AggregateData modifiedCached;
+    modifiedCached.loadCurrentCostData( filename );
+    BOOST_REQUIRE_EQUAL( modifiedCached.getSize(), modified.getSize() );
+    BOOST_CHECK_EQUAL( modifiedCached[ modifiedCached.getSize()-1 ].reading, 1234 );
+
+    remove( filename.c_str() );
+    remove( cacheFilename.c_str() );
+    rmdir( tmpDir );
+}
+
+BOOST_AUTO_TEST_CASE( streaming )
+{
+    const std::string filename = "data/input/current_cost/earlyAugust.csv";
+
+    AggregateData reference;
+    reference.loadCurrentCostData( filename, false );
+
+    AggregateData streamed;
+    streamed.openCurrentCostStream( filename );
+    BOOST_CHECK( streamed.isStreaming() );
+
+    // Walk through the file an hour at a time, keeping only two hours in memory
+    const size_t WINDOW = 3600;
+    size_t time = reference[0].timestamp;
+    while ( streamed.streamSamplesUntil( time + WINDOW ) ) {
+        streamed.retireSamplesBefore( time - WINDOW );
+        time += WINDOW;
+    }
+    BOOST_CHECK( streamed.endOfStream() );
+
+    // Capacity is bounded by the window, not by the length of the file
+    BOOST_CHECK_LT( streamed.getCapacity(), reference.getSize() / 10 );
+
+    // The samples left in the window should match the tail of the full load
+    BOOST_CHECK_LT( streamed.getSize(), reference.getSize() );
+    size_t mismatches = 0;
+    size_t refIndex = reference.getSize() - streamed.getSize();
+    for (size_t i=0; i<streamed.getSize(); i++, refIndex++) {
+        if ( streamed[i].timestamp != reference[refIndex].timestamp ||
+             streamed[i].reading   != reference[refIndex].reading )
+            mismatches++;
+    }
+    BOOST_CHECK_EQUAL( mismatches, 0 );
+}
+
+BOOST_AUTO_TEST_CASE( readingGoesBelow )
+{
+    // Indexed (range-minimum) and scanned answers must agree
+    const std::string filename = "data/input/current_cost/10July.csv";
+    AggregateData indexed;
+    indexed.loadCurrentCostData( filename, false );
+
+    AggregateData scanned;
+    scanned.openCurrentCostStream( filename );
+    scanned.streamSamplesUntil( (size_t)-1 );
+
+    const size_t first = indexed[0].timestamp;
+    const size_t last  = indexed[ indexed.getSize()-1 ].timestamp;
+
+    std::vector<AggregateData::ReadingQuery> queries;
+    srand( 42 );
+    for (size_t q=0; q<5000; q++) {
+        const size_t start = first - 100 + (rand() % (last - first + 200));
+        const size_t end   = start + (rand() % 20000);
+        queries.push_back( AggregateData::ReadingQuery( start, end, rand() % 800 ) );
+    }
+
+    std::vector<bool> results;
+    indexed.readingsGoBelow( queries, &results );
+    BOOST_REQUIRE_EQUAL( results.size(), queries.size() );
+
+    size_t mismatches = 0, trues = 0;
+    for (size_t q=0; q<queries.size(); q++) {
+        if ( results[q] != scanned.readingGoesBelow( queries[q].startTime, queries[q].endTime, queries[q].threshold ) )
+            mismatches++;
+        if ( results[q] )
+            trues++;
+    }
+    BOOST_CHECK_EQUAL( mismatches, 0 );
+    BOOST_CHECK_GT( trues, 0 );
+    BOOST_CHECK_LT( trues, queries.size() );
+}
+
+BOOST_AUTO_TEST_CASE( batchedFindSpikes )
+{
+    // findSpikes() must give exactly what separate findSpike() calls give,
+    // both with and without the delta columns
+    const std::string filename = "data/input/current_cost/10July.csv";
+    AggregateData indexed;
+    indexed.loadCurrentCostData( filename, false );
+
+    AggregateData scanned;
+    scanned.openCurrentCostStream( filename );
+    scanned.streamSamplesUntil( (size_t)-1 );
+
+    const AggregateData * aggDatas[] = { &indexed, &scanned };
+    const size_t first = indexed[0].timestamp;
+    const double means[] = { 245, -245, 2000, -2000, 30 };
+
+    // Overlapping, nested and disjoint windows
+    std::vector<Statistic<Sample_t> > stats;
+    std::vector<AggregateData::SpikeQuery> queries;
+    srand( 42 );
+    for (size_t q=0; q<20; q++) {
+        stats.push_back( Statistic<Sample_t>( means[q % 5] ) );
+        const size_t start = first + (rand() % 40000);
+        queries.push_back( AggregateData::SpikeQuery(
+                AggregateData::SpikeSearch( stats.back() ), start, start + 1 + (rand() % 5000) ) );
+    }
+
+    for (size_t a=0; a<2; a++) {
+        std::vector< std::list<AggregateData::FoundSpike> > results;
+        aggDatas[a]->findSpikes( queries, &results );
+        BOOST_REQUIRE_EQUAL( results.size(), queries.size() );
+
+        for (size_t q=0; q<queries.size(); q++) {
+            std::list<AggregateData::FoundSpike> expected =
+                    aggDatas[a]->findSpike( stats[q], queries[q].startTime, queries[q].endTime );
+            BOOST_REQUIRE_EQUAL( results[q].size(), expected.size() );
+            std::list<AggregateData::FoundSpike>::const_iterator e = expected.begin();
+            for (std::list<AggregateData::FoundSpike>::const_iterator r=results[q].begin(); r!=results[q].end(); r++, e++) {
+                BOOST_CHECK_EQUAL( r->timestamp, e->timestamp );
+                BOOST_CHECK_EQUAL( r->delta, e->delta );
+                BOOST_CHECK_EQUAL( r->likelihood, e->likelihood );
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( tabulatedSpikes )
+{
+    // Looking windows up in a findAllSpikes() table must give exactly
+    // what findSpike() gives for the same window
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+    BOOST_REQUIRE( aggData.canTabulateSpikes() );
+
+    AggregateData streamed;
+    streamed.openCurrentCostStream( "data/input/current_cost/10July.csv" );
+    BOOST_CHECK( ! streamed.canTabulateSpikes() );
+
+    const size_t first = aggData[0].timestamp;
+    const double means[] = { 245, -245, 2000, -2000, 30 };
+
+    size_t totalFound = 0;
+    srand( 42 );
+    for (size_t m=0; m<5; m++) {
+        const Statistic<Sample_t> stats( means[m] );
+        AggregateData::SpikeTable table;
+        aggData.findAllSpikes( AggregateData::SpikeSearch( stats ), &table );
+
+        for (size_t w=0; w<20; w++) {
+            // include windows which start between samples and before the data
+            const size_t start = (w == 0) ? first - 10 : first + (rand() % 40000);
+            const size_t end   = start + 1 + (rand() % 5000);
+
+            std::vector<AggregateData::FoundSpike> found;
+            aggData.findSpikes( table, start, end, &found );
+            const std::list<AggregateData::FoundSpike> expected = aggData.findSpike( stats, start, end );
+
+            BOOST_REQUIRE_EQUAL( found.size(), expected.size() );
+            totalFound += found.size();
+            std::list<AggregateData::FoundSpike>::const_iterator e = expected.begin();
+            for (size_t f=0; f<found.size(); f++, e++) {
+                BOOST_CHECK_EQUAL( found[f].timestamp, e->timestamp );
+                BOOST_CHECK_EQUAL( found[f].delta, e->delta );
+                BOOST_CHECK_EQUAL( found[f].likelihood, e->likelihood );
+            }
+        }
+    }
+
+    BOOST_CHECK_GT( totalFound, 0 );
+}
@@ -0,0 +1,136 @@
+#define BOOST_TEST_MODULE AggregateDataset AggregateDatasetTest
+#define BOOST_TEST_DYN_LINK
+#define GOOGLE_STRIP_LOG 4
+#include "../src/AggregateDataset.h"
+#include "../src/AggregateData.h"
+#include "../src/PowerStateGraph.h"
+#include "../src/Signature.h"
+#include "../src/Statistic.h"
+#include <boost/test/unit_test.hpp>
+#include <iostream>
+#include <fstream>
+#include <list>
+#include <vector>
+#include <cstdio>
+#include <sys/stat.h>
+
+const std::string DATASET_PATH = DATA_OUTPUT_PATH + "datasetTest/";
+const size_t NUM_FILES = 4;
+
+/**
+ * Split @c full into @c numFiles "daily" files.
+ */
+void writeDataset( const AggregateData& full, const size_t numFiles = NUM_FILES )
+{
+    mkdir( DATASET_PATH.c_str(), 0755 );
+
+    const size_t perFile = full.getSize() / numFiles + 1;
+    for (size_t f=0; f<numFiles; f++) {
+        std::ofstream out( (DATASET_PATH + "day" + Utils::size_t_to_s(f) + ".csv").c_str() );
+        out << "timestamp\treading\n"; // header line should be skipped
+        for (size_t i=f*perFile; i<(f+1)*perFile && i<full.getSize(); i++) {
+            out << full[i].timestamp << "\t" << full[i].reading << "\n";
+        }
+    }
+}
+
+void removeDataset( const size_t numFiles = NUM_FILES )
+{
+    for (size_t f=0; f<numFiles; f++) {
+        remove( (DATASET_PATH + "day" + Utils::size_t_to_s(f) + ".csv").c_str() );
+    }
+    rmdir( DATASET_PATH.c_str() );
+}
+
+/**
+ * Removes the dataset when the test case ends, even if a
+ * BOOST_REQUIRE failed part way through it.
+ */
+struct DatasetFixture {
+    size_t numFiles; /**< @brief number of files the test case wrote */
+    DatasetFixture() : numFiles( NUM_FILES ) {}
+    ~DatasetFixture() { removeDataset( numFiles ); }
+};
+
+BOOST_FIXTURE_TEST_CASE( indexAndLazyLoading, DatasetFixture )
+{
+    AggregateData full;
+    full.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+    writeDataset( full );
+
+    AggregateDataset dataset;
+    BOOST_CHECK( AggregateDataset::isDataset( DATASET_PATH ) );
+    BOOST_CHECK( AggregateDataset::isDataset( DATASET_PATH + "day*.csv" ) );
+    BOOST_CHECK( ! AggregateDataset::isDataset( "data/input/current_cost/10July.csv" ) );
+
+    dataset.open( DATASET_PATH + "day*.csv" );
+    BOOST_REQUIRE_EQUAL( dataset.getNumFiles(), NUM_FILES );
+    BOOST_CHECK_EQUAL( dataset.getFile(0).firstTimestamp, full[0].timestamp );
+    BOOST_CHECK_EQUAL( dataset.getFile(NUM_FILES-1).lastTimestamp, full[full.getSize()-1].timestamp );
+    BOOST_CHECK_EQUAL( dataset.getNumFilesLoaded(), 0 );
+
+    // A window in the middle of the second file should only load that file
+    // and the first sample of the third file
+    const size_t t0 = dataset.getFile(1).firstTimestamp + 600;
+    const size_t t1 = dataset.getFile(1).firstTimestamp + 1200;
+    const AggregateData& window = dataset.loadWindow( t0, t1 );
+    BOOST_CHECK_EQUAL( dataset.getNumFilesLoaded(), 1 );
+    BOOST_CHECK_EQUAL( window[ window.findTime(t0) ].timestamp, full[ full.findTime(t0) ].timestamp );
+
+    // Searching the whole dataset gives the same spikes as the concatenated file
+    Statistic<Sample_t> stats;
+    stats.update( 1000 );
+    stats.update( 2000 );
+    std::list<AggregateData::FoundSpike> expected = full.findSpike( stats );
+    std::list<AggregateData::FoundSpike> found;
+    for (size_t f=0; f<NUM_FILES; f++) {
+        const size_t scanFrom = dataset.getFile(f).firstTimestamp;
+        const size_t scanTo   = (f+1 < NUM_FILES) ? dataset.getFile(f+1).firstTimestamp
+                                                  : dataset.getFile(f).lastTimestamp;
+        std::list<AggregateData::FoundSpike> spikes = dataset.findSpike( stats, scanFrom, scanTo );
+        found.splice( found.end(), spikes );
+    }
+
+    BOOST_REQUIRE_EQUAL( found.size(), expected.size() );
+    std::list<AggregateData::FoundSpike>::const_iterator e = expected.begin();
+    for (std::list<AggregateData::FoundSpike>::const_iterator f=found.begin(); f!=found.end(); f++, e++) {
+        BOOST_CHECK_EQUAL( f->timestamp, e->timestamp );
+        BOOST_CHECK_EQUAL( f->delta, e->delta );
+    }
+
+    // The window should never have held the whole dataset at once
+    BOOST_CHECK_LT( dataset.getWindow().getSize(), full.getSize() );
+}
+
+BOOST_FIXTURE_TEST_CASE( disaggregateMatchesConcatenatedFile, DatasetFixture )
+{
+    // earlyAugust is long enough for traces to run across file boundaries
+    AggregateData full;
+    full.loadCurrentCostData( "data/input/current_cost/earlyAugust.csv", false );
+    numFiles = 7;
+    writeDataset( full, numFiles );
+
+    PowerStateGraph psg;
+    const char * filenames[] = {"washer.csv", "washer2.csv", "washer3.csv", "washer4.csv", "washer5.csv"};
+    for (size_t i=0; i<5; i++) {
+        Signature sig( std::string("data/input/watts_up/") + filenames[i], 1, "washer", i );
+        psg.update( sig );
+    }
+    psg.setDeviceName( "washer" );
+
+    const std::list<PowerStateGraph::Fingerprint> expected = psg.disaggregate( full );
+
+    AggregateDataset dataset;
+    dataset.open( DATASET_PATH + "day*.csv" );
+    BOOST_REQUIRE_EQUAL( dataset.getNumFiles(), numFiles );
+    const std::list<PowerStateGraph::Fingerprint> found = psg.disaggregate( &dataset );
+
+    BOOST_CHECK( ! expected.empty() );
+    BOOST_REQUIRE_EQUAL( found.size(), expected.size() );
+    std::list<PowerStateGraph::Fingerprint>::const_iterator e = expected.begin();
+    for (std::list<PowerStateGraph::Fingerprint>::const_iterator f=found.begin(); f!=found.end(); f++, e++) {
+        BOOST_CHECK_EQUAL( f->timestamp, e->timestamp );
+        BOOST_CHECK_EQUAL( f->duration, e->duration );
+        BOOST_CHECK_EQUAL( f->avLikelihood, e->avLikelihood );
+    }
+}
@@ -0,0 +1,97 @@
+#define BOOST_TEST_MODULE ArenaTree test
+#define BOOST_TEST_DYN_LINK
+#include "../src/ArenaTree.h"
+#include <boost/test/unit_test.hpp>
+#include <sstream>
+#include <cstdlib> // malloc(), free()
+#include <new>
+
+typedef ArenaTree<int> Tree;
+
+/**
+ * Every heap allocation made by this test goes through here so that
+ * getNumGrowths() can be checked against the real number.
+ */
+static size_t heapAllocations = 0;
+
+void * operator new( std::size_t size )
+{
+    heapAllocations++;
+    void * p = std::malloc( size ? size : 1 );
+    if ( ! p )
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete( void * p ) noexcept
+{
+    std::free( p );
+}
+
+struct NoOpWriter {
+    void operator()( std::ostream&, const size_t ) const {}
+};
+
+/**
+ * Build 0 -> {1, 2}, 1 -> {3}, 2 -> {3} and return the number of vertices.
+ */
+size_t buildDiamond( Tree * tree )
+{
+    for (int i=0; i<4; i++) {
+        (*tree)[ tree->addVertex() ] = i * 10;
+    }
+    tree->addEdge( 0, 1, 0.1 );
+    tree->addEdge( 0, 2, 0.2 );
+    tree->addEdge( 1, 3, 0.3 );
+    tree->addEdge( 2, 3, 0.4 );
+    return tree->getNumVertices();
+}
+
+BOOST_AUTO_TEST_CASE( outEdgesAndParents )
+{
+    Tree tree;
+    BOOST_CHECK_EQUAL( buildDiamond( &tree ), 4 );
+    BOOST_CHECK_EQUAL( tree.getNumEdges(), 4 );
+    BOOST_CHECK_EQUAL( tree[2], 20 );
+
+    // out-edges are visited in the order they were added
+    Tree::edge_descriptor e = tree.firstOutEdge( 0 );
+    BOOST_CHECK_EQUAL( tree.target( e ), 1 );
+    BOOST_CHECK_CLOSE( tree.likelihood( e ), 0.1, 1e-9 );
+    e = tree.nextOutEdge( e );
+    BOOST_CHECK_EQUAL( tree.target( e ), 2 );
+    BOOST_CHECK_EQUAL( tree.nextOutEdge( e ), Tree::NONE );
+    BOOST_CHECK_EQUAL( tree.firstOutEdge( 3 ), Tree::NONE );
+
+    // the first edge into a vertex sets its parent
+    BOOST_CHECK_EQUAL( tree.parent( 0 ), Tree::NONE );
+    BOOST_CHECK_EQUAL( tree.parent( 2 ), 0 );
+    BOOST_CHECK_EQUAL( tree.parent( 3 ), 1 );
+
+    std::ostringstream graphViz;
+    tree.writeGraphViz( graphViz, NoOpWriter(), NoOpWriter() );
+    BOOST_CHECK( graphViz.str().find( "2->3" ) != std::string::npos );
+}
+
+BOOST_AUTO_TEST_CASE( clearReusesMemory )
+{
+    Tree tree;
+    size_t before = heapAllocations;
+    buildDiamond( &tree );
+    const size_t growths = tree.getNumGrowths();
+    BOOST_CHECK_GT( growths, 0 );
+    BOOST_CHECK_EQUAL( heapAllocations - before, growths );
+
+    // nothing in the loop may allocate so the checks come afterwards
+    before = heapAllocations;
+    size_t verticesBuilt = 0;
+    for (int i=0; i<10; i++) {
+        tree.clear();
+        verticesBuilt += tree.getNumVertices();
+        verticesBuilt += buildDiamond( &tree );
+    }
+    const size_t rebuildAllocations = heapAllocations - before;
+    BOOST_CHECK_EQUAL( verticesBuilt, 40 );
+    BOOST_CHECK_EQUAL( tree.getNumGrowths(), growths );
+    BOOST_CHECK_EQUAL( rebuildAllocations, 0 );
+}
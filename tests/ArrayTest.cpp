@@ -6,6 +6,13 @@
 #include <boost/test/unit_test.hpp>
 #include <iostream>
 #include <list>
+#include <fstream>
+#include <cstdlib>
+
+static void parseDouble(const char * begin, const char * end, double * value)
+{
+    *value = strtod( std::string( begin, end ).c_str(), 0 );
+}
 
 template <class T>
 void checkWrite(Array<T>& a)
@@ -343,3 +350,38 @@ BOOST_AUTO_TEST_CASE( rollingAvsize_tsize_t2 )
         BOOST_CHECK_CLOSE(arrayTestSrc.rollingAv(i, 9), answers2[i], 0.001);
     }
 }
+
+BOOST_AUTO_TEST_CASE( loadDataFromFilename )
+{
+    // Compare the memory-mapped loader against the iostreams loader
+    const std::string filename = SIG_DATA_PATH + "washer.csv";
+
+    std::fstream fs( filename.c_str(), std::fstream::in );
+    Array<Sample_t> reference;
+    reference.loadData( fs );
+    fs.close();
+
+    Array<Sample_t> a;
+    a.loadData( filename );
+    BOOST_CHECK( a == reference );
+}
+
+BOOST_AUTO_TEST_CASE( lineChunks )
+{
+    // Lines which do not start with a digit must be skipped,
+    // and the last line may not end with a newline.
+    const std::string text = "header\n1\n2\n\n3.5\n#comment\n4\n5\n6\n7\n8\n9\n10";
+    const double expected[] = {1, 2, 3.5, 4, 5, 6, 7, 8, 9, 10};
+
+    for (size_t maxChunks=1; maxChunks<=8; maxChunks++) {
+        Parallel::LineChunks chunks( text.c_str(), text.size(), maxChunks, 1 );
+        BOOST_CHECK_LE( chunks.getNumChunks(), maxChunks );
+        BOOST_REQUIRE_EQUAL( chunks.getNumDataLines(), 10 );
+
+        double values[10];
+        chunks.parseInto( values, parseDouble );
+        for (size_t i=0; i<10; i++) {
+            BOOST_CHECK_EQUAL( values[i], expected[i] );
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#define BOOST_TEST_MODULE BeamSearch BeamSearchBenchmark
+#define BOOST_TEST_DYN_LINK
+#define GOOGLE_STRIP_LOG 4
+#include "../src/PowerStateGraph.h"
+#include <boost/test/unit_test.hpp>
+#include <iostream>
+#include <sstream>
+
+/**
+ * Train @c psg on all five washer signatures, as "disaggregate -n washer
+ * -s washer.csv ... -s washer5.csv" would.
+ */
+void trainWasher( PowerStateGraph * psg )
+{
+    const char * filenames[] = {"washer.csv", "washer2.csv", "washer3.csv", "washer4.csv", "washer5.csv"};
+    for (size_t i=0; i<5; i++) {
+        Signature sig( std::string("data/input/watts_up/") + filenames[i], 1, "washer", i );
+        psg->update( sig );
+    }
+    psg->setDeviceName( "washer" );
+}
+
+/**
+ * @return the fraction of @c reference fingerprints which have a
+ *         fingerprint in @c found starting within @c tolerance seconds.
+ */
+double recall(
+        const std::list<PowerStateGraph::Fingerprint>& reference,
+        const std::list<PowerStateGraph::Fingerprint>& found,
+        const size_t tolerance = 300
+        )
+{
+    if ( reference.empty() )
+        return 1;
+
+    size_t matched = 0;
+    std::list<PowerStateGraph::Fingerprint>::const_iterator r, f;
+    for (r=reference.begin(); r!=reference.end(); r++) {
+        for (f=found.begin(); f!=found.end(); f++) {
+            if ( (r->timestamp > f->timestamp ? r->timestamp - f->timestamp
+                                              : f->timestamp - r->timestamp) <= tolerance ) {
+                matched++;
+                break;
+            }
+        }
+    }
+    return (double)matched / reference.size();
+}
+
+/**
+ * Accuracy of the beam search against the exhaustive search as the beam
+ * width grows, and the time each takes.
+ */
+BOOST_AUTO_TEST_CASE( beamSearchAccuracyVsRuntime )
+{
+    std::cout << "beamSearchAccuracyVsRuntime..." << std::endl;
+
+    PowerStateGraph psg;
+    trainWasher( &psg );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/earlyAugust.csv", false );
+
+    double start = Utils::secondsSince( 0 );
+    const std::list<PowerStateGraph::Fingerprint> exhaustive = psg.disaggregate( aggData );
+    const double exhaustiveSeconds = Utils::secondsSince( start );
+
+    std::ostringstream table;
+    table << "   exhaustive   \t" << exhaustiveSeconds << "s\trecall=1" << std::endl;
+
+    const size_t widths[] = {1, 2, 4, 8, 16, 32};
+    for (size_t w=0; w<sizeof(widths)/sizeof(widths[0]); w++) {
+        psg.setBeamSearch( widths[w] );
+        start = Utils::secondsSince( 0 );
+        const std::list<PowerStateGraph::Fingerprint> beam = psg.disaggregate( aggData );
+        const double beamSeconds = Utils::secondsSince( start );
+
+        table << "   beam width " << widths[w] << "\t" << beamSeconds << "s\trecall="
+              << recall( exhaustive, beam ) << std::endl;
+    }
+
+    std::cout << std::endl << "Beam search accuracy vs runtime (earlyAugust.csv, washer):" << std::endl
+              << table.str();
+
+    BOOST_CHECK( ! exhaustive.empty() );
+}
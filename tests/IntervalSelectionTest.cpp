@@ -0,0 +1,171 @@
+#define BOOST_TEST_MODULE IntervalSelection test
+#define BOOST_TEST_DYN_LINK
+#include "../src/IntervalSelection.h"
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <cstdlib>
+#include <algorithm> // sort()
+
+using namespace IntervalSelection;
+
+/**
+ * @return the maximum number of selected intervals covering any time,
+ *         and their total weight in @c weight.
+ */
+size_t maxDepth(
+        const std::vector<Interval>& intervals,
+        const std::vector<bool>& selected,
+        double * weight
+        )
+{
+    size_t depth = 0;
+    *weight = 0;
+    for (size_t i=0; i<intervals.size(); i++) {
+        if (!selected[i])
+            continue;
+        *weight += intervals[i].weight;
+        for (size_t t=intervals[i].start; t<=intervals[i].end; t++) {
+            size_t d = 0;
+            for (size_t j=0; j<intervals.size(); j++) {
+                if (selected[j] && intervals[j].start <= t && t <= intervals[j].end)
+                    d++;
+            }
+            if (d > depth)
+                depth = d;
+        }
+    }
+    return depth;
+}
+
+/**
+ * @return the heaviest total weight of any subset of @c intervals
+ *         in which at most @c maxOverlap overlap, by trying them all.
+ */
+double bruteForce(
+        const std::vector<Interval>& intervals,
+        const size_t maxOverlap
+        )
+{
+    double best = 0;
+    std::vector<bool> subset( intervals.size() );
+    for (size_t mask=0; mask < ((size_t)1 << intervals.size()); mask++) {
+        for (size_t i=0; i<intervals.size(); i++) {
+            subset[i] = (mask >> i) & 1;
+        }
+        double weight;
+        if (maxDepth( intervals, subset, &weight ) <= maxOverlap && weight > best)
+            best = weight;
+    }
+    return best;
+}
+
+BOOST_AUTO_TEST_CASE( compareWithBruteForce )
+{
+    srand( 42 );
+    for (size_t trial=0; trial<200; trial++) {
+        std::vector<Interval> intervals;
+        const size_t n = 1 + rand() % 10;
+        for (size_t i=0; i<n; i++) {
+            const size_t start = rand() % 30;
+            intervals.push_back( Interval( start, start + rand() % 10, (rand() % 100) / 10.0 ) );
+        }
+
+        for (size_t maxOverlap=1; maxOverlap<=3; maxOverlap++) {
+            std::vector<bool> selected;
+            select( intervals, maxOverlap, &selected );
+            BOOST_REQUIRE_EQUAL( selected.size(), n );
+
+            double weight;
+            BOOST_CHECK( maxDepth( intervals, selected, &weight ) <= maxOverlap );
+            BOOST_CHECK_CLOSE( weight + 1, bruteForce( intervals, maxOverlap ) + 1, 1e-9 );
+
+            if (maxOverlap == 1) {
+                // the general algorithm must find an equally good selection
+                selectWithMaxOverlap( intervals, 1, &selected );
+                BOOST_CHECK( maxDepth( intervals, selected, &weight ) <= 1 );
+                BOOST_CHECK_CLOSE( weight + 1, bruteForce( intervals, 1 ) + 1, 1e-9 );
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( touchingIntervalsOverlap )
+{
+    // Intervals include their end time, so [0,5] and [5,9] overlap
+    std::vector<Interval> intervals;
+    intervals.push_back( Interval( 0, 5, 1.0 ) );
+    intervals.push_back( Interval( 5, 9, 2.0 ) );
+    intervals.push_back( Interval( 10, 12, 0.5 ) );
+
+    std::vector<bool> selected;
+    select( intervals, 1, &selected );
+    BOOST_CHECK( !selected[0] );
+    BOOST_CHECK( selected[1] );
+    BOOST_CHECK( selected[2] );
+
+    select( intervals, 2, &selected );
+    BOOST_CHECK( selected[0] && selected[1] && selected[2] );
+}
+
+BOOST_AUTO_TEST_CASE( beatsGreedy )
+{
+    // Greedily keeping the heaviest of each overlapping pair keeps only
+    // the middle interval, but the two outer ones weigh more together.
+    std::vector<Interval> intervals;
+    intervals.push_back( Interval( 0, 10, 0.6 ) );
+    intervals.push_back( Interval( 8, 22, 0.9 ) );
+    intervals.push_back( Interval( 20, 30, 0.6 ) );
+
+    std::vector<bool> selected;
+    select( intervals, 1, &selected );
+    BOOST_CHECK( selected[0] );
+    BOOST_CHECK( !selected[1] );
+    BOOST_CHECK( selected[2] );
+}
+
+BOOST_AUTO_TEST_CASE( nonPositiveWeightsAreNeverSelected )
+{
+    std::vector<Interval> intervals;
+    intervals.push_back( Interval( 0, 5, 0.0 ) );
+    intervals.push_back( Interval( 10, 15, -1.0 ) );
+
+    std::vector<bool> selected;
+    for (size_t maxOverlap=1; maxOverlap<=2; maxOverlap++) {
+        select( intervals, maxOverlap, &selected );
+        BOOST_CHECK( !selected[0] && !selected[1] );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( manyCandidates )
+{
+    // Plenty of candidates, most of which overlap others
+    srand( 7 );
+    std::vector<Interval> intervals;
+    for (size_t i=0; i<100000; i++) {
+        const size_t start = rand() % 3000000;
+        intervals.push_back( Interval( start, start + 50 + rand() % 500, (rand() % 1000) / 1000.0 ) );
+    }
+
+    std::vector<bool> selected;
+    for (size_t maxOverlap=1; maxOverlap<=2; maxOverlap++) {
+        select( intervals, maxOverlap, &selected );
+
+        // sweep over the start and end points to check the overlap
+        std::vector< std::pair<size_t, int> > events;
+        for (size_t i=0; i<intervals.size(); i++) {
+            if (selected[i]) {
+                events.push_back( std::make_pair( intervals[i].start, 1 ) );
+                events.push_back( std::make_pair( intervals[i].end + 1, -1 ) );
+            }
+        }
+        std::sort( events.begin(), events.end() ); // ends sort before starts at the same time
+        int depth = 0, deepest = 0;
+        for (size_t e=0; e<events.size(); e++) {
+            depth += events[e].second;
+            if (depth > deepest)
+                deepest = depth;
+        }
+        BOOST_CHECK( !events.empty() );
+        BOOST_CHECK( deepest <= (int)maxOverlap );
+    }
+}
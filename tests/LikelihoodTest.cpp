@@ -0,0 +1,113 @@
+#define BOOST_TEST_MODULE Likelihood test
+#define BOOST_TEST_DYN_LINK
+#include "../src/Likelihood.h"
+#include <boost/test/unit_test.hpp>
+#include <boost/math/distributions/students_t.hpp>
+#include <boost/math/distributions/normal.hpp>
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+
+BOOST_AUTO_TEST_CASE( normalisedGaussianMatchesBoost )
+{
+    const double means[]  = { 0, 3, -245, 2000, 86400 };
+    const double stdevs[] = { 0.1, 7, 24.5, 117.6, 3600 };
+
+    for (size_t m=0; m<sizeof(means)/sizeof(double); m++) {
+        boost::math::normal dist( means[m], stdevs[m] );
+        const double pdfAtMean = boost::math::pdf( dist, means[m] );
+
+        std::vector<double> x;
+        for (double z=-40; z<=40; z+=0.013) {
+            x.push_back( means[m] + z * stdevs[m] );
+        }
+        std::vector<double> batch( x.size() );
+        Likelihood::normalisedGaussian( &x[0], x.size(), means[m], stdevs[m], &batch[0] );
+
+        double maxRelativeError = 0;
+        for (size_t i=0; i<x.size(); i++) {
+            const double expected = boost::math::pdf( dist, x[i] ) / pdfAtMean;
+            const double single = Likelihood::normalisedGaussian( x[i], means[m], stdevs[m] );
+            BOOST_CHECK_EQUAL( batch[i], single );
+            if ( expected > 1e-300 )
+                maxRelativeError = std::max( maxRelativeError, fabs( single - expected ) / expected );
+        }
+        BOOST_CHECK_SMALL( maxRelativeError, 1e-12 );
+        BOOST_CHECK_EQUAL( Likelihood::normalisedGaussian( means[m], means[m], stdevs[m] ), 1.0 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( studentTMatchesBoost )
+{
+    // Welch's degrees of freedom are rarely whole numbers
+    const double degreesOfFreedom[] = { 0.3, 1, 1.5, 2, 2.5, 4, 7.3, 10, 30, 99.5, 300, 5000, 1e5, 1e6 };
+
+    for (size_t d=0; d<sizeof(degreesOfFreedom)/sizeof(double); d++) {
+        const double v = degreesOfFreedom[d];
+        boost::math::students_t dist( v );
+
+        std::vector<double> t;
+        for (double x=-60; x<=60; x+=0.0173) {
+            t.push_back( x );
+        }
+        t.push_back( 0 );
+        t.push_back( 1e10 );
+        std::vector<double> batch( t.size() );
+        Likelihood::studentTUpperTail( &t[0], t.size(), v, &batch[0] );
+
+        double maxError = 0;
+        for (size_t i=0; i<t.size(); i++) {
+            const double expected = boost::math::cdf( boost::math::complement( dist, t[i] ) );
+            const double cached = Likelihood::studentTUpperTail( t[i], v );
+            BOOST_CHECK_EQUAL( cached, batch[i] );
+            maxError = std::max( maxError, fabs( cached - expected ) );
+        }
+        BOOST_CHECK_SMALL( maxError, 1e-11 );
+    }
+
+    BOOST_CHECK_EQUAL( Likelihood::studentTUpperTail( 0, 3.7 ), 0.5 );
+}
+
+BOOST_AUTO_TEST_CASE( invalidParametersThrowLikeBoost )
+{
+    // e.g. Statistic::nonZeroStdev() is 0 when the mean is 0 and the stdev < 1
+    double x = 1, likelihood;
+    BOOST_CHECK_THROW( boost::math::normal( 0, 0 ), std::domain_error );
+    BOOST_CHECK_THROW( Likelihood::normalisedGaussian( x, 0, 0 ), std::domain_error );
+    BOOST_CHECK_THROW( Likelihood::normalisedGaussian( &x, 1, 0, 0, &likelihood ), std::domain_error );
+    BOOST_CHECK_THROW( Likelihood::normalisedGaussian( x, 0, NAN ), std::domain_error );
+
+    // Welch's degrees of freedom are 0/0 when both stdevs are 0
+    BOOST_CHECK_THROW( boost::math::students_t( NAN ), std::domain_error );
+    BOOST_CHECK_THROW( Likelihood::studentTUpperTail( x, NAN ), std::domain_error );
+    BOOST_CHECK_THROW( Likelihood::studentTUpperTail( &x, 1, 0, &likelihood ), std::domain_error );
+    BOOST_CHECK_THROW( Likelihood::StudentT( -1 ), std::domain_error );
+}
+
+BOOST_AUTO_TEST_CASE( studentTRelativeErrorInTheTail )
+{
+    // small tail probabilities are what the t-test compares with alpha
+    const double degreesOfFreedom[] = { 1, 3.2, 12, 150 };
+    for (size_t d=0; d<sizeof(degreesOfFreedom)/sizeof(double); d++) {
+        boost::math::students_t dist( degreesOfFreedom[d] );
+        for (double t=1; t<1e4; t*=1.7) {
+            const double expected = boost::math::cdf( boost::math::complement( dist, t ) );
+            if ( expected < 1e-300 )
+                break;
+            BOOST_CHECK_CLOSE( Likelihood::studentTUpperTail( t, degreesOfFreedom[d] ), expected, 1e-9 );
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( studentTCache )
+{
+    // Interleave more distinct degrees of freedom than the cache has
+    // slots; every answer must still be for the right distribution.
+    for (size_t pass=0; pass<3; pass++) {
+        for (size_t i=0; i<200; i++) {
+            const double v = 1 + i * 0.37;
+            const Likelihood::StudentT dist( v );
+            BOOST_CHECK_EQUAL( Likelihood::studentTUpperTail( 1.5, v ), dist.upperTail( 1.5 ) );
+        }
+    }
+}
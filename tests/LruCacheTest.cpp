@@ -0,0 +1,38 @@
+#define BOOST_TEST_MODULE LruCache test
+#define BOOST_TEST_DYN_LINK
+#include "../src/LruCache.h"
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+BOOST_AUTO_TEST_CASE( evictsLeastRecentlyUsed )
+{
+    LruCache<int, std::string> cache( 2 );
+
+    BOOST_CHECK( cache.find( 1 ) == 0 );
+    cache.insert( 1, "one" );
+    cache.insert( 2, "two" );
+    BOOST_CHECK_EQUAL( cache.size(), 2 );
+
+    // Touch 1 so that 2 is the least recently used
+    BOOST_REQUIRE( cache.find( 1 ) != 0 );
+    BOOST_CHECK_EQUAL( *cache.find( 1 ), "one" );
+
+    cache.insert( 3, "three" );
+    BOOST_CHECK_EQUAL( cache.size(), 2 );
+    BOOST_CHECK( cache.find( 2 ) == 0 );
+    BOOST_CHECK( cache.find( 1 ) != 0 );
+    BOOST_CHECK( cache.find( 3 ) != 0 );
+
+    BOOST_CHECK_EQUAL( cache.getHits(), 4 );
+    BOOST_CHECK_EQUAL( cache.getMisses(), 2 );
+    BOOST_CHECK_EQUAL( cache.getEvictions(), 1 );
+}
+
+BOOST_AUTO_TEST_CASE( zeroCapacityDisablesCache )
+{
+    LruCache<int, int> cache( 0 );
+    BOOST_CHECK( cache.insert( 1, 10 ) == 0 );
+    BOOST_CHECK( cache.find( 1 ) == 0 );
+    BOOST_CHECK_EQUAL( cache.size(), 0 );
+    BOOST_CHECK_EQUAL( cache.getMisses(), 1 );
+}
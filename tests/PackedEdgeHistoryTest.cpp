@@ -0,0 +1,97 @@
+#define BOOST_TEST_MODULE PackedEdgeHistory test
+#define BOOST_TEST_DYN_LINK
+#include "../src/PackedEdgeHistory.h"
+#include <boost/test/unit_test.hpp>
+#include <cstdlib>
+#include <deque>
+#include <utility>
+#include <sstream>
+
+typedef std::deque< std::pair<size_t, size_t> > Reference;
+
+/**
+ * The comparison PowerStateGraph used to do edge by edge.
+ */
+bool referenceMatches( const Reference& a, const Reference& b )
+{
+    if ( a.size() != b.size() )
+        return false;
+    for (size_t i=0; i<a.size(); i++) {
+        if ( a[i].first != b[i].first && a[i].second != b[i].second )
+            return false;
+    }
+    return true;
+}
+
+template <size_t N>
+void pushBoth( PackedEdgeHistory<N> * packed, Reference * reference, const size_t s, const size_t t )
+{
+    packed->push_back( s, t );
+    reference->push_back( std::make_pair( s, t ) );
+    if ( reference->size() > N )
+        reference->pop_front();
+}
+
+BOOST_AUTO_TEST_CASE( forgetsOldestEdge )
+{
+    PackedEdgeHistory<5> history;
+    BOOST_CHECK_EQUAL( history.size(), 0 );
+
+    for (size_t i=0; i<7; i++) {
+        history.push_back( i, i+1 );
+    }
+    BOOST_REQUIRE_EQUAL( history.size(), 5 );
+    BOOST_CHECK_EQUAL( history.source(0), 2 );
+    BOOST_CHECK_EQUAL( history.target(0), 3 );
+    BOOST_CHECK_EQUAL( history.source(4), 6 );
+    BOOST_CHECK_EQUAL( history.target(4), 7 );
+
+    std::ostringstream out;
+    out << history;
+    BOOST_CHECK_EQUAL( out.str(), "(2,3)(3,4)(4,5)(5,6)(6,7)" );
+
+    // Same edges pushed from a different start give an equal history
+    PackedEdgeHistory<5> other;
+    other.push_back( 255, 255 );
+    for (size_t i=2; i<7; i++) {
+        other.push_back( i, i+1 );
+    }
+    BOOST_CHECK( history == other );
+    BOOST_CHECK_EQUAL( history.hash(), other.hash() );
+    BOOST_CHECK( !(history < other) && !(other < history) );
+}
+
+BOOST_AUTO_TEST_CASE( matchesAgreesWithEdgeByEdgeComparison )
+{
+    srand( 42 );
+    for (size_t trial=0; trial<10000; trial++) {
+        PackedEdgeHistory<5> a, b;
+        Reference refA, refB;
+
+        // small vertex indices so that near misses are common
+        const size_t lengthA = rand() % 8, lengthB = rand() % 8;
+        for (size_t i=0; i<lengthA; i++) {
+            pushBoth( &a, &refA, rand() % 3, rand() % 3 );
+        }
+        for (size_t i=0; i<lengthB; i++) {
+            pushBoth( &b, &refB, rand() % 3, rand() % 3 );
+        }
+
+        BOOST_REQUIRE_EQUAL( a.matches( b ), referenceMatches( refA, refB ) );
+        BOOST_REQUIRE_EQUAL( a == b, refA == refB );
+    }
+
+    // Both bytes of a lane differ, but only in their high bits
+    PackedEdgeHistory<5> a, b;
+    a.push_back( 0x80, 0x80 );
+    b.push_back( 0x00, 0x00 );
+    BOOST_CHECK( ! a.matches( b ) );
+}
+
+BOOST_AUTO_TEST_CASE( disabledHistoryAlwaysMatches )
+{
+    PackedEdgeHistory<0> a, b;
+    a.push_back( 1, 2 );
+    BOOST_CHECK_EQUAL( a.size(), 0 );
+    BOOST_CHECK( a.matches( b ) );
+}
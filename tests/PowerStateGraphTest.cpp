@@ -2,10 +2,18 @@
 #define BOOST_TEST_DYN_LINK
 #define GOOGLE_STRIP_LOG 4
 #include "../src/PowerStateGraph.h"
+#include "../src/OnlineDisaggregator.h"
 #include "../src/Statistic.h"
 #include "../src/Array.h"
 #include <boost/test/unit_test.hpp>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <cstdio>   // remove(), sscanf()
+#include <cstdlib>  // mkdtemp()
+#include <unistd.h> // rmdir()
+#include <algorithm> // std::min()
 
 BOOST_AUTO_TEST_CASE( constructorTest )
 {
@@ -31,3 +39,347 @@ BOOST_AUTO_TEST_CASE( updateTest )
         std::cout << psg << std::endl;
         psg.writeGraphViz( std::cout );
 }
+
+/**
+ * Train @c psg on all five washer signatures, as "disaggregate -n washer
+ * -s washer.csv ... -s washer5.csv" would.
+ */
+void trainWasher( PowerStateGraph * psg )
+{
+    const char * filenames[] = {"washer.csv", "washer2.csv", "washer3.csv", "washer4.csv", "washer5.csv"};
+    for (size_t i=0; i<5; i++) {
+        Signature sig( std::string("data/input/watts_up/") + filenames[i], 1, "washer", i );
+        psg->update( sig );
+    }
+    psg->setDeviceName( "washer" );
+}
+
+/**
+ * Check that @c a and @c b hold the same fingerprints in the same order.
+ */
+void checkSameFingerprints(
+        const std::list<PowerStateGraph::Fingerprint>& a,
+        const std::list<PowerStateGraph::Fingerprint>& b
+        )
+{
+    BOOST_REQUIRE_EQUAL( a.size(), b.size() );
+    std::list<PowerStateGraph::Fingerprint>::const_iterator ai = a.begin();
+    std::list<PowerStateGraph::Fingerprint>::const_iterator bi = b.begin();
+    for (; ai!=a.end(); ai++, bi++) {
+        BOOST_CHECK_EQUAL( ai->timestamp, bi->timestamp );
+        BOOST_CHECK_EQUAL( ai->duration, bi->duration );
+        BOOST_CHECK_EQUAL( ai->avLikelihood, bi->avLikelihood );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( compiledModelMatchesGraph )
+{
+    PowerStateGraph psg;
+    trainWasher( &psg );
+    psg.compile();
+
+    const PowerStateGraph::PSGraph& graph = psg.powerStateGraph;
+    const PowerStateGraph::CompiledModel& model = psg.model;
+    BOOST_REQUIRE_EQUAL( model.firstOutEdge.size(), num_vertices( graph ) + 1 );
+    BOOST_REQUIRE_EQUAL( model.source.size(), num_edges( graph ) );
+
+    PowerStateGraph::PSG_vertex_iter v_i, v_end;
+    for (boost::tie(v_i, v_end) = vertices( graph ); v_i != v_end; v_i++) {
+        BOOST_CHECK_EQUAL( model.betweenSpikesMean[*v_i], graph[*v_i].betweenSpikes.mean );
+        BOOST_CHECK_EQUAL( model.betweenSpikesMin[*v_i], graph[*v_i].betweenSpikes.min );
+
+        // the out-edges are stored in the order out_edges() gives them
+        size_t e = model.firstOutEdge[*v_i];
+        PowerStateGraph::PSG_out_edge_iter e_i, e_end;
+        for (boost::tie(e_i, e_end) = out_edges( *v_i, graph ); e_i != e_end; e_i++, e++) {
+            BOOST_REQUIRE_LT( e, model.firstOutEdge[*v_i + 1] );
+            const PowerStateGraph::PowerStateEdge& edge = graph[*e_i];
+            BOOST_CHECK_EQUAL( model.source[e], *v_i );
+            BOOST_CHECK_EQUAL( model.target[e], target( *e_i, graph ) );
+            BOOST_CHECK_EQUAL( model.durationMean[e], edge.duration.mean );
+            BOOST_CHECK_EQUAL( model.durationMin[e], edge.duration.min );
+            BOOST_CHECK_EQUAL( model.durationMax[e], edge.duration.max );
+            BOOST_CHECK_EQUAL( model.durationNonZeroStdev[e], edge.duration.nonZeroStdev() );
+            BOOST_CHECK_EQUAL( model.durationSlack[e], (size_t)edge.duration.nonZeroStdev() );
+            BOOST_CHECK( model.edgeHistory[e] == edge.edgeHistory );
+            BOOST_CHECK_EQUAL( model.spikeSearch[e].mean, edge.delta.mean );
+            BOOST_CHECK_EQUAL( model.spikeSearch[e].stdev, edge.delta.nonZeroStdev() );
+        }
+        BOOST_CHECK_EQUAL( e, model.firstOutEdge[*v_i + 1] );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( threadCountDoesNotChangeResults )
+{
+    std::cout << "threadCountDoesNotChangeResults..." << std::endl;
+
+    PowerStateGraph psg;
+    Signature sig( "data/input/watts_up/washer.csv", 1, "washer", 1, 1, 2530 );
+    Signature sig2( "data/input/watts_up/washer2.csv", 1, "washer2", 1,1, 2000 );
+    psg.update( sig );
+    psg.update( sig2 );
+    psg.setDeviceName( "washer" );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+
+    psg.setNumThreads( 1 );
+    const std::list<PowerStateGraph::Fingerprint> serial = psg.disaggregate( aggData );
+
+    psg.setNumThreads( 4 );
+    const std::list<PowerStateGraph::Fingerprint> parallel = psg.disaggregate( aggData );
+
+    checkSameFingerprints( serial, parallel );
+}
+
+BOOST_AUTO_TEST_CASE( onlineMatchesBatch )
+{
+    std::cout << "onlineMatchesBatch..." << std::endl;
+
+    PowerStateGraph psg;
+    trainWasher( &psg );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+    const std::list<PowerStateGraph::Fingerprint> batch = psg.disaggregate( aggData, true );
+
+    // Feed the same samples in chunks of varying size
+    std::list<PowerStateGraph::Fingerprint> online;
+    size_t maxWindow;
+    {
+        OnlineDisaggregator disaggregator( &psg );
+        size_t i = 0, chunk = 1;
+        while ( i < aggData.getSize() ) {
+            const size_t n = std::min( chunk, aggData.getSize() - i );
+            disaggregator.appendSamples( &aggData[i], n, &online );
+            i += n;
+            chunk = (chunk % 7) + 1;
+        }
+        disaggregator.finish( &online );
+        BOOST_CHECK_EQUAL( disaggregator.getNumOpenCandidates(), 0 );
+        BOOST_CHECK_EQUAL( disaggregator.getNumOpenVertices(), 0 );
+        maxWindow = disaggregator.getPeakWindowSize();
+    }
+    online.sort( PowerStateGraph::Fingerprint::startsBefore );
+
+    // old samples must have been retired
+    BOOST_CHECK_GT( maxWindow, 0 );
+    BOOST_CHECK( maxWindow < aggData.getSize() );
+
+    BOOST_CHECK( ! batch.empty() );
+    checkSameFingerprints( online, batch );
+}
+
+/**
+ * Feed @c aggData to an OnlineDisaggregator one sample at a time.
+ *
+ * @return the fingerprints in start order.  @c emittedAt[ timestamp ]
+ *         is the number of samples appended before that fingerprint
+ *         was returned.
+ */
+const std::list<PowerStateGraph::Fingerprint> disaggregateOnline(
+        PowerStateGraph * psg,
+        const AggregateData& aggData,
+        std::map<size_t, size_t> * emittedAt /**< output parameter */
+        )
+{
+    std::list<PowerStateGraph::Fingerprint> online, finished;
+    OnlineDisaggregator disaggregator( psg );
+    for (size_t i=0; i<aggData.getSize(); i++) {
+        disaggregator.appendSamples( &aggData[i], 1, &finished );
+        for (std::list<PowerStateGraph::Fingerprint>::const_iterator f=finished.begin(); f!=finished.end(); f++)
+            (*emittedAt)[ f->timestamp ] = i + 1;
+        online.splice( online.end(), finished );
+    }
+    disaggregator.finish( &finished );
+    for (std::list<PowerStateGraph::Fingerprint>::const_iterator f=finished.begin(); f!=finished.end(); f++)
+        (*emittedAt)[ f->timestamp ] = aggData.getSize() + 1;
+    online.splice( online.end(), finished );
+    online.sort( PowerStateGraph::Fingerprint::startsBefore );
+    return online;
+}
+
+BOOST_AUTO_TEST_CASE( onlineFinishesEarlyWithBound )
+{
+    std::cout << "onlineFinishesEarlyWithBound..." << std::endl;
+
+    PowerStateGraph psg;
+    trainWasher( &psg );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+
+    std::map<size_t, size_t> unboundedAt, boundedAt;
+    const std::list<PowerStateGraph::Fingerprint> unbounded = disaggregateOnline( &psg, aggData, &unboundedAt );
+    psg.setPruning( 0, 0, 5 );
+    const std::list<PowerStateGraph::Fingerprint> bounded = disaggregateOnline( &psg, aggData, &boundedAt );
+
+    BOOST_CHECK( ! unbounded.empty() );
+    checkSameFingerprints( bounded, unbounded );
+    std::list<PowerStateGraph::Fingerprint>::const_iterator b = bounded.begin();
+    std::list<PowerStateGraph::Fingerprint>::const_iterator u = unbounded.begin();
+    size_t earlier = 0;
+    for (; b!=bounded.end(); b++, u++) {
+        // a candidate is never held back by the bound
+        BOOST_CHECK_LE( boundedAt[ b->timestamp ], unboundedAt[ u->timestamp ] );
+        if ( boundedAt[ b->timestamp ] < unboundedAt[ u->timestamp ] )
+            earlier++;
+    }
+    BOOST_CHECK_GT( earlier, 0 );
+}
+
+/**
+ * Copy @c src to @c dst, moving every sample at or after @c gapStart
+ * @c gapLength seconds later, as if the meter had been offline.
+ */
+void writeGappedCopy(
+        const std::string& src,
+        const std::string& dst,
+        const size_t gapStart,
+        const size_t gapLength
+        )
+{
+    std::ifstream in( src.c_str() );
+    std::ofstream out( dst.c_str() );
+    size_t timestamp, reading;
+    while ( in >> timestamp >> reading ) {
+        if ( timestamp >= gapStart )
+            timestamp += gapLength;
+        out << timestamp << "\t" << reading << "\n";
+    }
+}
+
+BOOST_AUTO_TEST_CASE( streamAcrossGap )
+{
+    std::cout << "streamAcrossGap..." << std::endl;
+
+    // one signature keeps the look-ahead shorter than the data
+    PowerStateGraph psg;
+    Signature sig( "data/input/watts_up/washer.csv", 1, "washer", 0 );
+    psg.update( sig );
+    psg.setDeviceName( "washer" );
+
+    // a five hour meter outage, longer than the look-ahead
+    const size_t gapLength = 5 * 3600;
+    BOOST_REQUIRE( gapLength > psg.streamingWindowDuration() );
+
+    char tmpDir[] = "/tmp/psgTestXXXXXX";
+    BOOST_REQUIRE( mkdtemp( tmpDir ) );
+    const std::string filename = std::string( tmpDir ) + "/gapped.csv";
+    writeGappedCopy( "data/input/current_cost/10July.csv", filename, 1310295600, gapLength );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( filename, false );
+    const std::list<PowerStateGraph::Fingerprint> batch = psg.disaggregate( aggData );
+
+    AggregateData streamed;
+    streamed.openCurrentCostStream( filename );
+    const std::list<PowerStateGraph::Fingerprint> stream = psg.disaggregateStream( &streamed );
+
+    BOOST_CHECK( ! batch.empty() );
+    checkSameFingerprints( stream, batch );
+
+    remove( filename.c_str() );
+    rmdir( tmpDir );
+}
+
+BOOST_AUTO_TEST_CASE( wideBeamMatchesExhaustive )
+{
+    std::cout << "wideBeamMatchesExhaustive..." << std::endl;
+
+    // BeamSearchBenchmark measures accuracy against runtime on a longer file
+    PowerStateGraph psg;
+    trainWasher( &psg );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+    const std::list<PowerStateGraph::Fingerprint> exhaustive = psg.disaggregate( aggData );
+
+    // A beam wide enough to keep every step must give the exhaustive result
+    psg.setBeamSearch( 1000000 );
+    const std::list<PowerStateGraph::Fingerprint> unbounded = psg.disaggregate( aggData );
+    BOOST_CHECK( ! exhaustive.empty() );
+    checkSameFingerprints( unbounded, exhaustive );
+}
+
+/**
+ * The branches pruned by one call to disaggregate(), read back from
+ * the report finishDisaggregation() prints.
+ */
+struct PruningReport {
+    size_t energy, duration, likelihood;
+    bool tooTight; /**< did it warn that the limits may be too tight? */
+};
+
+const std::list<PowerStateGraph::Fingerprint> disaggregateWithReport(
+        PowerStateGraph * psg,
+        const AggregateData& aggData,
+        PruningReport * report /**< output parameter */
+        )
+{
+    std::ostringstream out;
+    std::streambuf * coutBuf = std::cout.rdbuf( out.rdbuf() );
+    const std::list<PowerStateGraph::Fingerprint> fingerprints = psg->disaggregate( aggData );
+    std::cout.rdbuf( coutBuf );
+
+    const std::string printed = out.str();
+    const size_t line = printed.find( "Pruned " );
+    BOOST_REQUIRE( line != std::string::npos );
+    size_t total;
+    BOOST_REQUIRE_EQUAL( sscanf( printed.c_str() + line,
+            "Pruned %zu DisagTree branches: %zu over the energy limit, %zu over the duration limit and %zu",
+            &total, &report->energy, &report->duration, &report->likelihood ), 4 );
+    BOOST_CHECK_EQUAL( total, report->energy + report->duration + report->likelihood );
+    report->tooTight = printed.find( "limits may be too tight" ) != std::string::npos;
+    return fingerprints;
+}
+
+BOOST_AUTO_TEST_CASE( pruningKeepsResults )
+{
+    std::cout << "pruningKeepsResults..." << std::endl;
+
+    PowerStateGraph psg;
+    trainWasher( &psg );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+    const std::list<PowerStateGraph::Fingerprint> unpruned = psg.disaggregate( aggData );
+    BOOST_CHECK( ! unpruned.empty() );
+
+    // Each limit on its own, then all three.  None is tight enough
+    // to change the result on this data but each prunes something.
+    const double energyFactors[]   = {1, 0, 0, 1};
+    const double durationFactors[] = {0, 1, 0, 1};
+    const size_t remainingEdges[]  = {0, 0, 5, 5};
+    for (size_t i=0; i<4; i++) {
+        psg.setPruning( energyFactors[i], durationFactors[i], remainingEdges[i] );
+        PruningReport report;
+        const std::list<PowerStateGraph::Fingerprint> pruned = disaggregateWithReport( &psg, aggData, &report );
+
+        BOOST_CHECK_EQUAL( report.energy > 0, energyFactors[i] > 0 );
+        BOOST_CHECK_EQUAL( report.duration > 0, durationFactors[i] > 0 );
+        BOOST_CHECK_EQUAL( report.likelihood > 0, remainingEdges[i] > 0 );
+        BOOST_CHECK( ! report.tooTight );
+
+        checkSameFingerprints( pruned, unpruned );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( tooTightPruningIsReported )
+{
+    std::cout << "tooTightPruningIsReported..." << std::endl;
+
+    PowerStateGraph psg;
+    trainWasher( &psg );
+
+    AggregateData aggData;
+    aggData.loadCurrentCostData( "data/input/current_cost/10July.csv", false );
+
+    // No washer run is this short so every path gets pruned
+    psg.setPruning( 0, 0.3, 0 );
+    PruningReport report;
+    const std::list<PowerStateGraph::Fingerprint> pruned = disaggregateWithReport( &psg, aggData, &report );
+    BOOST_CHECK( pruned.empty() );
+    BOOST_CHECK_GT( report.duration, 0 );
+    BOOST_CHECK( report.tooTight );
+}
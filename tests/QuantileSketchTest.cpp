@@ -0,0 +1,164 @@
+#define BOOST_TEST_MODULE QuantileSketch test
+#define BOOST_TEST_DYN_LINK
+#include "../src/QuantileSketch.h"
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+/**
+ * @return the fraction of @c sorted which is <= @c value
+ */
+double rankOf( const std::vector<double>& sorted, const double value )
+{
+    return (double)( std::upper_bound( sorted.begin(), sorted.end(), value ) - sorted.begin() ) / sorted.size();
+}
+
+BOOST_AUTO_TEST_CASE( exactWhileSmall )
+{
+    QuantileSketch<int> sketch( 128 );
+    BOOST_CHECK_EQUAL( sketch.quantile( 0.5 ), 0 );
+
+    std::vector<int> values;
+    for (int i=0; i<50; i++) {
+        values.push_back( (i * 37) % 50 );
+        sketch.add( values.back() );
+    }
+    std::sort( values.begin(), values.end() );
+
+    // nothing has been compacted yet so the answers are exact
+    BOOST_CHECK_EQUAL( sketch.getNumRetained(), 50 );
+    BOOST_CHECK_EQUAL( sketch.quantile( 0 ),    values.front() );
+    BOOST_CHECK_EQUAL( sketch.quantile( 0.02 ), values[0] );
+    BOOST_CHECK_EQUAL( sketch.quantile( 0.5 ),  values[24] );
+    BOOST_CHECK_EQUAL( sketch.quantile( 0.51 ), values[25] );
+    BOOST_CHECK_EQUAL( sketch.quantile( 1 ),    values.back() );
+}
+
+BOOST_AUTO_TEST_CASE( boundedRankError )
+{
+    const size_t N = 200000;
+    const size_t K = 128;
+
+    srand( 42 );
+    std::vector<double> values( N );
+    for (size_t i=0; i<N; i++) {
+        // skewed, with a long upper tail
+        const double u = (double)rand() / RAND_MAX;
+        values[i] = 100 + 1000 * u * u * u;
+    }
+
+    QuantileSketch<double> sketch( K );
+    for (size_t i=0; i<N; i++) {
+        sketch.add( values[i] );
+    }
+    std::sort( values.begin(), values.end() );
+
+    BOOST_CHECK_EQUAL( sketch.getNumDataPoints(), N );
+    BOOST_CHECK_LT( sketch.getNumRetained(), 4*K );
+    BOOST_CHECK_EQUAL( sketch.quantile( 0 ), values.front() );
+    BOOST_CHECK_EQUAL( sketch.quantile( 1 ), values.back() );
+
+    for (double q=0.01; q<1; q+=0.01) {
+        BOOST_CHECK_SMALL( rankOf( values, sketch.quantile( q ) ) - q, 0.03 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( merge )
+{
+    const size_t N = 100000;
+    const size_t NUM_PARTS = 7;
+
+    srand( 7 );
+    std::vector<double> values( N );
+    std::vector< QuantileSketch<double> > parts( NUM_PARTS );
+    QuantileSketch<double> merged;
+    for (size_t i=0; i<N; i++) {
+        // each part sees a different range of values
+        const size_t part = i % NUM_PARTS;
+        values[i] = part * 100 + (rand() % 1000);
+        parts[part].add( values[i] );
+    }
+    for (size_t p=0; p<NUM_PARTS; p++) {
+        merged.merge( parts[p] );
+    }
+    merged.merge( QuantileSketch<double>() ); // merging an empty sketch changes nothing
+    std::sort( values.begin(), values.end() );
+
+    BOOST_CHECK_EQUAL( merged.getNumDataPoints(), N );
+    BOOST_CHECK_LT( merged.getNumRetained(), 4*128 );
+    BOOST_CHECK_EQUAL( merged.quantile( 0 ), values.front() );
+    BOOST_CHECK_EQUAL( merged.quantile( 1 ), values.back() );
+    for (double q=0.05; q<1; q+=0.05) {
+        BOOST_CHECK_SMALL( rankOf( values, merged.quantile( q ) ) - q, 0.03 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( reservoir )
+{
+    Reservoir<int> disabled;
+    disabled.add( 1 );
+    BOOST_CHECK( disabled.getSamples().empty() );
+    BOOST_CHECK_LT( sizeof( Reservoir<int> ), sizeof( std::mt19937 ) );
+
+    const size_t CAPACITY = 400;
+    Reservoir<int> zeros( CAPACITY, 1 );
+    Reservoir<int> ones( CAPACITY, 2 );
+    for (size_t i=0; i<1000; i++) {
+        zeros.add( 0 );
+    }
+    for (size_t i=0; i<3000; i++) {
+        ones.add( 1 );
+    }
+    BOOST_CHECK_EQUAL( zeros.getSamples().size(), CAPACITY );
+    BOOST_CHECK_EQUAL( ones.getNumDataPoints(), 3000 );
+
+    // A quarter of the merged data are zeros so about a quarter of the
+    // merged sample should be too (the stdev of the count is about 9).
+    zeros.merge( ones );
+    BOOST_CHECK_EQUAL( zeros.getNumDataPoints(), 4000 );
+    BOOST_REQUIRE_EQUAL( zeros.getSamples().size(), CAPACITY );
+    const size_t numOnes = std::count( zeros.getSamples().begin(), zeros.getSamples().end(), 1 );
+    BOOST_CHECK_GT( numOnes, 250 );
+    BOOST_CHECK_LT( numOnes, 350 );
+
+    // Every value of a stream is equally likely to be in the sample
+    Reservoir<int> stream( 100, 3 );
+    for (int i=0; i<10000; i++) {
+        stream.add( i );
+    }
+    size_t inFirstHalf = 0;
+    for (size_t i=0; i<stream.getSamples().size(); i++) {
+        if ( stream.getSamples()[i] < 5000 )
+            inFirstHalf++;
+    }
+    BOOST_CHECK_GT( inFirstHalf, 30 );
+    BOOST_CHECK_LT( inFirstHalf, 70 );
+
+    // A smaller reservoir runs out of values before its share is drawn
+    Reservoir<int> big( 10, 4 ), small( 2, 5 ), tiny( 10, 6 );
+    for (int i=0; i<1000; i++) {
+        big.add( 0 );
+        small.add( 1 );
+    }
+    big.merge( small );
+    BOOST_CHECK_EQUAL( big.getNumDataPoints(), 2000 );
+    BOOST_CHECK_EQUAL( big.getSamples().size(), 10 );
+    BOOST_CHECK_LE( std::count( big.getSamples().begin(), big.getSamples().end(), 1 ), 2 );
+
+    // ... and both pools can run out before the capacity is reached
+    tiny.add( 0 );
+    tiny.merge( small );
+    BOOST_CHECK_EQUAL( tiny.getSamples().size(), 3 );
+
+    // merging small reservoirs keeps every value
+    Reservoir<int> a( 10 ), b( 10 );
+    a.add( 1 ); a.add( 2 );
+    b.add( 3 );
+    a.merge( b );
+    std::vector<int> merged( a.getSamples() );
+    std::sort( merged.begin(), merged.end() );
+    BOOST_REQUIRE_EQUAL( merged.size(), 3 );
+    BOOST_CHECK_EQUAL( merged[0], 1 );
+    BOOST_CHECK_EQUAL( merged[2], 3 );
+}
@@ -0,0 +1,52 @@
+#define BOOST_TEST_MODULE RangeMinimum test
+#define BOOST_TEST_DYN_LINK
+#include "../src/RangeMinimum.h"
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <cstdlib>
+
+BOOST_AUTO_TEST_CASE( compareWithLinearScan )
+{
+    // Sizes either side of the block size and a few blocks long
+    const size_t sizes[] = { 1, 2, 31, 32, 33, 64, 65, 200, 1000 };
+
+    srand( 42 );
+    for (size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+        const size_t n = sizes[s];
+        std::vector<int> values( n );
+        for (size_t i=0; i<n; i++) {
+            values[i] = rand() % 50; // plenty of duplicates
+        }
+
+        RangeMinimum<int> rmq;
+        rmq.build( values.begin(), n );
+        BOOST_REQUIRE_EQUAL( rmq.size(), n );
+
+        size_t mismatches = 0;
+        for (size_t first=0; first<n; first++) {
+            int expected = values[first];
+            for (size_t last=first+1; last<=n; last++) {
+                if ( values[last-1] < expected )
+                    expected = values[last-1];
+                if ( rmq.min( first, last ) != expected )
+                    mismatches++;
+            }
+        }
+        BOOST_CHECK_EQUAL( mismatches, 0 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( sortedInput )
+{
+    // Descending input stresses the mask stack (nothing is ever popped)
+    std::vector<size_t> values( 100 );
+    for (size_t i=0; i<100; i++) {
+        values[i] = 100 - i;
+    }
+
+    RangeMinimum<size_t> rmq;
+    rmq.build( values.begin(), values.size() );
+    BOOST_CHECK_EQUAL( rmq.min( 0, 100 ), 1 );
+    BOOST_CHECK_EQUAL( rmq.min( 0, 50 ), 51 );
+    BOOST_CHECK_EQUAL( rmq.minIndex( 10, 90 ), 89 );
+}
@@ -5,6 +5,7 @@
 #include "../src/Array.h"
 #include <boost/test/unit_test.hpp>
 #include <iostream>
+#include <type_traits> // is_trivially_copyable
 
 BOOST_AUTO_TEST_CASE( constructorAndUpdateTest )
 {
@@ -102,3 +103,136 @@ BOOST_AUTO_TEST_CASE( singleStatsTest )
     BOOST_CHECK_EQUAL( stat.getNumDataPoints(), 3 );
 
 }
+
+BOOST_AUTO_TEST_CASE( streamingMatchesExactTest )
+{
+    // values with a large offset, which would upset a naive sum-of-squares
+    const size_t SIZE = 1000;
+    Array<double> src(SIZE);
+    for (size_t i=0; i<SIZE; i++) {
+        src[i] = 1e9 + ((i * 7919) % 101) * 0.5;
+    }
+
+    Statistic<double, ExactDataStore<double> > exact( src, 0, 100 );
+    Statistic<double, StreamingMoments<double> > streaming( src, 0, 100 );
+
+    for (size_t i=100; i<SIZE; i++) {
+        exact.update( src[i] );
+        streaming.update( src[i] );
+    }
+
+    BOOST_CHECK_EQUAL( streaming.getNumDataPoints(), exact.getNumDataPoints() );
+    BOOST_CHECK_EQUAL( streaming.getMean(), exact.getMean() );
+    BOOST_CHECK_CLOSE( streaming.getStdev(), exact.getStdev(), 1e-6 );
+    BOOST_CHECK_EQUAL( streaming.getMin(), exact.getMin() );
+    BOOST_CHECK_EQUAL( streaming.getMax(), exact.getMax() );
+
+    // and merging with another Statistic
+    Statistic<double, ExactDataStore<double> > exact2( src, 500, 800 );
+    Statistic<double, StreamingMoments<double> > streaming2( src, 500, 800 );
+    exact.update( exact2 );
+    streaming.update( streaming2 );
+
+    BOOST_CHECK_EQUAL( streaming.getNumDataPoints(), SIZE + 300 );
+    BOOST_CHECK_CLOSE( streaming.getMean(), exact.getMean(), 1e-12 );
+    BOOST_CHECK_CLOSE( streaming.getStdev(), exact.getStdev(), 1e-6 );
+    BOOST_CHECK_EQUAL( exact.storage.dataStore.size(), SIZE + 300 );
+}
+
+BOOST_AUTO_TEST_CASE( mergeTest )
+{
+    const size_t SIZE = 1000;
+    Array<double> src(SIZE);
+    for (size_t i=0; i<SIZE; i++) {
+        src[i] = 230.0 + ((i * 104729) % 997) * 0.25;
+    }
+    Statistic<double> whole( src );
+
+    // merging into an empty Statistic and merging an empty one
+    Statistic<double> stat;
+    stat.update( Statistic<double>( src, 0, 400 ) );
+    stat.update( Statistic<double>() );
+    stat.update( Statistic<double>( src, 400, SIZE ) );
+
+    BOOST_CHECK_EQUAL( stat.getNumDataPoints(), SIZE );
+    BOOST_CHECK_CLOSE( stat.getMean(),  whole.getMean(),  1e-10 );
+    BOOST_CHECK_CLOSE( stat.getStdev(), whole.getStdev(), 1e-8 );
+    BOOST_CHECK_EQUAL( stat.getMin(), whole.getMin() );
+    BOOST_CHECK_EQUAL( stat.getMax(), whole.getMax() );
+
+    // tree reduction of uneven partials, including an empty one
+    const size_t bounds[] = {0, 1, 10, 10, 333, 334, 700, 999, SIZE};
+    const size_t numBounds = sizeof(bounds)/sizeof(size_t);
+    std::vector< Statistic<double> > partials;
+    for (size_t b=0; b+1<numBounds; b++) {
+        if (bounds[b] == bounds[b+1])
+            partials.push_back( Statistic<double>() );
+        else
+            partials.push_back( Statistic<double>( src, bounds[b], bounds[b+1] ) );
+    }
+
+    const Statistic<double> reduced = Statistic<double>::reduce( partials );
+    BOOST_CHECK_EQUAL( reduced.getNumDataPoints(), SIZE );
+    BOOST_CHECK_CLOSE( reduced.getMean(),  whole.getMean(),  1e-10 );
+    BOOST_CHECK_CLOSE( reduced.getStdev(), whole.getStdev(), 1e-8 );
+    BOOST_CHECK_EQUAL( reduced.getMin(), whole.getMin() );
+    BOOST_CHECK_EQUAL( reduced.getMax(), whole.getMax() );
+
+    BOOST_CHECK_EQUAL( Statistic<double>::reduce( std::vector< Statistic<double> >() ).getNumDataPoints(), 0 );
+
+    // the exact policy gives the same answer
+    std::vector< Statistic<double, ExactDataStore<double> > > exactPartials;
+    for (size_t b=0; b+1<numBounds; b++) {
+        if (bounds[b] != bounds[b+1])
+            exactPartials.push_back( Statistic<double, ExactDataStore<double> >( src, bounds[b], bounds[b+1] ) );
+    }
+    const Statistic<double, ExactDataStore<double> > exactReduced =
+            Statistic<double, ExactDataStore<double> >::reduce( exactPartials );
+    BOOST_CHECK_EQUAL( exactReduced.storage.dataStore.size(), SIZE );
+    BOOST_CHECK_CLOSE( exactReduced.getStdev(), whole.getStdev(), 1e-8 );
+}
+
+BOOST_AUTO_TEST_CASE( summaryTest )
+{
+    BOOST_CHECK( std::is_trivially_copyable<StatSummary>::value );
+
+    int pop[] = {5,4,5,6,5,4,5,5,4,6,6,5,4,5};
+    Array<int> src(sizeof(pop)/sizeof(int), pop);
+    Statistic<int> stat( src );
+    Statistic<int, ExactDataStore<int> > exact( src, 0, 10 );
+
+    const StatSummary s = stat.summary();
+    BOOST_CHECK_EQUAL( s.mean,  stat.mean );
+    BOOST_CHECK_EQUAL( s.stdev, stat.stdev );
+    BOOST_CHECK_EQUAL( s.min,   4 );
+    BOOST_CHECK_EQUAL( s.max,   6 );
+    BOOST_CHECK_EQUAL( s.numDataPoints, stat.numDataPoints );
+
+    // the Statistic functions give the same answers as the summary's
+    Statistic<int> other( src, 0, 10 );
+    BOOST_CHECK_EQUAL( stat.tTest( other ), s.tTest( other.summary() ) );
+    BOOST_CHECK_EQUAL( stat.similar( other ), s.similar( other.summary() ) );
+    BOOST_CHECK_EQUAL( stat.nonZeroStdev(), s.nonZeroStdev() );
+    BOOST_CHECK_EQUAL( stat.normalisedLikelihood( 4.5 ), s.normalisedLikelihood( 4.5 ) );
+    BOOST_CHECK_CLOSE( s.normalisedLikelihood( stat.mean ), 1.0, 1e-10 );
+
+    // and summaries let Statistics with different storage be compared
+    BOOST_CHECK_CLOSE( exact.summary().tTest( s ), other.summary().tTest( s ), 1e-8 );
+    BOOST_CHECK( exact.summary().similar( s ) );
+}
+
+BOOST_AUTO_TEST_CASE( exactQuantileSeesNewData )
+{
+    int pop[] = {5,1,4,2,3};
+    Array<int> src(sizeof(pop)/sizeof(int), pop);
+    Statistic<int, ExactDataStore<int> > exact( src );
+    BOOST_CHECK_EQUAL( exact.quantile( 0.5 ), 3 );
+    BOOST_CHECK_EQUAL( exact.quantile( 0.2 ), 1 );
+
+    // the sorted copy kept by quantile() must not go stale
+    exact.update( 12 );
+    exact.update( 10 );
+    exact.update( 11 );
+    BOOST_CHECK_EQUAL( exact.quantile( 0.5 ), 4 );
+    BOOST_CHECK_EQUAL( exact.quantile( 1 ), 12 );
+}